@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Times push and concat workloads with each allocator backend: Boehm GC (when
+ * built with it), the system allocator and a slab allocator. The slab is
+ * destroyed after every round, which is how it's meant to be used. A batch
+ * build through a transient is timed with and without an arena as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "rrb.h"
+
+#define PUSHES 1000000
+#define CONCATS 20000
+#define BATCH_EDITS 200000
+#define ROUNDS 5
+
+static intptr_t push_workload() {
+  const RRB *rrb = rrb_create();
+  for (uint32_t i = 0; i < PUSHES; i++) {
+    rrb = rrb_push(rrb, (void *) ((intptr_t) i));
+  }
+  return (intptr_t) rrb_nth(rrb, PUSHES / 2);
+}
+
+static intptr_t concat_workload() {
+  const RRB *rrb = rrb_create();
+  for (uint32_t i = 0; i < 1000; i++) {
+    rrb = rrb_push(rrb, (void *) ((intptr_t) i));
+  }
+  for (uint32_t i = 0; i < CONCATS; i++) {
+    const uint32_t cnt = rrb_count(rrb);
+    const uint32_t from = (uint32_t) rand() % cnt;
+    const uint32_t to = from + (uint32_t) rand() % (cnt - from) + 1;
+    rrb = rrb_concat(rrb_slice(rrb, 0, to), rrb_slice(rrb, from, cnt));
+    if (rrb_count(rrb) > 1000000) {
+      rrb = rrb_slice(rrb, 0, 1000000);
+    }
+  }
+  return (intptr_t) rrb_nth(rrb, rrb_count(rrb) / 2);
+}
+
+// Builds a tree through random edits on a transient, the way a batch builder
+// would.
+static intptr_t batch_workload(TransientRRB* (*to_transient)(const RRB *)) {
+  TransientRRB *trrb = to_transient(rrb_create());
+  for (uint32_t i = 0; i < BATCH_EDITS; i++) {
+    const uint32_t cnt = transient_rrb_count(trrb);
+    const void *elt = (void *) ((intptr_t) i);
+    switch (cnt == 0 ? 0 : rand() % 4) {
+    case 0:
+      trrb = transient_rrb_push(trrb, elt);
+      break;
+    case 1:
+      trrb = transient_rrb_insert_at(trrb, (uint32_t) rand() % cnt, elt);
+      break;
+    case 2:
+      trrb = transient_rrb_update(trrb, (uint32_t) rand() % cnt, elt);
+      break;
+    default:
+      trrb = transient_rrb_push_front(trrb, elt);
+      break;
+    }
+  }
+  const RRB *rrb = transient_to_rrb(trrb);
+  return (intptr_t) rrb_nth(rrb, rrb_count(rrb) / 2);
+}
+
+static intptr_t transient_workload() {
+  return batch_workload(rrb_to_transient);
+}
+
+static intptr_t arena_workload() {
+  return batch_workload(rrb_to_transient_arena);
+}
+
+// Reports the best round, the others are mostly noise from other processes.
+static void run(const char *name, const RRBAllocator *allocator, char slab,
+                intptr_t (*workload)(void), const char *workload_name) {
+  intptr_t sum = 0;
+  double best = 0;
+  srand(1);
+  for (uint32_t round = 0; round < ROUNDS; round++) {
+    RRBAllocator *round_slab = NULL;
+    if (slab) {
+      round_slab = rrb_slab_allocator_create();
+      allocator = round_slab;
+    }
+    rrb_set_allocator(allocator);
+    const clock_t start = clock();
+    sum += workload();
+    const clock_t end = clock();
+    rrb_set_allocator(NULL);
+    if (slab) {
+      rrb_slab_allocator_destroy(round_slab);
+    }
+    const double secs = ((double) (end - start)) / CLOCKS_PER_SEC;
+    if (round == 0 || secs < best) {
+      best = secs;
+    }
+  }
+  printf("%s, %s: %.3f s (checksum %ld)\n", name, workload_name, best,
+         (long) sum);
+}
+
+int main() {
+  if (rrb_gc_allocator() != NULL) {
+    run("gc", rrb_gc_allocator(), 0, push_workload, "pushes");
+    run("gc", rrb_gc_allocator(), 0, concat_workload, "concats");
+    run("gc", rrb_gc_allocator(), 0, transient_workload, "transient edits");
+    run("gc", rrb_gc_allocator(), 0, arena_workload, "arena edits");
+  }
+  run("malloc", rrb_malloc_allocator(), 0, push_workload, "pushes");
+  run("malloc", rrb_malloc_allocator(), 0, concat_workload, "concats");
+  run("malloc", rrb_malloc_allocator(), 0, transient_workload,
+      "transient edits");
+  run("malloc", rrb_malloc_allocator(), 0, arena_workload, "arena edits");
+  run("slab", NULL, 1, push_workload, "pushes");
+  run("slab", NULL, 1, concat_workload, "concats");
+  return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Times rrb_nth on relaxed trees built the same way test_fibocat.c builds
+ * them.
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "rrb.h"
+
+#ifndef MIN
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#endif
+
+#define RRB_COUNT 2600
+#define PREDEF_RRBS 200
+#define MAX_INIT_SIZE (MIN(RRB_BRANCHING,16))
+#define LOOKUPS 10000000
+#define INDICES 4096
+#define ROUNDS 7
+
+static const RRB* rand_rrb() {
+  const uint32_t size = (uint32_t) (rand() % MAX_INIT_SIZE);
+  const RRB *rrb = rrb_create();
+  for (uint32_t i = 0; i < size; i++) {
+    rrb = rrb_push(rrb, (void *) ((intptr_t) rand() & 0xffff));
+  }
+  return rrb;
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  srand(argc == 2 ? (unsigned int) atoi(argv[1]) : 1);
+
+  const RRB **rrbs = GC_MALLOC(sizeof(RRB *) * RRB_COUNT);
+  for (uint32_t i = 0; i < PREDEF_RRBS; i++) {
+    rrbs[i] = rand_rrb();
+  }
+  for (uint32_t i = PREDEF_RRBS; i < RRB_COUNT; i++) {
+    rrbs[i] = rrb_concat(rrbs[i - PREDEF_RRBS], rrbs[i - PREDEF_RRBS + 1]);
+  }
+  const RRB *rrb = rrbs[RRB_COUNT - 1];
+  const uint32_t count = rrb_count(rrb);
+
+  uint32_t *indices = GC_MALLOC_ATOMIC(sizeof(uint32_t) * INDICES);
+  for (uint32_t i = 0; i < INDICES; i++) {
+    indices[i] = (uint32_t) rand() % count;
+  }
+
+  // Report the best round, the others are mostly noise from other processes.
+  intptr_t sum = 0;
+  double best = 0;
+  for (uint32_t round = 0; round < ROUNDS; round++) {
+    const clock_t start = clock();
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+      sum += (intptr_t) rrb_nth(rrb, indices[i % INDICES]);
+    }
+    const clock_t end = clock();
+    const double secs = ((double) (end - start)) / CLOCKS_PER_SEC;
+    if (round == 0 || secs < best) {
+      best = secs;
+    }
+  }
+
+  printf("%u elements, %d lookups: %.3f s, %.1f ns/lookup (checksum %ld)\n",
+         count, LOOKUPS, best, best * 1e9 / LOOKUPS, (long) sum);
+  return 0;
+}
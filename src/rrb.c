@@ -27,7 +27,6 @@
 #include <string.h>
 #include "rrb.h"
 
-
 #ifndef true
 #define true 1
 #endif
@@ -50,19 +49,37 @@
 #define DEC_SHIFT(shift) (shift - (uint32_t) RRB_BITS)
 #define LEAF_NODE_SHIFT ((uint32_t) 0)
 
-// Abusing allocated pointers being unique to create GUIDs: using a single
-// malloc to create a guid.
+#ifdef __GNUC__
+#define RRB_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define RRB_PREFETCH(addr) ((void) (addr))
+#endif
+
+// The transient that may edit a node in place, see rrb_guid_create.
 #define GUID_DECLARATION const void *guid;
 
+// Built with RRB_REFCOUNT, the library frees memory through reference counts
+// instead of relying on a tracing collector. The count comes first in every
+// node, size table and RRB head, see rrb_refcount.h.
+#ifdef RRB_REFCOUNT
+#define REFS_DECLARATION uint32_t refs;
+#define STATIC_REFS_INITIALIZER .refs = RRB_STATIC_REFS,
+#else
+#define REFS_DECLARATION
+#define STATIC_REFS_INITIALIZER
+#endif
+
 typedef enum {LEAF_NODE, INTERNAL_NODE} NodeType;
 
 typedef struct TreeNode {
+  REFS_DECLARATION
   NodeType type;
   uint32_t len;
   GUID_DECLARATION
 } TreeNode;
 
 typedef struct LeafNode {
+  REFS_DECLARATION
   NodeType type;
   uint32_t len;
   GUID_DECLARATION
@@ -70,11 +87,13 @@ typedef struct LeafNode {
 } LeafNode;
 
 typedef struct RRBSizeTable {
+  REFS_DECLARATION
   GUID_DECLARATION
   uint32_t size[];
 } RRBSizeTable;
 
 typedef struct InternalNode {
+  REFS_DECLARATION
   NodeType type;
   uint32_t len;
   GUID_DECLARATION
@@ -82,45 +101,167 @@ typedef struct InternalNode {
   struct InternalNode *child[];
 } InternalNode;
 
+// cnt is the number of items in the trie and the tail. The head holds the
+// first head_len items in front of them, so that pushing and popping at the
+// front only touches the trie once per leaf, the way the tail does at the back.
+// The items of a pointer_free RRB-tree are not pointers, so its leaves are
+// allocated atomically.
 struct RRB_ {
+  REFS_DECLARATION
   uint32_t cnt;
   uint32_t shift;
   uint32_t tail_len;
   LeafNode *tail;
   TreeNode *root;
+  uint32_t head_len;
+  char pointer_free;
+  LeafNode *head; // may be NULL if head_len is 0
+};
+
+struct RRBIterator_ {
+  const RRB *rrb;
+  uint32_t index;
+  uint32_t leaf_start; // index of the first element in leaf
+  const LeafNode *leaf;
+  uint32_t height; // number of internal nodes in path, 0 when leaf is the tail
+  const InternalNode *path[RRB_MAX_HEIGHT+1];
+  uint32_t path_idx[RRB_MAX_HEIGHT+1];
+};
+
+struct RRBCursor_ {
+  const RRB *rrb;
+  // The edit count of the transient the cursor is over, NULL if it's over a
+  // persistent RRB-tree, and its value when the path was cached.
+  const uint32_t *edits;
+  uint32_t seen_edits;
+  const LeafNode *leaf; // NULL if no path is cached
+  uint32_t leaf_start;
+  uint32_t height;
+  const InternalNode *path[RRB_MAX_HEIGHT+1];
+  uint32_t path_idx[RRB_MAX_HEIGHT+1];
+  // index range [path_start, path_end) covered by each node in path
+  uint32_t path_start[RRB_MAX_HEIGHT+1];
+  uint32_t path_end[RRB_MAX_HEIGHT+1];
 };
 
-static LeafNode EMPTY_LEAF = {.type = LEAF_NODE, .len = 0};
-static const RRB EMPTY_RRB = {.cnt = 0, .shift = 0, .root = NULL,
-                              .tail_len = 0, .tail = &EMPTY_LEAF};
+#ifdef RRB_REFCOUNT
+#include "rrb_refcount.h"
+#else
+#define RRB_FRESH(obj) ((void) 0)
+#define RRB_REFS_RESET(obj) ((void) 0)
+#define RRB_SCOPE_BEGIN() ((void) 0)
+#define RRB_SCOPE_END(rrb) (rrb)
+#define RRB_SCOPE_END_MANY(rrbs, n) ((void) (rrbs), (void) (n))
+#define RRB_CALLBACKS_BEGIN() ((void) 0)
+#define RRB_CALLBACKS_END() ((void) 0)
+#endif
+
+static LeafNode EMPTY_LEAF = {STATIC_REFS_INITIALIZER
+                              .type = LEAF_NODE, .len = 0};
+static const RRB EMPTY_RRB = {STATIC_REFS_INITIALIZER
+                              .cnt = 0, .shift = 0, .root = NULL,
+                              .tail_len = 0, .tail = &EMPTY_LEAF,
+                              .head_len = 0, .head = NULL};
+static const RRB EMPTY_POINTER_FREE_RRB = {STATIC_REFS_INITIALIZER
+                                           .cnt = 0, .shift = 0, .root = NULL,
+                                           .tail_len = 0, .tail = &EMPTY_LEAF,
+                                           .head_len = 0, .head = NULL,
+                                           .pointer_free = true};
+
+// The pieces a sort is split into, so that they can be run one by one, or in
+// parallel.
+typedef struct SortState_ SortState;
+typedef void (*SortRunner)(SortState *state, uint32_t pieces);
 
 static RRBSizeTable* size_table_create(uint32_t len);
 static RRBSizeTable* size_table_clone(const RRBSizeTable* original, uint32_t len);
 static RRBSizeTable* size_table_inc(const RRBSizeTable *original, uint32_t len);
 
+static RRB* rrb_from_leaves(TreeNode **nodes, uint32_t nodes_len,
+                            LeafNode *tail, uint32_t n, char pointer_free);
+
 static InternalNode* concat_sub_tree(TreeNode *left_node, uint32_t left_shift,
                                      TreeNode *right_node, uint32_t right_shift,
-                                     char is_top);
+                                     char is_top, char pointer_free);
 static InternalNode* rebalance(InternalNode *left, InternalNode *centre,
                                InternalNode *right, uint32_t shift,
-                               char is_top);
+                               char is_top, char pointer_free);
 static uint32_t* create_concat_plan(InternalNode *all, uint32_t *top_len);
 static InternalNode* execute_concat_plan(InternalNode *all, uint32_t *node_sizes,
-                                         uint32_t slen, uint32_t shift);
+                                         uint32_t slen, uint32_t shift,
+                                         char pointer_free);
 static uint32_t find_shift(TreeNode *node);
+static InternalNode* rebalance_nodes(InternalNode *all, uint32_t shift,
+                                     char pointer_free);
+static InternalNode* concat_nodes(TreeNode *const *nodes,
+                                  const uint32_t *shifts, uint32_t n,
+                                  uint32_t shift, char pointer_free);
+static TreeNode* concat_trees(TreeNode *const *nodes, const uint32_t *shifts,
+                              uint32_t n, uint32_t *shift, char pointer_free);
 static InternalNode* set_sizes(InternalNode *node, uint32_t shift);
 static uint32_t size_sub_trie(TreeNode *node, uint32_t parent_shift);
+static inline uint32_t size_table_search(const RRBSizeTable *table,
+                                         uint32_t pos, uint32_t index);
 static uint32_t sized_pos(const InternalNode *node, uint32_t *index,
                           uint32_t sp);
 static const InternalNode* sized(const InternalNode *node, uint32_t *index,
                                  uint32_t sp);
-
-static LeafNode* leaf_node_clone(const LeafNode *original);
-static LeafNode* leaf_node_inc(const LeafNode *original);
-static LeafNode* leaf_node_dec(const LeafNode *original);
-static LeafNode* leaf_node_create(uint32_t size);
-static LeafNode* leaf_node_merge(LeafNode *left_leaf, LeafNode *right_leaf);
-
+static void nth_many_rec(const InternalNode *node, uint32_t shift,
+                         uint32_t start, const uint64_t *keys, uint32_t n,
+                         void **out);
+static int uint64_cmp(const void *a, const void *b);
+static inline char bound_after(const void *elt, const void *key,
+                               RRBCmpFn cmp, void *ctx, char upper);
+static uint32_t leaf_bound(const void *const *items, uint32_t len,
+                           const void *key, RRBCmpFn cmp, void *ctx,
+                           char upper);
+static uint32_t rrb_bound(const RRB *rrb, const void *key, RRBCmpFn cmp,
+                          void *ctx, char upper);
+static InternalNode* update_many_rec(const InternalNode *node, uint32_t shift,
+                                     uint32_t start, const uint32_t *indices,
+                                     const void *const *elts, uint32_t n,
+                                     char pointer_free);
+static LeafNode* leaf_node_write(const LeafNode *original, uint32_t from,
+                                 const void *const *elts, uint32_t n,
+                                 char pointer_free);
+static InternalNode* write_range_rec(const InternalNode *node, uint32_t shift,
+                                     uint32_t from, const void *const *elts,
+                                     uint32_t n, char pointer_free);
+static LeafNode* leaf_node_map(const LeafNode *original, uint32_t len,
+                               RRBMapFn fn, void *ctx, char pointer_free);
+static TreeNode* map_rec(const TreeNode *node, uint32_t shift, RRBMapFn fn,
+                         void *ctx, char pointer_free);
+static void partition_items(const void *const *items, uint32_t len,
+                            RRBPredFn pred, void *ctx, TransientRRB **kept,
+                            TransientRRB **rejected);
+static void insertion_sort(void **items, uint32_t len, RRBCmpFn cmp,
+                           void *ctx);
+static void merge_runs(void *const *left, uint32_t left_len,
+                       void *const *right, uint32_t right_len,
+                       uint32_t *l, uint32_t *r, void **out, uint32_t len,
+                       RRBCmpFn cmp, void *ctx);
+static uint32_t merge_split(void *const *left, uint32_t left_len,
+                            void *const *right, uint32_t right_len,
+                            uint32_t k, RRBCmpFn cmp, void *ctx);
+static void sort_chunk_piece(SortState *s, uint32_t i);
+static void sort_merge_piece(SortState *s, uint32_t i);
+static void sort_run_seq(SortState *s, uint32_t pieces);
+static const RRB* sort_tree(const RRB *rrb, RRBCmpFn cmp, void *ctx,
+                            SortRunner run);
+
+static LeafNode* leaf_node_alloc(uint32_t len, char pointer_free);
+static LeafNode* leaf_node_clone(const LeafNode *original, char pointer_free);
+static LeafNode* leaf_node_inc(const LeafNode *original, char pointer_free);
+static LeafNode* leaf_node_dec(const LeafNode *original, char pointer_free);
+static LeafNode* leaf_node_insert(const LeafNode *original, uint32_t index,
+                                  const void *elt, char pointer_free);
+static LeafNode* leaf_node_remove(const LeafNode *original, uint32_t index,
+                                  char pointer_free);
+static LeafNode* leaf_node_create(uint32_t size, char pointer_free);
+static LeafNode* leaf_node_merge(LeafNode *left_leaf, LeafNode *right_leaf,
+                                 char pointer_free);
+
+static InternalNode* internal_node_alloc(uint32_t len);
 static InternalNode* internal_node_create(uint32_t len);
 static InternalNode* internal_node_clone(const InternalNode *original);
 static InternalNode* internal_node_inc(const InternalNode *original);
@@ -131,42 +272,88 @@ static InternalNode* internal_node_copy(InternalNode *original, uint32_t start,
                                         uint32_t len);
 static InternalNode* internal_node_new_above1(InternalNode *child);
 static InternalNode* internal_node_new_above(InternalNode *left, InternalNode *right);
+static InternalNode* internal_node_sized(InternalNode *const *children,
+                                         const uint32_t *sizes, uint32_t len,
+                                         uint32_t offset);
+static void cumulative_sizes(const InternalNode *node, uint32_t shift,
+                             uint32_t *sizes);
+static TreeNode* node_merge(const TreeNode *left, const TreeNode *right,
+                            uint32_t shift, char pointer_free);
 
 static RRB* slice_right(const RRB *rrb, const uint32_t right);
 static TreeNode* slice_right_rec(uint32_t *total_shift, const TreeNode *root,
                                   uint32_t right, uint32_t shift,
-                                  char has_left);
+                                  char has_left, char pointer_free);
 static const RRB* slice_left(RRB *rrb, uint32_t left);
 static TreeNode* slice_left_rec(uint32_t *total_shift, const TreeNode *root,
                                 uint32_t left, uint32_t shift,
-                                char has_right);
+                                char has_right, char pointer_free);
+
+static void fill_root_leaf(RRB *rrb);
+
+static TreeNode* insert_at_rec(const TreeNode *root, uint32_t shift,
+                               uint32_t index, const void *elt,
+                               TreeNode **split, char pointer_free);
+static TreeNode* remove_at_rec(const TreeNode *root, uint32_t shift,
+                               uint32_t index, char pointer_free);
 
 static RRB* rrb_head_clone(const RRB *original);
+static RRB* rrb_mutable_create(char pointer_free);
+static const RRB* rrb_empty(char pointer_free);
+static char rrbs_pointer_free(const RRB *const *rrbs, uint32_t n);
 
 static RRB* push_down_tail(const RRB *restrict rrb, RRB *restrict new_rrb,
                            LeafNode *restrict new_tail);
 static void promote_rightmost_leaf(RRB *new_rrb);
-
-
-
+static void push_down_head(RRB *new_rrb);
+static void promote_leftmost_leaf(RRB *new_rrb);
+static const RRB* flush_head(const RRB *rrb);
+static uint32_t add_subtries(const RRB *rrb, TreeNode **nodes, uint32_t *shifts,
+                             uint32_t n);
+static void concat_subtries(RRB *new_rrb, TreeNode *const *nodes,
+                            const uint32_t *shifts, uint32_t n);
+static void splice_items(TransientRRB *trrb, uint32_t from, uint32_t to,
+                         const RRB *insert);
+static void transient_hold_pointers(TransientRRB *trrb);
+static const RRB* splice_trees(const RRB *rrb, uint32_t from, uint32_t to,
+                               const RRB *insert);
+static TreeNode* split_part(const InternalNode *node,
+                            InternalNode *const *children,
+                            const uint32_t *sizes, uint32_t len,
+                            uint32_t start);
+static void split_rec(const TreeNode *node, uint32_t shift,
+                      const uint32_t *cuts, uint32_t n, uint32_t offset,
+                      TreeNode **parts, LeafNode **tails, char pointer_free);
+
+static void iterator_find_leaf(RRBIterator *it, uint32_t index);
+static void iterator_next_leaf(RRBIterator *it);
+static void iterator_prev_leaf(RRBIterator *it);
+
+static void cursor_find_leaf(RRBCursor *cursor, uint32_t index);
+static inline void cursor_seek(RRBCursor *cursor, uint32_t index);
+
+
+
+// Size tables hold no pointers, as guids aren't allocated, see
+// rrb_guid_create.
 static RRBSizeTable* size_table_create(uint32_t size) {
-  RRBSizeTable *table = RRB_MALLOC(sizeof(RRBSizeTable)
-                                  + size * sizeof(uint32_t));
+  RRBSizeTable *table = RRB_MALLOC_ATOMIC(sizeof(RRBSizeTable)
+                                          + size * sizeof(uint32_t));
+  RRB_FRESH(table);
+  table->guid = NULL;
   return table;
 }
 
 static RRBSizeTable* size_table_clone(const RRBSizeTable *original,
                                       uint32_t len) {
-  RRBSizeTable *clone = RRB_MALLOC(sizeof(RRBSizeTable)
-                                   + len * sizeof(uint32_t));
+  RRBSizeTable *clone = size_table_create(len);
   memcpy(&clone->size, &original->size, sizeof(uint32_t) * len);
   return clone;
 }
 
 static inline RRBSizeTable* size_table_inc(const RRBSizeTable *original,
                                            uint32_t len) {
-  RRBSizeTable *incr = RRB_MALLOC(sizeof(RRBSizeTable) +
-                                  (len + 1) * sizeof(uint32_t));
+  RRBSizeTable *incr = size_table_create(len + 1);
   memcpy(&incr->size, &original->size, sizeof(uint32_t) * len);
   return incr;
 }
@@ -174,6 +361,7 @@ static inline RRBSizeTable* size_table_inc(const RRBSizeTable *original,
 static RRB* rrb_head_clone(const RRB* original) {
   RRB *clone = RRB_MALLOC(sizeof(RRB));
   memcpy(clone, original, sizeof(RRB));
+  RRB_FRESH(clone);
   return clone;
 }
 
@@ -181,40 +369,152 @@ const RRB* rrb_create() {
   return &EMPTY_RRB;
 }
 
-static RRB* rrb_mutable_create() {
+const RRB* rrb_create_pointer_free() {
+  return &EMPTY_POINTER_FREE_RRB;
+}
+
+static const RRB* rrb_empty(char pointer_free) {
+  return pointer_free ? &EMPTY_POINTER_FREE_RRB : &EMPTY_RRB;
+}
+
+static char rrbs_pointer_free(const RRB *const *rrbs, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    if (!rrbs[i]->pointer_free) {
+      return false;
+    }
+  }
+  return n != 0;
+}
+
+const RRB* rrb_retain(const RRB *rrb) {
+#ifdef RRB_REFCOUNT
+  head_acquire(rrb);
+#endif
+  return rrb;
+}
+
+void rrb_release(const RRB *rrb) {
+#ifdef RRB_REFCOUNT
+  head_release(rrb);
+#else
+  (void) rrb;
+#endif
+}
+
+static RRB* rrb_mutable_create(char pointer_free) {
   RRB *rrb = RRB_MALLOC(sizeof(RRB));
+  RRB_FRESH(rrb);
+  rrb->pointer_free = pointer_free;
+  return rrb;
+}
+
+// Builds the same tree n pushes would: dense leaves and internal nodes without
+// size tables, built bottom-up one level at a time, with the last 1-32 items in
+// the tail.
+const RRB* rrb_from_array(const void **items, uint32_t n) {
+  RRB_SCOPE_BEGIN();
+  if (n == 0) {
+    return RRB_SCOPE_END(rrb_create());
+  }
+  const uint32_t tail_len = ((n - 1) & RRB_MASK) + 1;
+  const uint32_t trie_len = n - tail_len;
+
+  LeafNode *tail = leaf_node_create(tail_len, false);
+  memcpy(tail->child, &items[trie_len], tail_len * sizeof(void *));
+
+  const uint32_t nodes_len = trie_len >> RRB_BITS;
+  TreeNode **nodes = RRB_MALLOC(nodes_len * sizeof(TreeNode *));
+  for (uint32_t i = 0; i < nodes_len; i++) {
+    LeafNode *leaf = leaf_node_create(RRB_BRANCHING, false);
+    memcpy(leaf->child, &items[i << RRB_BITS],
+           RRB_BRANCHING * sizeof(void *));
+    nodes[i] = (TreeNode *) leaf;
+  }
+  RRB *rrb = rrb_from_leaves(nodes, nodes_len, tail, n, false);
+  RRB_FREE(nodes);
+  return RRB_SCOPE_END(rrb);
+}
+
+// Builds the trie above the nodes_len full leaves in nodes, which it
+// overwrites, and puts tail after them. n is the total number of items.
+static RRB* rrb_from_leaves(TreeNode **nodes, uint32_t nodes_len,
+                            LeafNode *tail, uint32_t n, char pointer_free) {
+  RRB *rrb = rrb_mutable_create(pointer_free);
+  rrb->cnt = n;
+  rrb->tail_len = tail->len;
+  rrb->tail = tail;
+  if (nodes_len == 0) {
+    rrb->shift = 0;
+    rrb->root = NULL;
+    return rrb;
+  }
+
+  // The parents overwrite the start of the level below, which we're done with
+  // by the time we get there.
+  uint32_t shift = LEAF_NODE_SHIFT;
+  while (nodes_len > 1) {
+    const uint32_t parents_len = ((nodes_len - 1) >> RRB_BITS) + 1;
+    for (uint32_t i = 0; i < parents_len; i++) {
+      const uint32_t first = i << RRB_BITS;
+      InternalNode *parent =
+        internal_node_create(MIN(RRB_BRANCHING, nodes_len - first));
+      memcpy(parent->child, &nodes[first], parent->len * sizeof(TreeNode *));
+      nodes[i] = (TreeNode *) parent;
+    }
+    nodes_len = parents_len;
+    shift = INC_SHIFT(shift);
+  }
+
+  rrb->shift = shift;
+  rrb->root = nodes[0];
   return rrb;
 }
 
 const RRB* rrb_concat(const RRB *left, const RRB *right) {
+  RRB_SCOPE_BEGIN();
+  const char pointer_free = left->pointer_free && right->pointer_free;
+  // The head of left stays where it is, but the head of right ends up in the
+  // middle, so it has to go into its trie first.
+  if (right->head_len != 0) {
+    right = flush_head(right);
+  }
   if (left->cnt == 0) {
-    return right;
+    if (left->head_len == 0) {
+      return RRB_SCOPE_END(right);
+    }
+    RRB *new_rrb = rrb_head_clone(right);
+    new_rrb->pointer_free = pointer_free;
+    new_rrb->head = left->head;
+    new_rrb->head_len = left->head_len;
+    return RRB_SCOPE_END(new_rrb);
   }
   else if (right->cnt == 0) {
-    return left;
+    return RRB_SCOPE_END(left);
   }
   else {
     if (right->root == NULL) {
       // merge left and right tail, if possible
       RRB *new_rrb = rrb_head_clone(left);
+      new_rrb->pointer_free = pointer_free;
       new_rrb->cnt += right->cnt;
 
       // skip merging if left tail is full.
       if (left->tail_len == RRB_BRANCHING) {
         new_rrb->tail_len = right->tail_len;
-        return push_down_tail(left, new_rrb, right->tail);
+        return RRB_SCOPE_END(push_down_tail(left, new_rrb, right->tail));
       }
       // We can merge both tails into a single tail.
       else if (left->tail_len + right->tail_len <= RRB_BRANCHING) {
         const uint32_t new_tail_len = left->tail_len + right->tail_len;
-        LeafNode *new_tail = leaf_node_merge(left->tail, right->tail);
+        LeafNode *new_tail = leaf_node_merge(left->tail, right->tail,
+                                             pointer_free);
         new_rrb->tail = new_tail;
         new_rrb->tail_len = new_tail_len;
-        return new_rrb;
+        return RRB_SCOPE_END(new_rrb);
       }
       else { // must push down something, and will have elements remaining in
              // the right tail
-        LeafNode *push_down = leaf_node_create(RRB_BRANCHING);
+        LeafNode *push_down = leaf_node_create(RRB_BRANCHING, pointer_free);
         memcpy(&push_down->child[0], &left->tail->child[0],
                left->tail_len * sizeof(void *));
         const uint32_t right_cut = RRB_BRANCHING - left->tail_len;
@@ -223,7 +523,7 @@ const RRB* rrb_concat(const RRB *left, const RRB *right) {
 
         // this will be strictly positive.
         const uint32_t new_tail_len = right->tail_len - right_cut;
-        LeafNode *new_tail = leaf_node_create(new_tail_len);
+        LeafNode *new_tail = leaf_node_create(new_tail_len, pointer_free);
 
         memcpy(&new_tail->child[0], &right->tail->child[right_cut],
                new_tail_len * sizeof(void *));
@@ -240,16 +540,19 @@ const RRB* rrb_concat(const RRB *left, const RRB *right) {
         memcpy(&left_imitation, left, sizeof(RRB));
         left_imitation.cnt = new_rrb->cnt - new_tail_len;
 
-        return push_down_tail(&left_imitation, new_rrb, new_tail);
+        return RRB_SCOPE_END(push_down_tail(&left_imitation, new_rrb,
+                                            new_tail));
       }
     }
     left = push_down_tail(left, rrb_head_clone(left), NULL);
-    RRB *new_rrb = rrb_mutable_create();
+    RRB *new_rrb = rrb_mutable_create(pointer_free);
     new_rrb->cnt = left->cnt + right->cnt;
+    new_rrb->head = left->head;
+    new_rrb->head_len = left->head_len;
 
     InternalNode *root_candidate = concat_sub_tree(left->root, RRB_SHIFT(left),
                                                    right->root, RRB_SHIFT(right),
-                                                   true);
+                                                   true, pointer_free);
 
     new_rrb->shift = find_shift((TreeNode *) root_candidate);
     // must be done before we set sizes.
@@ -257,13 +560,60 @@ const RRB* rrb_concat(const RRB *left, const RRB *right) {
                                            RRB_SHIFT(new_rrb));
     new_rrb->tail = right->tail;
     new_rrb->tail_len = right->tail_len;
-    return new_rrb;
+    return RRB_SCOPE_END(new_rrb);
+  }
+}
+
+const RRB* rrb_concat_many(const RRB *const *parts, uint32_t n) {
+  RRB_SCOPE_BEGIN();
+  uint32_t first = 0, last = n;
+  while (first < n && rrb_count(parts[first]) == 0) {
+    first++;
+  }
+  while (last > first && rrb_count(parts[last - 1]) == 0) {
+    last--;
+  }
+  if (first == last) {
+    return RRB_SCOPE_END(rrb_empty(rrbs_pointer_free(parts, n)));
+  }
+  if (last - first == 1) {
+    return RRB_SCOPE_END(parts[first]);
+  }
+
+  // Every part but the first adds at most its head, trie and tail. The head of
+  // the first one stays where it is.
+  const uint32_t max_len = 3 * (last - first);
+  TreeNode **nodes = RRB_MALLOC(max_len * sizeof(TreeNode *));
+  uint32_t *shifts = RRB_MALLOC_ATOMIC(max_len * sizeof(uint32_t));
+
+  RRB *new_rrb = rrb_mutable_create(rrbs_pointer_free(parts, n));
+  new_rrb->head = parts[first]->head;
+  new_rrb->head_len = parts[first]->head_len;
+  uint32_t len = 0;
+  if (parts[first]->root != NULL) {
+    nodes[len] = parts[first]->root;
+    shifts[len++] = RRB_SHIFT(parts[first]);
+  }
+  if (parts[first]->tail_len != 0) {
+    nodes[len] = (TreeNode *) parts[first]->tail;
+    shifts[len++] = LEAF_NODE_SHIFT;
   }
+  new_rrb->cnt = parts[first]->cnt;
+  for (uint32_t i = first + 1; i < last; i++) {
+    len = add_subtries(parts[i], nodes, shifts, len);
+    new_rrb->cnt += rrb_count(parts[i]);
+  }
+
+  // parts[last - 1] isn't empty, so the last subtrie is its tail or head.
+  concat_subtries(new_rrb, nodes, shifts, len);
+  RRB_FREE(nodes);
+  RRB_FREE(shifts);
+  return RRB_SCOPE_END(new_rrb);
 }
 
 static InternalNode* concat_sub_tree(TreeNode *left_node, uint32_t left_shift,
                                      TreeNode *right_node, uint32_t right_shift,
-                                     char is_top) {
+                                     char is_top, char pointer_free) {
   if (left_shift > right_shift) {
     // Left tree is higher than right tree
     InternalNode *left_internal = (InternalNode *) left_node;
@@ -271,8 +621,9 @@ static InternalNode* concat_sub_tree(TreeNode *left_node, uint32_t left_shift,
       concat_sub_tree((TreeNode *) left_internal->child[left_internal->len - 1],
                       DEC_SHIFT(left_shift),
                       right_node, right_shift,
-                      false);
-    return rebalance(left_internal, centre_node, NULL, left_shift, is_top);
+                      false, pointer_free);
+    return rebalance(left_internal, centre_node, NULL, left_shift, is_top,
+                     pointer_free);
   }
   else if (left_shift < right_shift) {
     InternalNode *right_internal = (InternalNode *) right_node;
@@ -280,8 +631,9 @@ static InternalNode* concat_sub_tree(TreeNode *left_node, uint32_t left_shift,
       concat_sub_tree(left_node, left_shift,
                       (TreeNode *) right_internal->child[0],
                       DEC_SHIFT(right_shift),
-                      false);
-    return rebalance(NULL, centre_node, right_internal, right_shift, is_top);
+                      false, pointer_free);
+    return rebalance(NULL, centre_node, right_internal, right_shift, is_top,
+                     pointer_free);
   }
   else { // we have same height
     if (left_shift == LEAF_NODE_SHIFT) { // We're dealing with leaf nodes
@@ -291,7 +643,7 @@ static InternalNode* concat_sub_tree(TreeNode *left_node, uint32_t left_shift,
       // as well.
       if (is_top && (left_leaf->len + right_leaf->len) <= RRB_BRANCHING) {
         // Can put them in a single node
-        LeafNode *merged = leaf_node_merge(left_leaf, right_leaf);
+        LeafNode *merged = leaf_node_merge(left_leaf, right_leaf, pointer_free);
         return internal_node_new_above1((InternalNode *) merged);
       }
       else {
@@ -309,57 +661,130 @@ static InternalNode* concat_sub_tree(TreeNode *left_node, uint32_t left_shift,
                         DEC_SHIFT(left_shift),
                         (TreeNode *) right_internal->child[0],
                         DEC_SHIFT(right_shift),
-                        false);
+                        false, pointer_free);
       // can be optimised: since left_shift == right_shift, we'll end up in this
       // block again.
       return rebalance(left_internal, centre_node, right_internal, left_shift,
-                       is_top);
+                       is_top, pointer_free);
     }
   }
 }
 
-static LeafNode* leaf_node_clone(const LeafNode *original) {
+// The leaves of pointer free RRB-trees are atomic, so that the collector
+// doesn't look at their items. Their items are left uninitialised.
+static LeafNode* leaf_node_alloc(uint32_t len, char pointer_free) {
+  const size_t size = sizeof(LeafNode) + len * sizeof(void *);
+  if (pointer_free) {
+    LeafNode *leaf = RRB_MALLOC_ATOMIC(size);
+    memset(leaf, 0, sizeof(LeafNode));
+    return leaf;
+  }
+  return RRB_MALLOC(size);
+}
+
+static LeafNode* leaf_node_clone(const LeafNode *original, char pointer_free) {
   size_t size = sizeof(LeafNode) + original->len * sizeof(void *);
-  LeafNode *clone = RRB_MALLOC(size);
+  LeafNode *clone = leaf_node_alloc(original->len, pointer_free);
   memcpy(clone, original, size);
+  RRB_FRESH(clone);
   return clone;
 }
 
-static LeafNode* leaf_node_inc(const LeafNode *original) {
+static LeafNode* leaf_node_inc(const LeafNode *original, char pointer_free) {
   size_t size = sizeof(LeafNode) + original->len * sizeof(void *);
-  LeafNode *inc = RRB_MALLOC(size + sizeof(void *));
+  LeafNode *inc = leaf_node_alloc(original->len + 1, pointer_free);
   memcpy(inc, original, size);
+  RRB_FRESH(inc);
   inc->len++;
   return inc;
 }
 
-static LeafNode* leaf_node_dec(const LeafNode *original) {
+static LeafNode* leaf_node_dec(const LeafNode *original, char pointer_free) {
   size_t size = sizeof(LeafNode) + (original->len - 1) * sizeof(void *);
-  LeafNode *dec = RRB_MALLOC(size); // assumes size > 1
+  // assumes len > 1
+  LeafNode *dec = leaf_node_alloc(original->len - 1, pointer_free);
   memcpy(dec, original, size);
+  RRB_FRESH(dec);
   dec->len--;
   return dec;
 }
 
+static LeafNode* leaf_node_insert(const LeafNode *original, uint32_t index,
+                                  const void *elt, char pointer_free) {
+  LeafNode *inserted = leaf_node_create(original->len + 1, pointer_free);
+  memcpy(inserted->child, original->child, index * sizeof(void *));
+  inserted->child[index] = elt;
+  memcpy(&inserted->child[index + 1], &original->child[index],
+         (original->len - index) * sizeof(void *));
+  return inserted;
+}
+
+static LeafNode* leaf_node_remove(const LeafNode *original, uint32_t index,
+                                  char pointer_free) {
+  // assumes len > 1
+  LeafNode *removed = leaf_node_create(original->len - 1, pointer_free);
+  memcpy(removed->child, original->child, index * sizeof(void *));
+  memcpy(&removed->child[index], &original->child[index + 1],
+         (removed->len - index) * sizeof(void *));
+  return removed;
+}
+
 
-static LeafNode* leaf_node_create(uint32_t len) {
-  LeafNode *node = RRB_MALLOC(sizeof(LeafNode) + len * sizeof(void *));
+static LeafNode* leaf_node_create(uint32_t len, char pointer_free) {
+  LeafNode *node = leaf_node_alloc(len, pointer_free);
+  RRB_FRESH(node);
   node->type = LEAF_NODE;
   node->len = len;
   return node;
 }
 
-static LeafNode* leaf_node_merge(LeafNode *left, LeafNode *right) {
-  LeafNode *merged = leaf_node_create(left->len + right->len);
+static LeafNode* leaf_node_merge(LeafNode *left, LeafNode *right,
+                                 char pointer_free) {
+  LeafNode *merged = leaf_node_create(left->len + right->len, pointer_free);
 
   memcpy(&merged->child[0], left->child, left->len * sizeof(void *));
   memcpy(&merged->child[left->len], right->child, right->len * sizeof(void *));
   return merged;
 }
 
+#ifndef RRB_NO_GC
+// Internal nodes allocated by the collector are typed, so that it only traces
+// their size table and children. There is a descriptor for every length up to
+// RRB_BRANCHING, longer nodes are only made while concatenating.
+#define INTERNAL_NODE_WORDS(len) (GC_WORD_OFFSET(InternalNode, child) + (len))
+
+static pthread_once_t rrb_internal_descrs_once = PTHREAD_ONCE_INIT;
+static GC_descr rrb_internal_descrs[RRB_BRANCHING + 1];
+
+static void internal_descrs_create() {
+  GC_word bitmap[(INTERNAL_NODE_WORDS(RRB_BRANCHING) + GC_WORDSZ - 1)
+                 / GC_WORDSZ] = {0};
+  GC_set_bit(bitmap, GC_WORD_OFFSET(InternalNode, size_table));
+  for (uint32_t len = 0; len <= RRB_BRANCHING; len++) {
+    rrb_internal_descrs[len] = GC_make_descriptor(bitmap,
+                                                  INTERNAL_NODE_WORDS(len));
+    if (len < RRB_BRANCHING) {
+      GC_set_bit(bitmap, INTERNAL_NODE_WORDS(len));
+    }
+  }
+}
+#endif
+
+// Typed objects can't be resized, which internal nodes never are.
+static InternalNode* internal_node_alloc(uint32_t len) {
+  const size_t size = sizeof(InternalNode) + len * sizeof(InternalNode *);
+#ifndef RRB_NO_GC
+  if (rrb_allocator.alloc == gc_alloc && len <= RRB_BRANCHING) {
+    pthread_once(&rrb_internal_descrs_once, internal_descrs_create);
+    return GC_malloc_explicitly_typed(size, rrb_internal_descrs[len]);
+  }
+#endif
+  return RRB_MALLOC(size);
+}
+
 static InternalNode* internal_node_create(uint32_t len) {
-  InternalNode *node = RRB_MALLOC(sizeof(InternalNode)
-                              + len * sizeof(InternalNode *));
+  InternalNode *node = internal_node_alloc(len);
+  RRB_FRESH(node);
   node->type = INTERNAL_NODE;
   node->len = len;
   node->size_table = NULL;
@@ -379,6 +804,64 @@ static InternalNode* internal_node_new_above(InternalNode *left, InternalNode *r
   return above;
 }
 
+// Creates an internal node with the given children and a size table made from
+// their cumulative sizes, minus offset.
+static InternalNode* internal_node_sized(InternalNode *const *children,
+                                         const uint32_t *sizes, uint32_t len,
+                                         uint32_t offset) {
+  InternalNode *node = internal_node_create(len);
+  RRBSizeTable *table = size_table_create(len);
+  memcpy(node->child, children, len * sizeof(InternalNode *));
+  for (uint32_t i = 0; i < len; i++) {
+    table->size[i] = sizes[i] - offset;
+  }
+  node->size_table = table;
+  return node;
+}
+
+// Writes the cumulative sizes of the children of node into sizes, the way a
+// size table would contain them, whether node has a size table or not.
+static void cumulative_sizes(const InternalNode *node, uint32_t shift,
+                             uint32_t *sizes) {
+  if (node->size_table != NULL) {
+    memcpy(sizes, node->size_table->size, node->len * sizeof(uint32_t));
+  }
+  else {
+    const uint32_t last = node->len - 1;
+    for (uint32_t i = 0; i < last; i++) {
+      sizes[i] = (i + 1) << shift;
+    }
+    sizes[last] = (last << shift) +
+      size_sub_trie((TreeNode *) node->child[last], DEC_SHIFT(shift));
+  }
+}
+
+// Merges two nodes at the same level into a single node. The caller must
+// ensure that their children fit in one node.
+static TreeNode* node_merge(const TreeNode *left, const TreeNode *right,
+                            uint32_t shift, char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    return (TreeNode *) leaf_node_merge((LeafNode *) left, (LeafNode *) right,
+                                        pointer_free);
+  }
+  const InternalNode *left_internal = (const InternalNode *) left;
+  const InternalNode *right_internal = (const InternalNode *) right;
+  const uint32_t left_len = left_internal->len;
+  InternalNode *children[RRB_BRANCHING];
+  uint32_t sizes[RRB_BRANCHING];
+
+  memcpy(children, left_internal->child, left_len * sizeof(InternalNode *));
+  memcpy(&children[left_len], right_internal->child,
+         right_internal->len * sizeof(InternalNode *));
+  cumulative_sizes(left_internal, shift, sizes);
+  cumulative_sizes(right_internal, shift, &sizes[left_len]);
+  const uint32_t len = left_len + right_internal->len;
+  for (uint32_t i = left_len; i < len; i++) {
+    sizes[i] += sizes[left_len - 1];
+  }
+  return (TreeNode *) internal_node_sized(children, sizes, len, 0);
+}
+
 static InternalNode* internal_node_merge(InternalNode *left, InternalNode *centre,
                                          InternalNode *right) {
   // If internal node is NULL, its size is zero.
@@ -405,8 +888,9 @@ static InternalNode* internal_node_merge(InternalNode *left, InternalNode *centr
 
 static InternalNode* internal_node_clone(const InternalNode *original) {
   size_t size = sizeof(InternalNode) + original->len * sizeof(InternalNode *);
-  InternalNode *clone = RRB_MALLOC(size);
+  InternalNode *clone = internal_node_alloc(original->len);
   memcpy(clone, original, size);
+  RRB_FRESH(clone);
   return clone;
 }
 
@@ -419,8 +903,9 @@ static InternalNode* internal_node_copy(InternalNode *original, uint32_t start,
 
 static InternalNode* internal_node_inc(const InternalNode *original) {
   size_t size = sizeof(InternalNode) + original->len * sizeof(InternalNode *);
-  InternalNode *incr = RRB_MALLOC(size + sizeof(InternalNode *));
+  InternalNode *incr = internal_node_alloc(original->len + 1);
   memcpy(incr, original, size);
+  RRB_FRESH(incr);
   // update length
   if (incr->size_table != NULL) {
     incr->size_table = size_table_inc(incr->size_table, incr->len);
@@ -431,8 +916,9 @@ static InternalNode* internal_node_inc(const InternalNode *original) {
 
 static InternalNode* internal_node_dec(const InternalNode *original) {
   size_t size = sizeof(InternalNode) + (original->len - 1) * sizeof(InternalNode *);
-  InternalNode *clone = RRB_MALLOC(size);
+  InternalNode *clone = internal_node_alloc(original->len - 1);
   memcpy(clone, original, size);
+  RRB_FRESH(clone);
   // update length
   clone->len--;
   // Leaks the size table, but it's okay: Would cost more to actually make a
@@ -443,14 +929,16 @@ static InternalNode* internal_node_dec(const InternalNode *original) {
 
 static InternalNode* rebalance(InternalNode *left, InternalNode *centre,
                                InternalNode *right, uint32_t shift,
-                               char is_top) {
+                               char is_top, char pointer_free) {
   InternalNode *all = internal_node_merge(left, centre, right);
   // top_len is children count of the internal node returned.
   uint32_t top_len; // populated through pointer manipulation.
 
   uint32_t *node_count = create_concat_plan(all, &top_len);
 
-  InternalNode *new_all = execute_concat_plan(all, node_count, top_len, shift);
+  InternalNode *new_all = execute_concat_plan(all, node_count, top_len, shift,
+                                              pointer_free);
+  RRB_FREE(node_count);
   if (top_len <= RRB_BRANCHING) {
     if (is_top == false) {
       return internal_node_new_above1(set_sizes(new_all, shift));
@@ -487,30 +975,43 @@ static uint32_t* create_concat_plan(InternalNode *all, uint32_t *top_len) {
 
   const uint32_t optimal_slots = ((total_nodes-1) / RRB_BRANCHING) + 1;
 
-  uint32_t shuffled_len = all->len;
-  uint32_t i = 0;
-  while (optimal_slots + RRB_EXTRAS < shuffled_len) {
+  // The number of nodes we have to get rid of.
+  uint32_t extra = 0;
+  if (optimal_slots + RRB_EXTRAS < all->len) {
+    extra = all->len - optimal_slots - RRB_EXTRAS;
+  }
 
+  // Short nodes are redistributed over the nodes following them until one
+  // node has been removed. Instead of shuffling up the remaining node sizes
+  // afterwards, we write the new sizes behind the ones we read, so that this
+  // stays linear when all has many more than 2 * RRB_BRANCHING children.
+  uint32_t shuffled_len = 0;
+  uint32_t i = 0;
+  while (i < all->len) {
     // Skip over all nodes satisfying the invariant.
-    while (node_count[i] > RRB_BRANCHING - RRB_INVARIANT) {
-      i++;
+    if (extra == 0 || node_count[i] > RRB_BRANCHING - RRB_INVARIANT) {
+      node_count[shuffled_len++] = node_count[i++];
+      continue;
     }
 
     // Found short node, so redistribute over the next nodes
-    uint32_t remaining_nodes = node_count[i];
-    do {
-      const uint32_t min_size = MIN(remaining_nodes + node_count[i+1], RRB_BRANCHING);
-      node_count[i] = min_size;
-      remaining_nodes = remaining_nodes + node_count[i+1] - min_size;
-      i++;
-    } while (remaining_nodes > 0);
-
-    // Shuffle up remaining node sizes
-    for (uint32_t j = i; j < shuffled_len - 1; j++) {
-      node_count[j] = node_count[j+1]; // Could use memmove here I guess
+    uint32_t size = node_count[i++];
+    char remaining = 0;
+    while (remaining ||
+           (extra > 0 && size <= RRB_BRANCHING - RRB_INVARIANT)) {
+      const uint32_t merged = size + node_count[i++];
+      remaining = merged > RRB_BRANCHING;
+      if (remaining) {
+        node_count[shuffled_len++] = RRB_BRANCHING;
+        size = merged - RRB_BRANCHING;
+      }
+      else {
+        // The next node fit, so we're down one node.
+        size = merged;
+        extra--;
+      }
     }
-    shuffled_len--;
-    i--;
+    node_count[shuffled_len++] = size;
   }
 
   *top_len = shuffled_len;
@@ -518,7 +1019,8 @@ static uint32_t* create_concat_plan(InternalNode *all, uint32_t *top_len) {
 }
 
 static InternalNode* execute_concat_plan(InternalNode *all, uint32_t *node_size,
-                                         uint32_t slen, uint32_t shift) {
+                                         uint32_t slen, uint32_t shift,
+                                         char pointer_free) {
   // the all vector doesn't have sizes set yet.
 
   InternalNode *new_all = internal_node_create(slen);
@@ -540,7 +1042,7 @@ static InternalNode* execute_concat_plan(InternalNode *all, uint32_t *node_size,
         new_all->child[i] = (InternalNode *) old;
       }
       else {
-        LeafNode *new_node = leaf_node_create(new_size);
+        LeafNode *new_node = leaf_node_create(new_size, pointer_free);
         uint32_t cur_size = 0;
         // cur_size is the current size of the new node
         // (the amount of elements copied into it so far)
@@ -627,6 +1129,168 @@ static uint32_t find_shift(TreeNode *node) {
   }
 }
 
+// Like rebalance, but all may have any number of children. Returns the
+// rebalanced nodes at shift in a list, which is an internal node only used to
+// hold them.
+static InternalNode* rebalance_nodes(InternalNode *all, uint32_t shift,
+                                     char pointer_free) {
+  uint32_t top_len;
+  uint32_t *node_count = create_concat_plan(all, &top_len);
+  InternalNode *new_all = execute_concat_plan(all, node_count, top_len, shift,
+                                              pointer_free);
+  RRB_FREE(node_count);
+  if (top_len <= RRB_BRANCHING) {
+    return internal_node_new_above1(set_sizes(new_all, shift));
+  }
+  const uint32_t len = ((top_len - 1) >> RRB_BITS) + 1;
+  InternalNode *list = internal_node_create(len);
+  for (uint32_t i = 0; i < len; i++) {
+    const uint32_t first = i << RRB_BITS;
+    InternalNode *node = internal_node_copy(new_all, first,
+                                            MIN(RRB_BRANCHING, top_len - first));
+    list->child[i] = set_sizes(node, shift);
+  }
+  return list;
+}
+
+/**
+ * Concatenates the subtries in nodes, where nodes[i] is at shifts[i] <= shift,
+ * and returns the result as a list of nodes at shift. Subtries lower than
+ * shift are treated as if they had single-child parents up to shift.
+ *
+ * This is concat_sub_tree for any number of subtries: the children on the
+ * seams between two nodes are concatenated one level down, and everything at
+ * this level is then rebalanced in one go. If a node has a single child, that
+ * child is on two seams, which are then handled as one.
+ */
+static InternalNode* concat_nodes(TreeNode *const *nodes,
+                                  const uint32_t *shifts, uint32_t n,
+                                  uint32_t shift, char pointer_free) {
+  if (n == 1) {
+    InternalNode *node = (InternalNode *) nodes[0];
+    for (uint32_t s = shifts[0]; s < shift; s += RRB_BITS) {
+      node = internal_node_new_above1(node);
+    }
+    return internal_node_new_above1(node);
+  }
+  if (shift == LEAF_NODE_SHIFT) {
+    // Leaves are rebalanced by their parent.
+    InternalNode *list = internal_node_create(n);
+    memcpy(list->child, nodes, n * sizeof(InternalNode *));
+    return list;
+  }
+  const uint32_t child_shift = DEC_SHIFT(shift);
+
+  // The children that end up in all are kept as spans, as we don't know how
+  // many nodes the seams turn into before we've concatenated them. The buffers
+  // are only allocated if there are too many nodes to keep them on the stack.
+  InternalNode *const *spans_buf[2 * RRB_BRANCHING + 1];
+  uint32_t span_lens_buf[2 * RRB_BRANCHING + 1];
+  TreeNode *seam_buf[RRB_BRANCHING];
+  uint32_t seam_shifts_buf[RRB_BRANCHING];
+
+  InternalNode *const **spans = spans_buf;
+  uint32_t *span_lens = span_lens_buf;
+  TreeNode **seam = seam_buf;
+  uint32_t *seam_shifts = seam_shifts_buf;
+  if (n > RRB_BRANCHING) {
+    spans = RRB_MALLOC((2 * n + 1) * sizeof(void *));
+    span_lens = RRB_MALLOC_ATOMIC((2 * n + 1) * sizeof(uint32_t));
+    seam = RRB_MALLOC(n * sizeof(TreeNode *));
+    seam_shifts = RRB_MALLOC_ATOMIC(n * sizeof(uint32_t));
+  }
+  uint32_t spans_len = 0, total = 0, seam_len = 0;
+
+  for (uint32_t i = 0; i <= n; i++) {
+    InternalNode *const *children = NULL;
+    uint32_t len = 0, children_shift = child_shift;
+    if (i < n && shifts[i] == shift) {
+      children = ((const InternalNode *) nodes[i])->child;
+      len = nodes[i]->len;
+    }
+    else if (i < n) {
+      children = (InternalNode *const *) &nodes[i];
+      len = 1;
+      children_shift = shifts[i];
+    }
+    if (len > 0) {
+      seam[seam_len] = (TreeNode *) children[0];
+      seam_shifts[seam_len] = children_shift;
+      seam_len++;
+    }
+    if (len > 1 || i == n) {
+      // The seam ends at the first child of this node.
+      InternalNode *centre = concat_nodes(seam, seam_shifts, seam_len,
+                                          child_shift, pointer_free);
+      spans[spans_len] = centre->child;
+      span_lens[spans_len++] = centre->len;
+      total += centre->len;
+      if (len > 2) {
+        spans[spans_len] = &children[1];
+        span_lens[spans_len++] = len - 2;
+        total += len - 2;
+      }
+      if (len > 0) {
+        seam[0] = (TreeNode *) children[len - 1];
+        seam_shifts[0] = children_shift;
+        seam_len = 1;
+      }
+    }
+  }
+
+  InternalNode *all = internal_node_create(total);
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < spans_len; i++) {
+    memcpy(&all->child[len], spans[i], span_lens[i] * sizeof(InternalNode *));
+    len += span_lens[i];
+  }
+  if (n > RRB_BRANCHING) {
+    RRB_FREE(spans);
+    RRB_FREE(span_lens);
+    RRB_FREE(seam);
+    RRB_FREE(seam_shifts);
+  }
+  return rebalance_nodes(all, shift, pointer_free);
+}
+
+// Concatenates the subtries in nodes into a single trie, and returns its root.
+// Its shift is put in *shift.
+static TreeNode* concat_trees(TreeNode *const *nodes, const uint32_t *shifts,
+                              uint32_t n, uint32_t *shift, char pointer_free) {
+  uint32_t top_shift = LEAF_NODE_SHIFT;
+  for (uint32_t i = 0; i < n; i++) {
+    top_shift = MAX(top_shift, shifts[i]);
+  }
+  if (n > 1 && top_shift == LEAF_NODE_SHIFT) {
+    // Leaves are only rebalanced by their parent, so start one level up.
+    top_shift = INC_SHIFT(LEAF_NODE_SHIFT);
+  }
+  InternalNode *list = concat_nodes(nodes, shifts, n, top_shift, pointer_free);
+
+  // The nodes at the top level are already balanced, so we only have to put
+  // parents above them.
+  while (list->len > 1) {
+    top_shift = INC_SHIFT(top_shift);
+    const uint32_t parents_len = ((list->len - 1) >> RRB_BITS) + 1;
+    InternalNode *parents = internal_node_create(parents_len);
+    for (uint32_t i = 0; i < parents_len; i++) {
+      const uint32_t first = i << RRB_BITS;
+      InternalNode *parent =
+        internal_node_copy(list, first, MIN(RRB_BRANCHING, list->len - first));
+      parents->child[i] = set_sizes(parent, top_shift);
+    }
+    list = parents;
+  }
+
+  TreeNode *root = (TreeNode *) list->child[0];
+  while (top_shift > LEAF_NODE_SHIFT && root->len == 1) {
+    root = (TreeNode *) ((InternalNode *) root)->child[0];
+    top_shift = DEC_SHIFT(top_shift);
+  }
+  *shift = top_shift;
+  return root;
+}
+
 static InternalNode* set_sizes(InternalNode *node, uint32_t shift) {
   uint32_t sum = 0;
   RRBSizeTable *table = size_table_create(node->len);
@@ -668,7 +1332,7 @@ static inline RRB* rrb_tail_push(const RRB *restrict rrb, const void *restrict e
 
 static inline RRB* rrb_tail_push(const RRB *restrict rrb, const void *restrict elt) {
   RRB* new_rrb = rrb_head_clone(rrb);
-  LeafNode *new_tail = leaf_node_inc(rrb->tail);
+  LeafNode *new_tail = leaf_node_inc(rrb->tail, rrb->pointer_free);
   new_tail->child[new_rrb->tail_len] = elt;
   new_rrb->cnt++;
   new_rrb->tail_len++;
@@ -683,16 +1347,17 @@ static InternalNode** append_empty(InternalNode **to_set,
                                    uint32_t empty_height);
 
 const RRB* rrb_push(const RRB *restrict rrb, const void *restrict elt) {
+  RRB_SCOPE_BEGIN();
   if (rrb->tail_len < RRB_BRANCHING) {
-    return rrb_tail_push(rrb, elt);
+    return RRB_SCOPE_END(rrb_tail_push(rrb, elt));
   }
   RRB *new_rrb = rrb_head_clone(rrb);
   new_rrb->cnt++;
 
-  LeafNode *new_tail = leaf_node_create(1);
+  LeafNode *new_tail = leaf_node_create(1, rrb->pointer_free);
   new_tail->child[0] = elt;
   new_rrb->tail_len = 1;
-  return push_down_tail(rrb, new_rrb, new_tail);
+  return RRB_SCOPE_END(push_down_tail(rrb, new_rrb, new_tail));
 }
 
 
@@ -753,7 +1418,9 @@ static RRB* push_down_tail(const RRB *restrict rrb, RRB *restrict new_rrb,
       pos = child_index;
     }
 
-    current = current->child[child_index];
+    // The slot past the last child is where the new leaf goes. Nodes are
+    // allocated with exactly len children, so it mustn't be read.
+    current = (child_index < current->len) ? current->child[child_index] : NULL;
     // This will only happen in a pvec subtree
     if (current == NULL) {
       nodes_to_copy = nodes_visited;
@@ -871,7 +1538,10 @@ static InternalNode** copy_first_k(const RRB *rrb, RRB *new_rrb, const uint32_t
       }
     }
     to_set = &new_current->child[child_index];
-    current = current->child[child_index];
+    // The last node copied gets a new slot, which current doesn't have.
+    if (i != k) {
+      current = current->child[child_index];
+    }
 
     i++;
     shift -= RRB_BITS;
@@ -899,13 +1569,21 @@ static InternalNode** append_empty(InternalNode **to_set,
   }
 }
 
+// Returns the first slot at or after pos where the cumulative size is larger
+// than index. pos is usually a very good guess, and the answer is nearly always
+// within a couple of slots of it.
+static inline uint32_t size_table_search(const RRBSizeTable *table,
+                                         uint32_t pos, uint32_t index) {
+  while (table->size[pos] <= index) {
+    pos++;
+  }
+  return pos;
+}
+
 static uint32_t sized_pos(const InternalNode *node, uint32_t *index,
                           uint32_t sp) {
   RRBSizeTable *table = node->size_table;
-  uint32_t is = *index >> sp;
-  while (table->size[is] <= *index) {
-    is++;
-  }
+  uint32_t is = size_table_search(table, *index >> sp, *index);
   if (is != 0) {
     *index -= table->size[is-1];
   }
@@ -919,6 +1597,10 @@ static const InternalNode* sized(const InternalNode *node, uint32_t *index,
 }
 
 void* rrb_nth(const RRB *rrb, uint32_t index) {
+  if (index < rrb->head_len) {
+    return (void *) rrb->head->child[index];
+  }
+  index -= rrb->head_len;
   if (index >= rrb->cnt) {
     return NULL;
   }
@@ -941,11 +1623,206 @@ void* rrb_nth(const RRB *rrb, uint32_t index) {
   }
 }
 
+// keys are (index << 32 | position in out), sorted, and within node. Groups
+// the keys by the child they're in and prefetches all those children before
+// descending into any of them, so the cache misses overlap.
+static void nth_many_rec(const InternalNode *node, uint32_t shift,
+                         uint32_t start, const uint64_t *keys, uint32_t n,
+                         void **out) {
+  if (shift == LEAF_NODE_SHIFT) {
+    const LeafNode *leaf = (const LeafNode *) node;
+    for (uint32_t i = 0; i < n; i++) {
+      out[(uint32_t) keys[i]] =
+        (void *) leaf->child[(uint32_t) (keys[i] >> 32) - start];
+    }
+    return;
+  }
+
+  uint32_t group_child[RRB_BRANCHING];
+  uint32_t group_start[RRB_BRANCHING];
+  uint32_t group_keys[RRB_BRANCHING + 1];
+  uint32_t groups = 0;
+
+  uint32_t i = 0;
+  while (i < n) {
+    uint32_t idx = (uint32_t) (keys[i] >> 32) - start;
+    uint32_t child_index, child_size;
+    if (node->size_table == NULL) {
+      child_index = (idx >> shift) & RRB_MASK;
+      child_size = 1u << shift;
+      idx -= child_index << shift;
+    }
+    else {
+      child_index = sized_pos(node, &idx, shift);
+      child_size = node->size_table->size[child_index]
+                 - (child_index == 0 ? 0 : node->size_table->size[child_index-1]);
+    }
+    const uint32_t child_start = (uint32_t) (keys[i] >> 32) - idx;
+    RRB_PREFETCH(node->child[child_index]);
+
+    group_child[groups] = child_index;
+    group_start[groups] = child_start;
+    group_keys[groups] = i;
+    groups++;
+    do {
+      i++;
+    } while (i < n && (uint32_t) (keys[i] >> 32) - child_start < child_size);
+  }
+  group_keys[groups] = n;
+
+  for (uint32_t g = 0; g < groups; g++) {
+    nth_many_rec(node->child[group_child[g]], DEC_SHIFT(shift), group_start[g],
+                 &keys[group_keys[g]], group_keys[g+1] - group_keys[g], out);
+  }
+}
+
+static int uint64_cmp(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *) a;
+  const uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+void rrb_nth_many(const RRB *rrb, const uint32_t *indices, uint32_t n,
+                  void **out) {
+  if (n == 0) {
+    return;
+  }
+  uint64_t *keys = RRB_MALLOC_ATOMIC(n * sizeof(uint64_t));
+  char sorted = true;
+  for (uint32_t i = 0; i < n; i++) {
+    keys[i] = ((uint64_t) indices[i] << 32) | i;
+    if (i != 0 && indices[i] < indices[i-1]) {
+      sorted = false;
+    }
+  }
+  if (!sorted) {
+    qsort(keys, n, sizeof(uint64_t), uint64_cmp);
+  }
+
+  const uint32_t head_len = rrb->head_len;
+  uint32_t in_head = 0;
+  while (in_head < n && (uint32_t) (keys[in_head] >> 32) < head_len) {
+    out[(uint32_t) keys[in_head]] =
+      (void *) rrb->head->child[(uint32_t) (keys[in_head] >> 32)];
+    in_head++;
+  }
+
+  const uint32_t tail_offset = head_len + rrb->cnt - rrb->tail_len;
+  uint32_t in_trie = in_head;
+  while (in_trie < n && (uint32_t) (keys[in_trie] >> 32) < tail_offset) {
+    in_trie++;
+  }
+  if (in_trie != in_head) {
+    // nth_many_rec takes the index of the first item in the trie as start.
+    nth_many_rec((const InternalNode *) rrb->root, RRB_SHIFT(rrb), head_len,
+                 &keys[in_head], in_trie - in_head, out);
+  }
+  for (uint32_t i = in_trie; i < n; i++) {
+    const uint32_t index = (uint32_t) (keys[i] >> 32);
+    out[(uint32_t) keys[i]] = (index < head_len + rrb->cnt)
+      ? (void *) rrb->tail->child[index - tail_offset]
+      : NULL;
+  }
+  RRB_FREE(keys);
+}
+
+// Whether elt belongs after the bound: at or after key for the lower bound,
+// and strictly after it for the upper one.
+static inline char bound_after(const void *elt, const void *key,
+                               RRBCmpFn cmp, void *ctx, char upper) {
+  const int c = cmp((void *) elt, (void *) key, ctx);
+  return upper ? c > 0 : c >= 0;
+}
+
+// Returns the first position in items that is after the bound, or len.
+static uint32_t leaf_bound(const void *const *items, uint32_t len,
+                           const void *key, RRBCmpFn cmp, void *ctx,
+                           char upper) {
+  uint32_t lo = 0, hi = len;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (bound_after(items[mid], key, cmp, ctx, upper)) {
+      hi = mid;
+    }
+    else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+// The head and the tail are checked with a single comparison each. In the
+// trie, every node is searched by the first items of its children: if the
+// bound is in a child, the first item of the next one is after it. Finding
+// those items only follows the leftmost pointers down, without any size table
+// lookups, and the search ends with a binary search of a single leaf.
+static uint32_t rrb_bound(const RRB *rrb, const void *key, RRBCmpFn cmp,
+                          void *ctx, char upper) {
+  if (rrb->head_len != 0 &&
+      bound_after(rrb->head->child[rrb->head_len - 1], key, cmp, ctx, upper)) {
+    return leaf_bound(rrb->head->child, rrb->head_len, key, cmp, ctx, upper);
+  }
+  const uint32_t tail_offset = rrb->head_len + rrb->cnt - rrb->tail_len;
+  if (rrb->tail_len != 0 &&
+      !bound_after(rrb->tail->child[0], key, cmp, ctx, upper)) {
+    return tail_offset + leaf_bound(rrb->tail->child, rrb->tail_len, key, cmp,
+                                    ctx, upper);
+  }
+  if (rrb->root == NULL) {
+    return tail_offset;
+  }
+
+  const TreeNode *node = rrb->root;
+  uint32_t index = rrb->head_len;
+  for (uint32_t shift = RRB_SHIFT(rrb); shift > 0; shift = DEC_SHIFT(shift)) {
+    const InternalNode *internal = (const InternalNode *) node;
+    // Finds the first child after the bound, and picks the one before it.
+    uint32_t lo = 1, hi = internal->len;
+    while (lo < hi) {
+      const uint32_t mid = lo + (hi - lo) / 2;
+      const TreeNode *first = (const TreeNode *) internal->child[mid];
+      for (uint32_t s = DEC_SHIFT(shift); s > 0; s = DEC_SHIFT(s)) {
+        first = (const TreeNode *) ((const InternalNode *) first)->child[0];
+      }
+      if (bound_after(((const LeafNode *) first)->child[0], key, cmp, ctx,
+                      upper)) {
+        hi = mid;
+      }
+      else {
+        lo = mid + 1;
+      }
+    }
+    const uint32_t child = lo - 1;
+    if (internal->size_table != NULL) {
+      index += (child == 0) ? 0 : internal->size_table->size[child - 1];
+    }
+    else {
+      index += child << shift;
+    }
+    node = (const TreeNode *) internal->child[child];
+  }
+  const LeafNode *leaf = (const LeafNode *) node;
+  return index + leaf_bound(leaf->child, leaf->len, key, cmp, ctx, upper);
+}
+
+uint32_t rrb_lower_bound(const RRB *rrb, const void *key, RRBCmpFn cmp,
+                         void *ctx) {
+  return rrb_bound(rrb, key, cmp, ctx, 0);
+}
+
+uint32_t rrb_upper_bound(const RRB *rrb, const void *key, RRBCmpFn cmp,
+                         void *ctx) {
+  return rrb_bound(rrb, key, cmp, ctx, 1);
+}
+
 uint32_t rrb_count(const RRB *rrb) {
-  return rrb->cnt;
+  return rrb->head_len + rrb->cnt;
 }
 
 void* rrb_peek(const RRB *rrb) {
+  if (rrb->cnt == 0 && rrb->head_len != 0) {
+    return (void *) rrb->head->child[rrb->head_len-1];
+  }
   return (void *) rrb->tail->child[rrb->tail_len-1];
 }
 
@@ -1004,9 +1881,52 @@ static void promote_rightmost_leaf(RRB *new_rrb) {
   new_rrb->root = (TreeNode *) path[0];
 }
 
+// A root leaf must be full, and a tree with at most RRB_BRANCHING items keeps
+// them all in the tail. Slicing and removing items from the trie may break
+// either, so this moves items over from the tail, or the trie into the tail.
+static void fill_root_leaf(RRB *rrb) {
+  if (rrb->root == NULL) {
+    return;
+  }
+  if (rrb->cnt <= RRB_BRANCHING) {
+    // can put all into a new tail
+    const uint32_t trie_len = rrb->cnt - rrb->tail_len;
+    LeafNode *new_tail = leaf_node_create(rrb->cnt, rrb->pointer_free);
+
+    rrb_copy_range(rrb, rrb->head_len, rrb->head_len + trie_len,
+                   (void **) new_tail->child);
+    memcpy(&new_tail->child[trie_len], &rrb->tail->child[0],
+           rrb->tail_len * sizeof(void *));
+    rrb->tail_len = rrb->cnt;
+    rrb->shift = LEAF_NODE_SHIFT;
+    rrb->root = NULL;
+    rrb->tail = new_tail;
+  }
+  // no need for <= here, because if the root node is == rrb_branching, the
+  // invariant is kept.
+  else if (RRB_SHIFT(rrb) == 0 && rrb->cnt - rrb->tail_len < RRB_BRANCHING) {
+    // create both a new tail and a new root node
+    const uint32_t tail_cut = RRB_BRANCHING - rrb->root->len;
+    LeafNode *new_root = leaf_node_create(RRB_BRANCHING, rrb->pointer_free);
+    LeafNode *new_tail = leaf_node_create(rrb->tail_len - tail_cut,
+                                          rrb->pointer_free);
+
+    memcpy(&new_root->child[0], &((LeafNode *) rrb->root)->child[0],
+           rrb->root->len * sizeof(void *));
+    memcpy(&new_root->child[rrb->root->len], &rrb->tail->child[0],
+           tail_cut * sizeof(void *));
+    memcpy(&new_tail->child[0], &rrb->tail->child[tail_cut],
+           (rrb->tail_len - tail_cut) * sizeof(void *));
+
+    rrb->tail_len = rrb->tail_len - tail_cut;
+    rrb->tail = new_tail;
+    rrb->root = (TreeNode *) new_root;
+  }
+}
+
 static RRB* slice_right(const RRB *rrb, const uint32_t right) {
   if (right == 0) {
-    return (RRB *) rrb_create();
+    return (RRB *) rrb_empty(rrb->pointer_free);
   }
   else if (right < rrb->cnt) {
     const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
@@ -1014,7 +1934,7 @@ static RRB* slice_right(const RRB *rrb, const uint32_t right) {
     if (tail_offset < right) {
       RRB *new_rrb = rrb_head_clone(rrb);
       const uint32_t new_tail_len = right - tail_offset;
-      LeafNode *new_tail = leaf_node_create(new_tail_len);
+      LeafNode *new_tail = leaf_node_create(new_tail_len, rrb->pointer_free);
       memcpy(new_tail->child, rrb->tail->child, new_tail_len * sizeof(void *));
       new_rrb->cnt = right;
       new_rrb->tail = new_tail;
@@ -1022,9 +1942,9 @@ static RRB* slice_right(const RRB *rrb, const uint32_t right) {
       return new_rrb;
     }
 
-    RRB *new_rrb = rrb_mutable_create();
+    RRB *new_rrb = rrb_mutable_create(rrb->pointer_free);
     TreeNode *root = slice_right_rec(&RRB_SHIFT(new_rrb), rrb->root, right - 1,
-                                     RRB_SHIFT(rrb), false);
+                                     RRB_SHIFT(rrb), false, rrb->pointer_free);
     new_rrb->cnt = right;
     new_rrb->root = root;
 
@@ -1041,7 +1961,7 @@ static RRB* slice_right(const RRB *rrb, const uint32_t right) {
 
 static TreeNode* slice_right_rec(uint32_t *total_shift, const TreeNode *root,
                                  uint32_t right, uint32_t shift,
-                                 char has_left) {
+                                 char has_left, char pointer_free) {
   const uint32_t subshift = DEC_SHIFT(shift);
   uint32_t subidx = right >> shift;
   if (shift > LEAF_NODE_SHIFT) {
@@ -1051,7 +1971,7 @@ static TreeNode* slice_right_rec(uint32_t *total_shift, const TreeNode *root,
         slice_right_rec(total_shift,
                         (TreeNode *) internal_root->child[subidx],
                         right - (subidx << shift), subshift,
-                        (subidx != 0) | has_left);
+                        (subidx != 0) | has_left, pointer_free);
       if (subidx == 0) {
         if (has_left) {
           InternalNode *right_hand_parent = internal_node_create(1);
@@ -1076,16 +1996,14 @@ static TreeNode* slice_right_rec(uint32_t *total_shift, const TreeNode *root,
       RRBSizeTable *table = internal_root->size_table;
       uint32_t idx = right;
 
-      while (table->size[subidx] <= idx) {
-        subidx++;
-      }
+      subidx = size_table_search(table, subidx, idx);
       if (subidx != 0) {
         idx -= table->size[subidx-1];
       }
 
       const TreeNode *right_hand_node =
         slice_right_rec(total_shift, (const TreeNode*) internal_root->child[subidx], idx,
-                        subshift, (subidx != 0) | has_left);
+                        subshift, (subidx != 0) | has_left, pointer_free);
       if (subidx == 0) {
         if (has_left) {
           // As there is one above us, must place the right hand node in a
@@ -1126,7 +2044,7 @@ static TreeNode* slice_right_rec(uint32_t *total_shift, const TreeNode *root,
   else { // if (shift <= RRB_BRANCHING)
     // Just pure copying into a new node
     const LeafNode *leaf_root = (LeafNode *) root;
-    LeafNode *left_vals = leaf_node_create(subidx + 1);
+    LeafNode *left_vals = leaf_node_create(subidx + 1, pointer_free);
 
     memcpy(left_vals->child, leaf_root->child, (subidx + 1) * sizeof(void *));
     *total_shift = shift;
@@ -1136,18 +2054,18 @@ static TreeNode* slice_right_rec(uint32_t *total_shift, const TreeNode *root,
 
 const RRB* slice_left(RRB *rrb, uint32_t left) {
   if (left >= rrb->cnt) {
-    return rrb_create();
+    return rrb_empty(rrb->pointer_free);
   }
   else if (left > 0) {
     const uint32_t remaining = rrb->cnt - left;
 
     // If we slice into the tail, we just need to modify the tail itself
     if (remaining <= rrb->tail_len) {
-      LeafNode *new_tail = leaf_node_create(remaining);
+      LeafNode *new_tail = leaf_node_create(remaining, rrb->pointer_free);
       memcpy(new_tail->child, &rrb->tail->child[rrb->tail_len - remaining],
              remaining * sizeof(void *));
 
-      RRB *new_rrb = rrb_mutable_create();
+      RRB *new_rrb = rrb_mutable_create(rrb->pointer_free);
       new_rrb->cnt = remaining;
       new_rrb->tail_len = remaining;
       new_rrb->tail = new_tail;
@@ -1156,10 +2074,10 @@ const RRB* slice_left(RRB *rrb, uint32_t left) {
     // Otherwise, we don't really have to take the tail into consideration.
     // Good!
 
-    RRB *new_rrb = rrb_mutable_create();
+    RRB *new_rrb = rrb_mutable_create(rrb->pointer_free);
     InternalNode *root = (InternalNode *)
       slice_left_rec(&RRB_SHIFT(new_rrb), rrb->root, left,
-                     RRB_SHIFT(rrb), false);
+                     RRB_SHIFT(rrb), false, rrb->pointer_free);
     new_rrb->cnt = remaining;
     new_rrb->root = (TreeNode *) root;
 
@@ -1178,50 +2096,13 @@ const RRB* slice_left(RRB *rrb, uint32_t left) {
   // resolved by slice_right itself. Perhaps not promote in the right slicing,
   // but here instead?
 
-  // This case handles leaf nodes < RRB_BRANCHING size, by redistributing
-  // values from the tail into the actual leaf node.
-  if (RRB_SHIFT(rrb) == 0 && rrb->root != NULL) {
-    // two cases to handle: cnt <= RRB_BRANCHING
-    //     and (cnt - tail_len) < RRB_BRANCHING
-
-    if (rrb->cnt <= RRB_BRANCHING) {
-      // can put all into a new tail
-      LeafNode *new_tail = leaf_node_create(rrb->cnt);
-
-      memcpy(&new_tail->child[0], &((LeafNode *) rrb->root)->child[0],
-             rrb->root->len * sizeof(void *));
-      memcpy(&new_tail->child[rrb->root->len], &rrb->tail->child[0],
-             rrb->tail_len * sizeof(void *));
-      rrb->tail_len = rrb->cnt;
-      rrb->root = NULL;
-      rrb->tail = new_tail;
-    }
-    // no need for <= here, because if the root node is == rrb_branching, the
-    // invariant is kept.
-    else if (rrb->cnt - rrb->tail_len < RRB_BRANCHING) {
-      // create both a new tail and a new root node
-      const uint32_t tail_cut = RRB_BRANCHING - rrb->root->len;
-      LeafNode *new_root = leaf_node_create(RRB_BRANCHING);
-      LeafNode *new_tail = leaf_node_create(rrb->tail_len - tail_cut);
-
-      memcpy(&new_root->child[0], &((LeafNode *) rrb->root)->child[0],
-             rrb->root->len * sizeof(void *));
-      memcpy(&new_root->child[rrb->root->len], &rrb->tail->child[0],
-             tail_cut * sizeof(void *));
-      memcpy(&new_tail->child[0], &rrb->tail->child[tail_cut],
-             (rrb->tail_len - tail_cut) * sizeof(void *));
-
-      rrb->tail_len = rrb->tail_len - tail_cut;
-      rrb->tail = new_tail;
-      rrb->root = (TreeNode *) new_root;
-    }
-  }
+  fill_root_leaf(rrb);
   return rrb;
 }
 
 static TreeNode* slice_left_rec(uint32_t *total_shift, const TreeNode *root,
                                 uint32_t left, uint32_t shift,
-                                char has_right) {
+                                char has_right, char pointer_free) {
   const uint32_t subshift = DEC_SHIFT(shift);
   uint32_t subidx = left >> shift;
   if (shift > LEAF_NODE_SHIFT) {
@@ -1233,9 +2114,7 @@ static TreeNode* slice_left_rec(uint32_t *total_shift, const TreeNode *root,
     else { // if (internal_root->size_table != NULL)
       const RRBSizeTable *table = internal_root->size_table;
 
-      while (table->size[subidx] <= idx) {
-        subidx++;
-      }
+      subidx = size_table_search(table, subidx, idx);
       if (subidx != 0) {
         idx -= table->size[subidx - 1];
       }
@@ -1245,7 +2124,7 @@ static TreeNode* slice_left_rec(uint32_t *total_shift, const TreeNode *root,
     const TreeNode *child = (TreeNode *) internal_root->child[subidx];
     TreeNode *left_hand_node =
       slice_left_rec(total_shift, child, idx, subshift,
-                     (subidx != last_slot) | has_right);
+                     (subidx != last_slot) | has_right, pointer_free);
     if (subidx == last_slot) { // No more slots left
       if (has_right) {
         InternalNode *left_hand_parent = internal_node_create(1);
@@ -1313,7 +2192,7 @@ static TreeNode* slice_left_rec(uint32_t *total_shift, const TreeNode *root,
   else { // if (shift <= RRB_BRANCHING)
     LeafNode *leaf_root = (LeafNode *) root;
     const uint32_t right_vals_len = leaf_root->len - subidx;
-    LeafNode *right_vals = leaf_node_create(right_vals_len);
+    LeafNode *right_vals = leaf_node_create(right_vals_len, pointer_free);
 
     memcpy(right_vals->child, &leaf_root->child[subidx],
            right_vals_len * sizeof(void *));
@@ -1324,18 +2203,52 @@ static TreeNode* slice_left_rec(uint32_t *total_shift, const TreeNode *root,
 }
 
 const RRB* rrb_slice(const RRB *rrb, uint32_t from, uint32_t to) {
-  return slice_left(slice_right(rrb, to), from);
+  RRB_SCOPE_BEGIN();
+  const uint32_t head_len = rrb->head_len;
+  if (head_len == 0) {
+    return RRB_SCOPE_END(slice_left(slice_right(rrb, to), from));
+  }
+  // Slice the trie and tail without the head, then put the part of the head
+  // that's left in front of them.
+  const uint32_t head_from = MIN(from, head_len);
+  const uint32_t head_to = MIN(to, head_len);
+  RRB body;
+  memcpy(&body, rrb, sizeof(RRB));
+  body.head_len = 0;
+  body.head = NULL;
+  RRB *new_rrb = rrb_head_clone(slice_left(slice_right(&body, to - head_to),
+                                           from - head_from));
+  if (head_from < head_to) {
+    new_rrb->head_len = head_to - head_from;
+    if (new_rrb->head_len == head_len) {
+      new_rrb->head = rrb->head;
+    }
+    else {
+      new_rrb->head = leaf_node_create(new_rrb->head_len, rrb->pointer_free);
+      memcpy(new_rrb->head->child, &rrb->head->child[head_from],
+             new_rrb->head_len * sizeof(void *));
+    }
+  }
+  return RRB_SCOPE_END(new_rrb);
 }
 
 const RRB* rrb_update(const RRB *restrict rrb, uint32_t index, const void *restrict elt) {
+  RRB_SCOPE_BEGIN();
+  if (index < rrb->head_len) {
+    RRB *new_rrb = rrb_head_clone(rrb);
+    new_rrb->head = leaf_node_clone(rrb->head, rrb->pointer_free);
+    new_rrb->head->child[index] = elt;
+    return RRB_SCOPE_END(new_rrb);
+  }
+  index -= rrb->head_len;
   if (index < rrb->cnt) {
     RRB *new_rrb = rrb_head_clone(rrb);
     const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
     if (tail_offset <= index) {
-      LeafNode *new_tail = leaf_node_clone(rrb->tail);
+      LeafNode *new_tail = leaf_node_clone(rrb->tail, rrb->pointer_free);
       new_tail->child[index - tail_offset] = elt;
       new_rrb->tail = new_tail;
-      return new_rrb;
+      return RRB_SCOPE_END(new_rrb);
     }
     InternalNode **previous_pointer = (InternalNode **) &new_rrb->root;
     InternalNode *current = (InternalNode *) rrb->root;
@@ -1355,37 +2268,1668 @@ const RRB* rrb_update(const RRB *restrict rrb, uint32_t index, const void *restr
     }
 
     LeafNode *leaf = (LeafNode *) current;
-    leaf = leaf_node_clone(leaf);
+    leaf = leaf_node_clone(leaf, rrb->pointer_free);
     *previous_pointer = (InternalNode *) leaf;
     leaf->child[index & RRB_MASK] = elt;
-    return new_rrb;
+    return RRB_SCOPE_END(new_rrb);
   }
   else {
-    return NULL;
+    return RRB_SCOPE_END(NULL);
   }
 }
 
-// Also assume direct append
-const RRB* rrb_pop(const RRB *rrb) {
-  if (rrb->cnt == 1) {
-    return rrb_create();
+// indices are sorted and within node, which starts at index start. As
+// nth_many_rec, but clones node and the children the indices are in instead.
+static InternalNode* update_many_rec(const InternalNode *node, uint32_t shift,
+                                     uint32_t start, const uint32_t *indices,
+                                     const void *const *elts, uint32_t n,
+                                     char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    LeafNode *leaf = leaf_node_clone((const LeafNode *) node, pointer_free);
+    for (uint32_t i = 0; i < n; i++) {
+      leaf->child[indices[i] - start] = elts[i];
+    }
+    return (InternalNode *) leaf;
   }
-  RRB* new_rrb = rrb_head_clone(rrb);
-  new_rrb->cnt--;
 
-  if (rrb->tail_len == 1) {
-    promote_rightmost_leaf(new_rrb);
-    return new_rrb;
+  InternalNode *clone = internal_node_clone(node);
+  uint32_t i = 0;
+  while (i < n) {
+    uint32_t idx = indices[i] - start;
+    uint32_t child_index, child_size;
+    if (node->size_table == NULL) {
+      child_index = (idx >> shift) & RRB_MASK;
+      child_size = 1u << shift;
+      idx -= child_index << shift;
+    }
+    else {
+      child_index = sized_pos(node, &idx, shift);
+      child_size = node->size_table->size[child_index]
+                 - (child_index == 0 ? 0 : node->size_table->size[child_index-1]);
+    }
+    const uint32_t child_start = indices[i] - idx;
+    const uint32_t first = i;
+    do {
+      i++;
+    } while (i < n && indices[i] - child_start < child_size);
+
+    clone->child[child_index] =
+      update_many_rec(node->child[child_index], DEC_SHIFT(shift), child_start,
+                      &indices[first], &elts[first], i - first, pointer_free);
   }
-  else {
-    LeafNode *new_tail = leaf_node_dec(rrb->tail);
-    new_rrb->tail_len--;
-    new_rrb->tail = new_tail;
-    return new_rrb;
+  return clone;
+}
+
+const RRB* rrb_update_many(const RRB *rrb, const uint32_t *indices,
+                           const void *const *elts, uint32_t n) {
+  RRB_SCOPE_BEGIN();
+  if (n == 0) {
+    return RRB_SCOPE_END(rrb);
+  }
+  if (indices[n - 1] >= rrb_count(rrb)) {
+    return RRB_SCOPE_END(NULL);
+  }
+  RRB *new_rrb = rrb_head_clone(rrb);
+  const uint32_t head_len = rrb->head_len;
+  uint32_t i = 0;
+  if (indices[0] < head_len) {
+    new_rrb->head = leaf_node_clone(rrb->head, rrb->pointer_free);
+    for (; i < n && indices[i] < head_len; i++) {
+      new_rrb->head->child[indices[i]] = elts[i];
+    }
+  }
+
+  const uint32_t tail_offset = head_len + rrb->cnt - rrb->tail_len;
+  const uint32_t in_trie = i;
+  while (i < n && indices[i] < tail_offset) {
+    i++;
+  }
+  if (i != in_trie) {
+    // The indices are relative to the whole tree, so the trie starts at
+    // head_len.
+    new_rrb->root = (TreeNode *)
+      update_many_rec((const InternalNode *) rrb->root, RRB_SHIFT(rrb),
+                      head_len, &indices[in_trie], &elts[in_trie], i - in_trie,
+                      rrb->pointer_free);
+  }
+
+  if (i != n) {
+    new_rrb->tail = leaf_node_clone(rrb->tail, rrb->pointer_free);
+    for (; i < n; i++) {
+      new_rrb->tail->child[indices[i] - tail_offset] = elts[i];
+    }
+  }
+  return RRB_SCOPE_END(new_rrb);
+}
+
+// Returns a copy of original where the n items from index from are replaced by
+// elts. If all of them are, the items in original aren't copied.
+static LeafNode* leaf_node_write(const LeafNode *original, uint32_t from,
+                                 const void *const *elts, uint32_t n,
+                                 char pointer_free) {
+  LeafNode *leaf;
+  if (n == original->len) {
+    leaf = leaf_node_create(n, pointer_free);
+  }
+  else {
+    leaf = leaf_node_clone(original, pointer_free);
+  }
+  memcpy(&leaf->child[from], elts, n * sizeof(void *));
+  return leaf;
+}
+
+// Replaces the n items from index from in node, where from + n is within
+// node, and returns the new node. Children that are entirely overwritten are
+// recreated without being copied.
+static InternalNode* write_range_rec(const InternalNode *node, uint32_t shift,
+                                     uint32_t from, const void *const *elts,
+                                     uint32_t n, char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    return (InternalNode *) leaf_node_write((const LeafNode *) node, from,
+                                            elts, n, pointer_free);
+  }
+
+  InternalNode *clone = internal_node_clone(node);
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(node, shift, sizes);
+
+  uint32_t child_index = 0;
+  while (sizes[child_index] <= from) {
+    child_index++;
+  }
+  const uint32_t to = from + n;
+  for (uint32_t pos = from; pos < to; child_index++) {
+    const uint32_t child_start = (child_index == 0) ? 0 : sizes[child_index-1];
+    const uint32_t child_to = MIN(to, sizes[child_index]);
+    clone->child[child_index] =
+      write_range_rec(node->child[child_index], DEC_SHIFT(shift),
+                      pos - child_start, &elts[pos - from], child_to - pos,
+                      pointer_free);
+    pos = child_to;
+  }
+  return clone;
+}
+
+const RRB* rrb_write_range(const RRB *rrb, uint32_t from,
+                           const void *const *elts, uint32_t n) {
+  RRB_SCOPE_BEGIN();
+  if (n == 0) {
+    return RRB_SCOPE_END(rrb);
+  }
+  if (from + n > rrb_count(rrb) || from + n < from) {
+    return RRB_SCOPE_END(NULL);
+  }
+  RRB *new_rrb = rrb_head_clone(rrb);
+  const uint32_t head_len = rrb->head_len;
+  const uint32_t to = from + n;
+  if (from < head_len) {
+    const uint32_t head_to = MIN(to, head_len);
+    new_rrb->head = leaf_node_write(rrb->head, from, elts, head_to - from,
+                                    rrb->pointer_free);
+  }
+
+  const uint32_t tail_offset = head_len + rrb->cnt - rrb->tail_len;
+  const uint32_t trie_from = MAX(from, head_len);
+  const uint32_t trie_to = MIN(to, tail_offset);
+  if (trie_from < trie_to) {
+    new_rrb->root = (TreeNode *)
+      write_range_rec((const InternalNode *) rrb->root, RRB_SHIFT(rrb),
+                      trie_from - head_len, &elts[trie_from - from],
+                      trie_to - trie_from, rrb->pointer_free);
+  }
+
+  if (tail_offset < to) {
+    const uint32_t tail_from = MAX(from, tail_offset);
+    new_rrb->tail = leaf_node_write(rrb->tail, tail_from - tail_offset,
+                                    &elts[tail_from - from], to - tail_from,
+                                    rrb->pointer_free);
+  }
+  return RRB_SCOPE_END(new_rrb);
+}
+
+static LeafNode* leaf_node_map(const LeafNode *original, uint32_t len,
+                               RRBMapFn fn, void *ctx, char pointer_free) {
+  LeafNode *mapped = leaf_node_create(len, pointer_free);
+  RRB_CALLBACKS_BEGIN();
+  for (uint32_t i = 0; i < len; i++) {
+    mapped->child[i] = fn((void *) original->child[i], ctx);
+  }
+  RRB_CALLBACKS_END();
+  return mapped;
+}
+
+// Maps the subtrie node into a new one of the same shape. Sizes don't change,
+// so the new internal nodes share the size tables of the old ones.
+static TreeNode* map_rec(const TreeNode *node, uint32_t shift, RRBMapFn fn,
+                         void *ctx, char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    const LeafNode *leaf = (const LeafNode *) node;
+    return (TreeNode *) leaf_node_map(leaf, leaf->len, fn, ctx, pointer_free);
+  }
+  const InternalNode *internal = (const InternalNode *) node;
+  InternalNode *mapped = internal_node_create(internal->len);
+  mapped->size_table = internal->size_table;
+  for (uint32_t i = 0; i < internal->len; i++) {
+    mapped->child[i] = (InternalNode *)
+      map_rec((const TreeNode *) internal->child[i], DEC_SHIFT(shift), fn, ctx,
+              pointer_free);
+  }
+  return (TreeNode *) mapped;
+}
+
+const RRB* rrb_map(const RRB *rrb, RRBMapFn fn, void *ctx) {
+  RRB_SCOPE_BEGIN();
+  if (rrb->head_len == 0 && rrb->cnt == 0) {
+    return RRB_SCOPE_END(rrb);
+  }
+  RRB *new_rrb = rrb_head_clone(rrb);
+  if (rrb->head_len != 0) {
+    new_rrb->head = leaf_node_map(rrb->head, rrb->head_len, fn, ctx,
+                                  rrb->pointer_free);
+  }
+  if (rrb->root != NULL) {
+    new_rrb->root = map_rec(rrb->root, RRB_SHIFT(rrb), fn, ctx,
+                            rrb->pointer_free);
+  }
+  if (rrb->tail_len != 0) {
+    new_rrb->tail = leaf_node_map(rrb->tail, rrb->tail_len, fn, ctx,
+                                  rrb->pointer_free);
+  }
+  return RRB_SCOPE_END(new_rrb);
+}
+
+// Pushes the items for which pred holds onto kept, and the others onto
+// rejected, unless it is NULL. len must be at most RRB_BRANCHING, so that the
+// survivors can be pushed a leaf at a time.
+static void partition_items(const void *const *items, uint32_t len,
+                            RRBPredFn pred, void *ctx, TransientRRB **kept,
+                            TransientRRB **rejected) {
+  const void *kept_items[RRB_BRANCHING];
+  const void *rejected_items[RRB_BRANCHING];
+  uint32_t kept_len = 0, rejected_len = 0;
+  RRB_CALLBACKS_BEGIN();
+  for (uint32_t i = 0; i < len; i++) {
+    if (pred((void *) items[i], ctx)) {
+      kept_items[kept_len++] = items[i];
+    }
+    else {
+      rejected_items[rejected_len++] = items[i];
+    }
+  }
+  RRB_CALLBACKS_END();
+  if (kept_len != 0) {
+    *kept = transient_rrb_push_many(*kept, kept_items, kept_len);
+  }
+  if (rejected != NULL && rejected_len != 0) {
+    *rejected = transient_rrb_push_many(*rejected, rejected_items,
+                                        rejected_len);
+  }
+}
+
+void rrb_partition(const RRB *rrb, RRBPredFn pred, void *ctx,
+                   const RRB **kept, const RRB **rejected) {
+  RRB_SCOPE_BEGIN();
+  TransientRRB *kept_trrb = rrb_to_transient(rrb_empty(rrb->pointer_free));
+  TransientRRB *rejected_trrb = (rejected != NULL)
+    ? rrb_to_transient(rrb_empty(rrb->pointer_free))
+    : NULL;
+
+  RRBIterator it;
+  it.rrb = rrb;
+  it.index = 0;
+  iterator_find_leaf(&it, 0);
+  uint32_t len;
+  const void *const *chunk;
+  while ((chunk = rrb_iterator_next_chunk(&it, &len)) != NULL) {
+    partition_items(chunk, len, pred, ctx, &kept_trrb,
+                    (rejected != NULL) ? &rejected_trrb : NULL);
+  }
+
+  *kept = transient_to_rrb(kept_trrb);
+  if (rejected != NULL) {
+    *rejected = transient_to_rrb(rejected_trrb);
+  }
+  const RRB *results[2] = {*kept, (rejected != NULL) ? *rejected : NULL};
+  RRB_SCOPE_END_MANY(results, 2);
+}
+
+const RRB* rrb_filter(const RRB *rrb, RRBPredFn pred, void *ctx) {
+  RRB_SCOPE_BEGIN();
+  const RRB *kept;
+  rrb_partition(rrb, pred, ctx, &kept, NULL);
+  return RRB_SCOPE_END(kept);
+}
+
+// Sorting is a bottom-up merge sort. The items are copied out in chunks, and
+// every chunk is sorted on its own, starting from leaf-sized runs sorted by
+// insertion. The chunks are then merged pairwise until one run is left. Every
+// merge is cut into chunk-sized pieces of output, so the pieces of a pass are
+// independent of each other, and the last pass merges straight into the
+// leaves of the new tree.
+#define RRB_SORT_CHUNK (1 << 13)
+
+struct SortState_ {
+  const RRB *rrb;
+  RRBCmpFn cmp;
+  void *ctx;
+  uint32_t n;
+  void **src;
+  void **dst;
+  // The length of the sorted runs in src that are being merged.
+  uint32_t width;
+  // Where the last pass puts its output, NULL before that.
+  LeafNode **leaves;
+  void (*piece)(SortState *s, uint32_t i);
+};
+
+// Stable, as are the merges, so equal items keep their order.
+static void insertion_sort(void **items, uint32_t len, RRBCmpFn cmp,
+                           void *ctx) {
+  RRB_CALLBACKS_BEGIN();
+  for (uint32_t i = 1; i < len; i++) {
+    void *item = items[i];
+    uint32_t j = i;
+    for (; j > 0 && cmp(items[j - 1], item, ctx) > 0; j--) {
+      items[j] = items[j - 1];
+    }
+    items[j] = item;
+  }
+  RRB_CALLBACKS_END();
+}
+
+// Merges the next len items from left and right, starting at l and r, into
+// out, and moves l and r past them. Takes from left when the items are equal.
+static void merge_runs(void *const *left, uint32_t left_len,
+                       void *const *right, uint32_t right_len,
+                       uint32_t *l, uint32_t *r, void **out, uint32_t len,
+                       RRBCmpFn cmp, void *ctx) {
+  uint32_t i = *l, j = *r;
+  RRB_CALLBACKS_BEGIN();
+  for (uint32_t k = 0; k < len; k++) {
+    if (j == right_len || (i < left_len && cmp(left[i], right[j], ctx) <= 0)) {
+      out[k] = left[i++];
+    }
+    else {
+      out[k] = right[j++];
+    }
+  }
+  RRB_CALLBACKS_END();
+  *l = i;
+  *r = j;
+}
+
+// Returns how many of the first k items of the merge of left and right come
+// from left, by binary search.
+static uint32_t merge_split(void *const *left, uint32_t left_len,
+                            void *const *right, uint32_t right_len,
+                            uint32_t k, RRBCmpFn cmp, void *ctx) {
+  uint32_t lo = (k > right_len) ? k - right_len : 0;
+  uint32_t hi = MIN(k, left_len);
+  RRB_CALLBACKS_BEGIN();
+  while (lo < hi) {
+    const uint32_t i = lo + (hi - lo) / 2;
+    // left[i] is among the first k if it doesn't come after right[k - i - 1].
+    if (cmp(left[i], right[k - i - 1], ctx) <= 0) {
+      lo = i + 1;
+    }
+    else {
+      hi = i;
+    }
+  }
+  RRB_CALLBACKS_END();
+  return lo;
+}
+
+// Copies chunk i into src, and sorts it there.
+static void sort_chunk_piece(SortState *s, uint32_t i) {
+  const uint32_t from = i * RRB_SORT_CHUNK;
+  const uint32_t len = MIN(RRB_SORT_CHUNK, s->n - from);
+  rrb_copy_range(s->rrb, from, from + len, &s->src[from]);
+  for (uint32_t run = 0; run < len; run += RRB_BRANCHING) {
+    insertion_sort(&s->src[from + run], MIN(RRB_BRANCHING, len - run), s->cmp,
+                   s->ctx);
+  }
+
+  void **src = &s->src[from], **dst = &s->dst[from];
+  for (uint32_t width = RRB_BRANCHING; width < len; width *= 2) {
+    for (uint32_t start = 0; start < len; start += 2 * width) {
+      const uint32_t left_len = MIN(width, len - start);
+      const uint32_t right_len = MIN(width, len - start - left_len);
+      uint32_t l = 0, r = 0;
+      merge_runs(&src[start], left_len, &src[start + left_len], right_len,
+                 &l, &r, &dst[start], left_len + right_len, s->cmp, s->ctx);
+    }
+    void **tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+  if (src != &s->src[from]) {
+    memcpy(&s->src[from], src, len * sizeof(void *));
+  }
+}
+
+// Merges the output from piece i onwards. The pieces are aligned to both the
+// runs and the leaves, so each of them is within a single merge, and fills
+// whole leaves.
+static void sort_merge_piece(SortState *s, uint32_t i) {
+  const uint32_t from = i * RRB_SORT_CHUNK;
+  const uint32_t len = MIN(RRB_SORT_CHUNK, s->n - from);
+  const uint32_t start = from - from % (2 * s->width);
+  void *const *left = &s->src[start];
+  const uint32_t left_len = MIN(s->width, s->n - start);
+  void *const *right = &s->src[start + left_len];
+  const uint32_t right_len = MIN(s->width, s->n - start - left_len);
+
+  uint32_t l = merge_split(left, left_len, right, right_len, from - start,
+                           s->cmp, s->ctx);
+  uint32_t r = from - start - l;
+  if (s->leaves == NULL) {
+    merge_runs(left, left_len, right, right_len, &l, &r, &s->dst[from], len,
+               s->cmp, s->ctx);
+    return;
+  }
+  for (uint32_t leaf_start = from; leaf_start < from + len;
+       leaf_start += RRB_BRANCHING) {
+    LeafNode *leaf = leaf_node_create(MIN(RRB_BRANCHING, s->n - leaf_start),
+                                      s->rrb->pointer_free);
+    merge_runs(left, left_len, right, right_len, &l, &r, (void **) leaf->child,
+               leaf->len, s->cmp, s->ctx);
+    s->leaves[leaf_start >> RRB_BITS] = leaf;
+  }
+}
+
+static void sort_run_seq(SortState *s, uint32_t pieces) {
+  for (uint32_t i = 0; i < pieces; i++) {
+    s->piece(s, i);
+  }
+}
+
+static const RRB* sort_tree(const RRB *rrb, RRBCmpFn cmp, void *ctx,
+                            SortRunner run) {
+  const uint32_t n = rrb_count(rrb);
+  if (n <= 1) {
+    return rrb;
+  }
+  SortState s = {.rrb = rrb, .cmp = cmp, .ctx = ctx, .n = n,
+                 .src = RRB_MALLOC(n * sizeof(void *)),
+                 .dst = RRB_MALLOC(n * sizeof(void *)),
+                 .width = RRB_SORT_CHUNK, .leaves = NULL};
+  const uint32_t pieces = (n - 1) / RRB_SORT_CHUNK + 1;
+  s.piece = sort_chunk_piece;
+  run(&s, pieces);
+
+  s.piece = sort_merge_piece;
+  const uint32_t leaves_len = ((n - 1) >> RRB_BITS) + 1;
+  while (true) {
+    // The pass that leaves a single run is the last one. If there's only one
+    // chunk, it merges that with nothing, straight into the leaves.
+    if (s.width >= n || n - s.width <= s.width) {
+      s.leaves = RRB_MALLOC(leaves_len * sizeof(LeafNode *));
+      run(&s, pieces);
+      break;
+    }
+    run(&s, pieces);
+    void **tmp = s.src;
+    s.src = s.dst;
+    s.dst = tmp;
+    s.width *= 2;
+  }
+  RRB *sorted = rrb_from_leaves((TreeNode **) s.leaves, leaves_len - 1,
+                                s.leaves[leaves_len - 1], n,
+                                rrb->pointer_free);
+  RRB_FREE(s.src);
+  RRB_FREE(s.dst);
+  RRB_FREE(s.leaves);
+  return sorted;
+}
+
+const RRB* rrb_sort(const RRB *rrb, RRBCmpFn cmp, void *ctx) {
+  RRB_SCOPE_BEGIN();
+  return RRB_SCOPE_END(sort_tree(rrb, cmp, ctx, sort_run_seq));
+}
+
+// Also assume direct append
+const RRB* rrb_pop(const RRB *rrb) {
+  RRB_SCOPE_BEGIN();
+  if (rrb->cnt <= 1 && rrb->head_len + rrb->cnt == 1) {
+    return RRB_SCOPE_END(rrb_empty(rrb->pointer_free));
+  }
+  else if (rrb->cnt == 0) { // only the head is left
+    RRB* new_rrb = rrb_head_clone(rrb);
+    new_rrb->head = leaf_node_dec(rrb->head, rrb->pointer_free);
+    new_rrb->head_len--;
+    return RRB_SCOPE_END(new_rrb);
+  }
+  else if (rrb->cnt == 1) {
+    RRB* new_rrb = rrb_head_clone(rrb);
+    new_rrb->cnt = 0;
+    new_rrb->tail_len = 0;
+    new_rrb->tail = &EMPTY_LEAF;
+    return RRB_SCOPE_END(new_rrb);
+  }
+  RRB* new_rrb = rrb_head_clone(rrb);
+  new_rrb->cnt--;
+
+  if (rrb->tail_len == 1) {
+    promote_rightmost_leaf(new_rrb);
+    // The root may have been replaced by a leaf that isn't full.
+    fill_root_leaf(new_rrb);
+    return RRB_SCOPE_END(new_rrb);
+  }
+  else {
+    LeafNode *new_tail = leaf_node_dec(rrb->tail, rrb->pointer_free);
+    new_rrb->tail_len--;
+    new_rrb->tail = new_tail;
+    // A relaxed trie may be short enough to fit in the tail by now.
+    if (new_rrb->cnt <= RRB_BRANCHING) {
+      fill_root_leaf(new_rrb);
+    }
+    return RRB_SCOPE_END(new_rrb);
+  }
+}
+
+// Inserts elt before the item at index in the subtrie root, copying the nodes
+// on the way down. A node that overflows is split in two halves: the left half
+// is returned and the right half is put in *split, which is NULL otherwise.
+// Internal nodes on the path get size tables, as they may no longer be dense.
+static TreeNode* insert_at_rec(const TreeNode *root, uint32_t shift,
+                               uint32_t index, const void *elt,
+                               TreeNode **split, char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    const LeafNode *leaf = (const LeafNode *) root;
+    if (leaf->len < RRB_BRANCHING) {
+      *split = NULL;
+      return (TreeNode *) leaf_node_insert(leaf, index, elt, pointer_free);
+    }
+    const void *items[RRB_BRANCHING + 1];
+    memcpy(items, leaf->child, index * sizeof(void *));
+    items[index] = elt;
+    memcpy(&items[index + 1], &leaf->child[index],
+           (RRB_BRANCHING - index) * sizeof(void *));
+
+    const uint32_t left_len = (RRB_BRANCHING + 1) / 2;
+    LeafNode *left = leaf_node_create(left_len, pointer_free);
+    LeafNode *right = leaf_node_create(RRB_BRANCHING + 1 - left_len,
+                                       pointer_free);
+    memcpy(left->child, items, left_len * sizeof(void *));
+    memcpy(right->child, &items[left_len], right->len * sizeof(void *));
+    *split = (TreeNode *) right;
+    return (TreeNode *) left;
+  }
+
+  const InternalNode *internal = (const InternalNode *) root;
+  const uint32_t child_shift = DEC_SHIFT(shift);
+  uint32_t len = internal->len;
+  InternalNode *children[RRB_BRANCHING + 1];
+  uint32_t sizes[RRB_BRANCHING + 1];
+  cumulative_sizes(internal, shift, sizes);
+
+  uint32_t child_index;
+  if (internal->size_table == NULL) {
+    child_index = index >> shift;
+    index -= child_index << shift;
+  }
+  else {
+    child_index = sized_pos(internal, &index, shift);
+  }
+
+  TreeNode *right;
+  TreeNode *child = insert_at_rec((TreeNode *) internal->child[child_index],
+                                  child_shift, index, elt, &right,
+                                  pointer_free);
+  memcpy(children, internal->child, len * sizeof(InternalNode *));
+  children[child_index] = (InternalNode *) child;
+  for (uint32_t i = child_index; i < len; i++) {
+    sizes[i]++;
+  }
+
+  if (right != NULL) {
+    memmove(&children[child_index + 2], &children[child_index + 1],
+            (len - child_index - 1) * sizeof(InternalNode *));
+    memmove(&sizes[child_index + 1], &sizes[child_index],
+            (len - child_index) * sizeof(uint32_t));
+    children[child_index + 1] = (InternalNode *) right;
+    sizes[child_index] -= size_sub_trie(right, child_shift);
+    len++;
+  }
+
+  if (len <= RRB_BRANCHING) {
+    *split = NULL;
+    return (TreeNode *) internal_node_sized(children, sizes, len, 0);
+  }
+  const uint32_t left_len = len / 2;
+  *split = (TreeNode *) internal_node_sized(&children[left_len],
+                                            &sizes[left_len], len - left_len,
+                                            sizes[left_len - 1]);
+  return (TreeNode *) internal_node_sized(children, sizes, left_len, 0);
+}
+
+const RRB* rrb_insert_at(const RRB *restrict rrb, uint32_t index,
+                         const void *restrict elt) {
+  RRB_SCOPE_BEGIN();
+  if (index <= rrb->head_len && rrb->head_len != 0) {
+    RRB *new_rrb = rrb_head_clone(rrb);
+    if (rrb->head_len < RRB_BRANCHING) {
+      new_rrb->head = leaf_node_insert(rrb->head, index, elt,
+                                       rrb->pointer_free);
+      new_rrb->head_len++;
+      return RRB_SCOPE_END(new_rrb);
+    }
+    // The head is full, so push it down and insert into the trie instead.
+    push_down_head(new_rrb);
+    rrb = new_rrb;
+  }
+  else {
+    index -= rrb->head_len;
+  }
+
+  if (index == rrb->cnt) {
+    return RRB_SCOPE_END(rrb_push(rrb, elt));
+  }
+  else if (index > rrb->cnt) {
+    return RRB_SCOPE_END(NULL);
+  }
+  RRB *new_rrb = rrb_head_clone(rrb);
+  new_rrb->cnt++;
+
+  const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
+  if (tail_offset <= index) {
+    const uint32_t tail_index = index - tail_offset;
+    if (rrb->tail_len < RRB_BRANCHING) {
+      new_rrb->tail = leaf_node_insert(rrb->tail, tail_index, elt,
+                                       rrb->pointer_free);
+      new_rrb->tail_len++;
+      return RRB_SCOPE_END(new_rrb);
+    }
+    // The tail is full, so its last item overflows into a new tail and the
+    // rest is pushed down.
+    LeafNode *push_down = leaf_node_create(RRB_BRANCHING, rrb->pointer_free);
+    memcpy(push_down->child, rrb->tail->child, tail_index * sizeof(void *));
+    push_down->child[tail_index] = elt;
+    memcpy(&push_down->child[tail_index + 1], &rrb->tail->child[tail_index],
+           (RRB_MASK - tail_index) * sizeof(void *));
+
+    LeafNode *new_tail = leaf_node_create(1, rrb->pointer_free);
+    new_tail->child[0] = rrb->tail->child[RRB_MASK];
+    new_rrb->tail = push_down;
+    new_rrb->tail_len = 1;
+    return RRB_SCOPE_END(push_down_tail(rrb, new_rrb, new_tail));
+  }
+
+  TreeNode *split;
+  TreeNode *root = insert_at_rec(rrb->root, RRB_SHIFT(rrb), index, elt, &split,
+                                 rrb->pointer_free);
+  if (split != NULL) {
+    InternalNode *new_root = internal_node_new_above((InternalNode *) root,
+                                                     (InternalNode *) split);
+    new_rrb->shift = INC_SHIFT(RRB_SHIFT(rrb));
+    root = (TreeNode *) set_sizes(new_root, RRB_SHIFT(new_rrb));
+  }
+  new_rrb->root = root;
+  return RRB_SCOPE_END(new_rrb);
+}
+
+// Removes the item at index from the subtrie root, copying the nodes on the
+// way down. Returns NULL if the subtrie ends up empty. A child that shrinks is
+// merged with a neighbour if both fit in a single node, so that removals don't
+// leave a trail of near-empty nodes behind.
+static TreeNode* remove_at_rec(const TreeNode *root, uint32_t shift,
+                               uint32_t index, char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    const LeafNode *leaf = (const LeafNode *) root;
+    if (leaf->len == 1) {
+      return NULL;
+    }
+    return (TreeNode *) leaf_node_remove(leaf, index, pointer_free);
+  }
+
+  const InternalNode *internal = (const InternalNode *) root;
+  const uint32_t child_shift = DEC_SHIFT(shift);
+  uint32_t len = internal->len;
+  InternalNode *children[RRB_BRANCHING];
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(internal, shift, sizes);
+
+  uint32_t child_index;
+  if (internal->size_table == NULL) {
+    child_index = index >> shift;
+    index -= child_index << shift;
+  }
+  else {
+    child_index = sized_pos(internal, &index, shift);
+  }
+
+  TreeNode *child = remove_at_rec((TreeNode *) internal->child[child_index],
+                                  child_shift, index, pointer_free);
+  if (child == NULL && len == 1) {
+    return NULL;
+  }
+  memcpy(children, internal->child, len * sizeof(InternalNode *));
+  for (uint32_t i = child_index; i < len; i++) {
+    sizes[i]--;
+  }
+
+  // The slot to remove, if any. A merged node is put in the right slot of the
+  // pair, as its cumulative size is the one already there.
+  uint32_t drop = len;
+  if (child == NULL) {
+    drop = child_index;
+  }
+  else {
+    children[child_index] = (InternalNode *) child;
+    if (child_index > 0 &&
+        children[child_index - 1]->len + child->len <= RRB_BRANCHING) {
+      children[child_index] = (InternalNode *)
+        node_merge((TreeNode *) children[child_index - 1], child, child_shift,
+                   pointer_free);
+      drop = child_index - 1;
+    }
+    else if (child_index + 1 < len &&
+             child->len + children[child_index + 1]->len <= RRB_BRANCHING) {
+      children[child_index + 1] = (InternalNode *)
+        node_merge(child, (TreeNode *) children[child_index + 1], child_shift,
+                   pointer_free);
+      drop = child_index;
+    }
+  }
+
+  if (drop != len) {
+    memmove(&children[drop], &children[drop + 1],
+            (len - drop - 1) * sizeof(InternalNode *));
+    memmove(&sizes[drop], &sizes[drop + 1],
+            (len - drop - 1) * sizeof(uint32_t));
+    len--;
+  }
+  return (TreeNode *) internal_node_sized(children, sizes, len, 0);
+}
+
+const RRB* rrb_remove_at(const RRB *rrb, uint32_t index) {
+  RRB_SCOPE_BEGIN();
+  if (index < rrb->head_len) {
+    if (rrb->head_len + rrb->cnt == 1) {
+      return RRB_SCOPE_END(rrb_empty(rrb->pointer_free));
+    }
+    RRB *new_rrb = rrb_head_clone(rrb);
+    new_rrb->head_len--;
+    new_rrb->head = (new_rrb->head_len == 0) ? NULL
+                  : leaf_node_remove(rrb->head, index, rrb->pointer_free);
+    return RRB_SCOPE_END(new_rrb);
+  }
+  index -= rrb->head_len;
+  if (index >= rrb->cnt) {
+    return RRB_SCOPE_END(NULL);
+  }
+  const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
+  if (tail_offset <= index) {
+    if (rrb->tail_len == 1) {
+      return RRB_SCOPE_END(rrb_pop(rrb));
+    }
+    RRB *new_rrb = rrb_head_clone(rrb);
+    new_rrb->cnt--;
+    new_rrb->tail_len--;
+    new_rrb->tail = leaf_node_remove(rrb->tail, index - tail_offset,
+                                     rrb->pointer_free);
+    fill_root_leaf(new_rrb);
+    return RRB_SCOPE_END(new_rrb);
+  }
+
+  RRB *new_rrb = rrb_head_clone(rrb);
+  new_rrb->cnt--;
+  TreeNode *root = remove_at_rec(rrb->root, RRB_SHIFT(rrb), index,
+                                 rrb->pointer_free);
+
+  // Remove roots with a single child, as in promote_rightmost_leaf.
+  while (root != NULL && RRB_SHIFT(new_rrb) > LEAF_NODE_SHIFT &&
+         root->len == 1) {
+    root = (TreeNode *) ((InternalNode *) root)->child[0];
+    new_rrb->shift = DEC_SHIFT(RRB_SHIFT(new_rrb));
+  }
+  if (root == NULL) {
+    new_rrb->shift = LEAF_NODE_SHIFT;
+  }
+  new_rrb->root = root;
+  fill_root_leaf(new_rrb);
+  return RRB_SCOPE_END(new_rrb);
+}
+
+// Puts leaf in front of the subtrie root, copying the left edge down to the
+// lowest node with room for it. Returns NULL if there is no room in root, in
+// which case the caller has to put the leaf in a new node.
+static InternalNode* prepend_leaf_rec(const InternalNode *root, uint32_t shift,
+                                      LeafNode *leaf) {
+  InternalNode *child = NULL;
+  if (shift > INC_SHIFT(LEAF_NODE_SHIFT)) {
+    child = prepend_leaf_rec(root->child[0], DEC_SHIFT(shift), leaf);
+  }
+  if (child == NULL && root->len == RRB_BRANCHING) {
+    return NULL;
+  }
+
+  uint32_t len = root->len;
+  InternalNode *children[RRB_BRANCHING];
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(root, shift, sizes);
+  memcpy(children, root->child, len * sizeof(InternalNode *));
+  if (child != NULL) {
+    children[0] = child;
+  }
+  else {
+    memmove(&children[1], &children[0], len * sizeof(InternalNode *));
+    memmove(&sizes[1], &sizes[0], len * sizeof(uint32_t));
+    sizes[0] = 0;
+    child = (InternalNode *) leaf;
+    for (uint32_t s = INC_SHIFT(LEAF_NODE_SHIFT); s < shift; s += RRB_BITS) {
+      child = internal_node_new_above1(child);
+    }
+    children[0] = child;
+    len++;
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    sizes[i] += leaf->len;
+  }
+  return internal_node_sized(children, sizes, len, 0);
+}
+
+/**
+ * Destructively moves the full head of new_rrb into the trie, as its leftmost
+ * leaf. This is push_down_tail for the front, but nodes on the left edge
+ * always need size tables afterwards.
+ */
+static void push_down_head(RRB *new_rrb) {
+  LeafNode *leaf = new_rrb->head;
+  new_rrb->head = NULL;
+  new_rrb->head_len = 0;
+
+  if (new_rrb->cnt == 0) {
+    new_rrb->tail = leaf;
+    new_rrb->tail_len = leaf->len;
+    new_rrb->cnt = leaf->len;
+    return;
+  }
+  new_rrb->cnt += leaf->len;
+  if (new_rrb->root == NULL) {
+    new_rrb->root = (TreeNode *) leaf;
+    new_rrb->shift = LEAF_NODE_SHIFT;
+    return;
+  }
+
+  InternalNode *root = NULL;
+  if (RRB_SHIFT(new_rrb) > LEAF_NODE_SHIFT) {
+    root = prepend_leaf_rec((InternalNode *) new_rrb->root, RRB_SHIFT(new_rrb),
+                            leaf);
+  }
+  if (root == NULL) { // Increasing height of tree.
+    InternalNode *left = (InternalNode *) leaf;
+    for (uint32_t s = LEAF_NODE_SHIFT; s < RRB_SHIFT(new_rrb); s += RRB_BITS) {
+      left = internal_node_new_above1(left);
+    }
+    root = internal_node_new_above(left, (InternalNode *) new_rrb->root);
+    new_rrb->shift = INC_SHIFT(RRB_SHIFT(new_rrb));
+    set_sizes(root, RRB_SHIFT(new_rrb));
+  }
+  new_rrb->root = (TreeNode *) root;
+}
+
+// Removes the leftmost leaf, of length leaf_len, from the subtrie root.
+// Returns NULL if the subtrie ends up empty.
+static InternalNode* drop_first_leaf_rec(const InternalNode *root,
+                                         uint32_t shift, uint32_t leaf_len) {
+  InternalNode *child = NULL;
+  if (shift > INC_SHIFT(LEAF_NODE_SHIFT)) {
+    child = drop_first_leaf_rec(root->child[0], DEC_SHIFT(shift), leaf_len);
+  }
+  if (child == NULL && root->len == 1) {
+    return NULL;
+  }
+
+  uint32_t len = root->len;
+  InternalNode *children[RRB_BRANCHING];
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(root, shift, sizes);
+  memcpy(children, root->child, len * sizeof(InternalNode *));
+  if (child != NULL) {
+    children[0] = child;
+  }
+  else {
+    len--;
+    memmove(&children[0], &children[1], len * sizeof(InternalNode *));
+    memmove(&sizes[0], &sizes[1], len * sizeof(uint32_t));
+  }
+  return internal_node_sized(children, sizes, len, leaf_len);
+}
+
+/**
+ * Destructively replaces the empty head of new_rrb with the leftmost leaf. If
+ * there is no trie, the tail becomes the head instead.
+ */
+static void promote_leftmost_leaf(RRB *new_rrb) {
+  if (new_rrb->root == NULL) {
+    new_rrb->head = new_rrb->tail;
+    new_rrb->head_len = new_rrb->tail_len;
+    new_rrb->tail = &EMPTY_LEAF;
+    new_rrb->tail_len = 0;
+    new_rrb->cnt = 0;
+    return;
+  }
+
+  const InternalNode *current = (const InternalNode *) new_rrb->root;
+  for (uint32_t shift = RRB_SHIFT(new_rrb); shift > 0; shift -= RRB_BITS) {
+    current = current->child[0];
+  }
+  new_rrb->head = (LeafNode *) current;
+  new_rrb->head_len = current->len;
+  new_rrb->cnt -= current->len;
+
+  TreeNode *root = NULL;
+  if (RRB_SHIFT(new_rrb) > LEAF_NODE_SHIFT) {
+    root = (TreeNode *) drop_first_leaf_rec((InternalNode *) new_rrb->root,
+                                            RRB_SHIFT(new_rrb), current->len);
+  }
+  while (root != NULL && RRB_SHIFT(new_rrb) > LEAF_NODE_SHIFT &&
+         root->len == 1) {
+    root = (TreeNode *) ((InternalNode *) root)->child[0];
+    new_rrb->shift = DEC_SHIFT(RRB_SHIFT(new_rrb));
+  }
+  if (root == NULL) {
+    new_rrb->shift = LEAF_NODE_SHIFT;
+  }
+  new_rrb->root = root;
+  fill_root_leaf(new_rrb);
+}
+
+// Returns rrb with its head moved into the trie, for the operations that only
+// work on the trie and the tail.
+static const RRB* flush_head(const RRB *rrb) {
+  RRB *head = rrb_mutable_create(rrb->pointer_free);
+  head->cnt = rrb->head_len;
+  head->tail_len = rrb->head_len;
+  head->tail = rrb->head;
+
+  RRB *body = rrb_head_clone(rrb);
+  body->head_len = 0;
+  body->head = NULL;
+  return rrb_concat(head, body);
+}
+
+const RRB* rrb_push_front(const RRB *restrict rrb, const void *restrict elt) {
+  RRB_SCOPE_BEGIN();
+  RRB *new_rrb = rrb_head_clone(rrb);
+  if (rrb->head_len == RRB_BRANCHING) {
+    push_down_head(new_rrb);
+  }
+  LeafNode *new_head = leaf_node_create(new_rrb->head_len + 1,
+                                        rrb->pointer_free);
+  new_head->child[0] = elt;
+  if (new_rrb->head_len != 0) {
+    memcpy(&new_head->child[1], new_rrb->head->child,
+           new_rrb->head_len * sizeof(void *));
+  }
+  new_rrb->head = new_head;
+  new_rrb->head_len++;
+  return RRB_SCOPE_END(new_rrb);
+}
+
+const RRB* rrb_pop_front(const RRB *rrb) {
+  RRB_SCOPE_BEGIN();
+  if (rrb->head_len + rrb->cnt <= 1) {
+    return RRB_SCOPE_END(rrb_empty(rrb->pointer_free));
+  }
+  RRB *new_rrb = rrb_head_clone(rrb);
+  if (new_rrb->head_len == 0) {
+    promote_leftmost_leaf(new_rrb);
+  }
+  new_rrb->head_len--;
+  if (new_rrb->head_len == 0) {
+    new_rrb->head = NULL;
+  }
+  else {
+    LeafNode *new_head = leaf_node_create(new_rrb->head_len, rrb->pointer_free);
+    memcpy(new_head->child, &new_rrb->head->child[1],
+           new_rrb->head_len * sizeof(void *));
+    new_rrb->head = new_head;
+  }
+  return RRB_SCOPE_END(new_rrb);
+}
+
+// Splices small edits, where the removed and inserted items fit in a single
+// leaf, item by item: they only touch a leaf or two, so cutting and stitching
+// the whole tree is a waste.
+static void splice_items(TransientRRB *trrb, uint32_t from, uint32_t to,
+                         const RRB *insert) {
+  const uint32_t removed = to - from;
+  const uint32_t inserted = rrb_count(insert);
+  void *items[RRB_BRANCHING];
+  rrb_copy_range(insert, 0, inserted, items);
+
+  const uint32_t overwritten = MIN(removed, inserted);
+  for (uint32_t i = 0; i < overwritten; i++) {
+    transient_rrb_update(trrb, from + i, items[i]);
+  }
+  for (uint32_t i = overwritten; i < removed; i++) {
+    transient_rrb_remove_at(trrb, from + overwritten);
+  }
+  for (uint32_t i = overwritten; i < inserted; i++) {
+    transient_rrb_insert_at(trrb, from + i, items[i]);
+  }
+}
+
+// Adds the head, trie and tail of rrb to nodes, for concat_subtries, and
+// returns the new number of subtries.
+static uint32_t add_subtries(const RRB *rrb, TreeNode **nodes, uint32_t *shifts,
+                             uint32_t n) {
+  if (rrb->head_len != 0) {
+    nodes[n] = (TreeNode *) rrb->head;
+    shifts[n++] = LEAF_NODE_SHIFT;
+  }
+  if (rrb->root != NULL) {
+    nodes[n] = rrb->root;
+    shifts[n++] = RRB_SHIFT(rrb);
+  }
+  if (rrb->tail_len != 0) {
+    nodes[n] = (TreeNode *) rrb->tail;
+    shifts[n++] = LEAF_NODE_SHIFT;
+  }
+  return n;
+}
+
+// Sets the trie and tail of new_rrb to the concatenation of the n subtries in
+// nodes. The last one must be a leaf, which is used as tail. The count and
+// head of new_rrb must already be set.
+static void concat_subtries(RRB *new_rrb, TreeNode *const *nodes,
+                            const uint32_t *shifts, uint32_t n) {
+  n--;
+  new_rrb->tail = (LeafNode *) nodes[n];
+  new_rrb->tail_len = nodes[n]->len;
+  if (n > 0) {
+    new_rrb->root = concat_trees(nodes, shifts, n, &RRB_SHIFT(new_rrb),
+                                 new_rrb->pointer_free);
+  }
+  fill_root_leaf(new_rrb);
+}
+
+/**
+ * Replaces the items from index from to index to in rrb with insert. The part
+ * before from, insert and the part after to are concatenated at once, with
+ * concat_trees: their tries, heads and tails all go in as separate subtries,
+ * except for the head of the first part and the tail of the last one, which
+ * stay where they are.
+ */
+static const RRB* splice_trees(const RRB *rrb, uint32_t from, uint32_t to,
+                               const RRB *insert) {
+  if (to == rrb_count(rrb) && rrb_count(insert) == 0) {
+    // There's no leaf after the first part to use as tail.
+    return rrb_slice(rrb, 0, from);
+  }
+  const char pointer_free = rrb->pointer_free && insert->pointer_free;
+  RRB *new_rrb = rrb_mutable_create(pointer_free);
+  TreeNode *nodes[8];
+  uint32_t shifts[8];
+  uint32_t n = 0;
+
+  // The part before from. Unlike slice_right, we don't promote its rightmost
+  // leaf to a tail, as it would only go back into the trie.
+  new_rrb->head_len = MIN(from, rrb->head_len);
+  if (new_rrb->head_len == rrb->head_len) {
+    new_rrb->head = rrb->head;
+  }
+  else if (new_rrb->head_len != 0) {
+    new_rrb->head = leaf_node_create(new_rrb->head_len, pointer_free);
+    memcpy(new_rrb->head->child, rrb->head->child,
+           new_rrb->head_len * sizeof(void *));
+  }
+  const uint32_t left = from - new_rrb->head_len;
+  const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
+  if (left > 0 && rrb->root != NULL) {
+    if (tail_offset <= left) {
+      nodes[n] = rrb->root;
+      shifts[n++] = RRB_SHIFT(rrb);
+    }
+    else {
+      shifts[n] = LEAF_NODE_SHIFT;
+      nodes[n] = slice_right_rec(&shifts[n], rrb->root, left - 1,
+                                 RRB_SHIFT(rrb), false, pointer_free);
+      n++;
+    }
+  }
+  if (tail_offset < left) {
+    LeafNode *tail = rrb->tail;
+    if (left - tail_offset < rrb->tail_len) {
+      tail = leaf_node_create(left - tail_offset, pointer_free);
+      memcpy(tail->child, rrb->tail->child, tail->len * sizeof(void *));
+    }
+    nodes[n] = (TreeNode *) tail;
+    shifts[n++] = LEAF_NODE_SHIFT;
+  }
+  new_rrb->cnt = left;
+
+  const RRB *right = rrb_slice(rrb, to, rrb_count(rrb));
+  n = add_subtries(insert, nodes, shifts, n);
+  n = add_subtries(right, nodes, shifts, n);
+  new_rrb->cnt += rrb_count(insert) + rrb_count(right);
+
+  // The last subtrie is a leaf from one of the last two parts.
+  concat_subtries(new_rrb, nodes, shifts, n);
+  return new_rrb;
+}
+
+const RRB* rrb_splice(const RRB *rrb, uint32_t from, uint32_t to,
+                      const RRB *insert) {
+  RRB_SCOPE_BEGIN();
+  if (to > rrb_count(rrb) || from > to) {
+    return RRB_SCOPE_END(NULL);
+  }
+  if (to - from + rrb_count(insert) <= RRB_BRANCHING) {
+    TransientRRB *trrb = rrb_to_transient(rrb);
+    if (!insert->pointer_free) {
+      transient_hold_pointers(trrb);
+    }
+    splice_items(trrb, from, to, insert);
+    return RRB_SCOPE_END(transient_to_rrb(trrb));
+  }
+  return RRB_SCOPE_END(splice_trees(rrb, from, to, insert));
+}
+
+// Creates a part for split_rec, or returns NULL if it has no children. A part
+// that starts at the start of a node without a size table needs none either,
+// as only its last child may have been cut.
+static TreeNode* split_part(const InternalNode *node,
+                            InternalNode *const *children,
+                            const uint32_t *sizes, uint32_t len,
+                            uint32_t start) {
+  if (len == 0) {
+    return NULL;
+  }
+  if (start == 0 && node->size_table == NULL) {
+    InternalNode *part = internal_node_create(len);
+    memcpy(part->child, children, len * sizeof(InternalNode *));
+    return (TreeNode *) part;
+  }
+  return (TreeNode *) internal_node_sized(children, sizes, len, start);
+}
+
+/**
+ * Splits the subtrie node at the n indices cuts[i] - offset, which must be
+ * sorted, distinct and inside the subtrie, and puts the n + 1 parts in parts.
+ * All parts are at the same shift as node, even if they have a single child.
+ * Children without a cut in them are shared with the parts, so only the nodes
+ * on the path down to a cut are created.
+ *
+ * The leaf right before cut i is taken out of its part and put in tails[i], so
+ * that it can be used as tail without copying the path down to it again. If
+ * the cut is between two children of an internal node above the leaves, the
+ * leaf is left where it is, and tails[i] is set to NULL. A part that only
+ * consisted of the leaf is NULL.
+ */
+static void split_rec(const TreeNode *node, uint32_t shift,
+                      const uint32_t *cuts, uint32_t n, uint32_t offset,
+                      TreeNode **parts, LeafNode **tails, char pointer_free) {
+  if (n == 0) {
+    parts[0] = (TreeNode *) node;
+    return;
+  }
+  if (shift == LEAF_NODE_SHIFT) {
+    // The parent takes out the tails.
+    const LeafNode *leaf = (const LeafNode *) node;
+    uint32_t from = 0;
+    for (uint32_t i = 0; i <= n; i++) {
+      const uint32_t to = (i < n) ? cuts[i] - offset : leaf->len;
+      LeafNode *part = leaf_node_create(to - from, pointer_free);
+      memcpy(part->child, &leaf->child[from], part->len * sizeof(void *));
+      parts[i] = (TreeNode *) part;
+      from = to;
+    }
+    return;
+  }
+
+  const InternalNode *internal = (const InternalNode *) node;
+  const uint32_t child_shift = DEC_SHIFT(shift);
+  const char above_leaves = (child_shift == LEAF_NODE_SHIFT);
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(internal, shift, sizes);
+
+  // The children of the part we're currently building, and where they end.
+  InternalNode *part_children[RRB_BRANCHING];
+  uint32_t part_sizes[RRB_BRANCHING];
+  uint32_t part_len = 0, part_start = 0, p = 0, c = 0;
+
+  for (uint32_t i = 0; i < internal->len; i++) {
+    const uint32_t child_start = (i == 0) ? 0 : sizes[i - 1];
+    if (c < n && cuts[c] - offset == child_start) {
+      // The cut is between two children, so the part ends here.
+      if (above_leaves) {
+        tails[c] = (LeafNode *) part_children[--part_len];
+      }
+      else {
+        tails[c] = NULL;
+      }
+      parts[p++] = split_part(internal, part_children, part_sizes, part_len,
+                              part_start);
+      part_start = child_start;
+      part_len = 0;
+      c++;
+    }
+    uint32_t child_cuts = 0;
+    while (c + child_cuts < n && cuts[c + child_cuts] - offset < sizes[i]) {
+      child_cuts++;
+    }
+    if (child_cuts == 0) {
+      part_children[part_len] = internal->child[i];
+      part_sizes[part_len++] = sizes[i];
+      continue;
+    }
+
+    // The child is split into child_cuts + 1 parts. The first one ends the
+    // part we're building, the ones in the middle are parts of their own and
+    // the last one starts the next part.
+    split_rec((const TreeNode *) internal->child[i], child_shift, &cuts[c],
+              child_cuts, offset + child_start, &parts[p], &tails[c],
+              pointer_free);
+    if (above_leaves) {
+      for (uint32_t j = 0; j < child_cuts; j++) {
+        tails[c + j] = (LeafNode *) parts[p + j];
+        parts[p + j] = NULL;
+      }
+    }
+    if (parts[p] != NULL) {
+      part_children[part_len] = (InternalNode *) parts[p];
+      part_sizes[part_len++] = cuts[c] - offset
+        - ((tails[c] != NULL) ? tails[c]->len : 0);
+    }
+    parts[p] = split_part(internal, part_children, part_sizes, part_len,
+                          part_start);
+    p++;
+    for (uint32_t j = 1; j < child_cuts; j++, p++) {
+      if (parts[p] != NULL) {
+        parts[p] = (TreeNode *) internal_node_new_above1((InternalNode *) parts[p]);
+      }
+    }
+    c += child_cuts;
+    part_start = cuts[c - 1] - offset;
+    part_children[0] = (InternalNode *) parts[p];
+    part_sizes[0] = sizes[i];
+    part_len = 1;
+  }
+  parts[p] = split_part(internal, part_children, part_sizes, part_len,
+                        part_start);
+}
+
+void rrb_split_n(const RRB *rrb, uint32_t k, const RRB **out) {
+  RRB_SCOPE_BEGIN();
+  if (k <= 1) {
+    if (k == 1) {
+      out[0] = rrb;
+    }
+    RRB_SCOPE_END_MANY(out, k);
+    return;
+  }
+  const uint32_t cnt = rrb_count(rrb);
+  const uint32_t head_len = rrb->head_len;
+  const uint32_t trie_len = rrb->cnt - rrb->tail_len;
+
+  // Part i contains the items from bounds[i] to bounds[i + 1]. The first small
+  // parts have cnt / k items, the rest have one more. Only the bounds inside
+  // the trie have to be cut there, the others cut the head or tail.
+  const uint32_t small = k - cnt % k;
+  uint32_t *bounds = RRB_MALLOC_ATOMIC((k + 1) * sizeof(uint32_t));
+  uint32_t *cuts = RRB_MALLOC_ATOMIC(k * sizeof(uint32_t));
+  uint32_t n = 0;
+  for (uint32_t i = 0; i <= k; i++) {
+    bounds[i] = i * (cnt / k) + (i > small ? i - small : 0);
+    if (head_len < bounds[i] && bounds[i] < head_len + trie_len &&
+        (n == 0 || cuts[n - 1] != bounds[i] - head_len)) {
+      cuts[n++] = bounds[i] - head_len;
+    }
+  }
+  TreeNode **tries = RRB_MALLOC((n + 1) * sizeof(TreeNode *));
+  LeafNode **tails = RRB_MALLOC((n + 1) * sizeof(LeafNode *));
+  if (rrb->root != NULL) {
+    split_rec(rrb->root, RRB_SHIFT(rrb), cuts, n, 0, tries, tails,
+              rrb->pointer_free);
+  }
+  uint32_t next_trie = 0;
+
+  for (uint32_t i = 0; i < k; i++) {
+    const uint32_t from = bounds[i], to = bounds[i + 1];
+    if (from == to) {
+      out[i] = rrb_empty(rrb->pointer_free);
+      continue;
+    }
+    RRB *part = rrb_mutable_create(rrb->pointer_free);
+    if (from < head_len) {
+      part->head_len = MIN(to, head_len) - from;
+      if (part->head_len == head_len) {
+        part->head = rrb->head;
+      }
+      else {
+        part->head = leaf_node_create(part->head_len, rrb->pointer_free);
+        memcpy(part->head->child, &rrb->head->child[from],
+               part->head_len * sizeof(void *));
+      }
+    }
+    // From here on, indices are relative to the trie.
+    const uint32_t body_from = (from < head_len) ? 0 : from - head_len;
+    const uint32_t body_to = (to < head_len) ? 0 : to - head_len;
+    part->cnt = body_to - body_from;
+
+    LeafNode *tail = NULL;
+    if (body_from < trie_len && body_from < body_to) {
+      TreeNode *root = tries[next_trie];
+      uint32_t shift = RRB_SHIFT(rrb);
+      while (root != NULL && shift > LEAF_NODE_SHIFT && root->len == 1) {
+        root = (TreeNode *) ((InternalNode *) root)->child[0];
+        shift = DEC_SHIFT(shift);
+      }
+      part->root = root;
+      part->shift = (root == NULL) ? LEAF_NODE_SHIFT : shift;
+      if (next_trie < n) {
+        tail = tails[next_trie];
+      }
+      next_trie++;
+    }
+    if (tail != NULL) {
+      part->tail = tail;
+      part->tail_len = tail->len;
+    }
+    else if (trie_len < body_to) {
+      const uint32_t tail_from = MAX(body_from, trie_len) - trie_len;
+      part->tail_len = body_to - trie_len - tail_from;
+      if (part->tail_len == rrb->tail_len) {
+        part->tail = rrb->tail;
+      }
+      else {
+        part->tail = leaf_node_create(part->tail_len, rrb->pointer_free);
+        memcpy(part->tail->child, &rrb->tail->child[tail_from],
+               part->tail_len * sizeof(void *));
+      }
+    }
+    else if (part->root != NULL) {
+      promote_rightmost_leaf(part);
+    }
+    else {
+      // Only items from the head.
+      part->tail = &EMPTY_LEAF;
+    }
+    fill_root_leaf(part);
+    out[i] = part;
+  }
+  RRB_FREE(bounds);
+  RRB_FREE(cuts);
+  RRB_FREE(tries);
+  RRB_FREE(tails);
+  RRB_SCOPE_END_MANY(out, k);
+}
+
+/**
+ * Points the iterator to the leaf containing index, and records the path from
+ * the root down to it. If index is in the head or the tail (or one past the
+ * last element), that is used as leaf and no path is recorded.
+ */
+static void iterator_find_leaf(RRBIterator *it, uint32_t index) {
+  const RRB *rrb = it->rrb;
+  if (index < rrb->head_len) {
+    it->leaf = rrb->head;
+    it->leaf_start = 0;
+    it->height = 0;
+    return;
+  }
+  const uint32_t tail_offset = rrb->head_len + rrb->cnt - rrb->tail_len;
+  if (tail_offset <= index) {
+    it->leaf = rrb->tail;
+    it->leaf_start = tail_offset;
+    it->height = 0;
+    return;
+  }
+  const InternalNode *current = (const InternalNode *) rrb->root;
+  uint32_t idx = index - rrb->head_len;
+  uint32_t height = 0;
+  for (uint32_t shift = RRB_SHIFT(rrb); shift > 0; shift -= RRB_BITS) {
+    uint32_t child_index;
+    if (current->size_table == NULL) {
+      child_index = (idx >> shift) & RRB_MASK;
+      idx -= child_index << shift;
+    }
+    else {
+      child_index = sized_pos(current, &idx, shift);
+    }
+    it->path[height] = current;
+    it->path_idx[height] = child_index;
+    height++;
+    current = current->child[child_index];
+  }
+  it->height = height;
+  it->leaf = (const LeafNode *) current;
+  it->leaf_start = index - idx;
+}
+
+/**
+ * Moves the iterator to the leaf right after the current one. Only walks up
+ * the path as far as needed, so a full scan visits every node once.
+ */
+static void iterator_next_leaf(RRBIterator *it) {
+  const RRB *rrb = it->rrb;
+  const uint32_t next_start = it->leaf_start + it->leaf->len;
+  if (next_start == rrb->head_len + rrb->cnt - rrb->tail_len) {
+    it->leaf = rrb->tail;
+    it->leaf_start = next_start;
+    it->height = 0;
+    return;
+  }
+  if (it->height == 0) { // leaving the head
+    iterator_find_leaf(it, next_start);
+    return;
+  }
+  uint32_t level = it->height;
+  while (it->path_idx[level-1] + 1 == it->path[level-1]->len) {
+    level--;
+  }
+  it->path_idx[level-1]++;
+  const InternalNode *current = it->path[level-1]->child[it->path_idx[level-1]];
+  for (; level < it->height; level++) {
+    it->path[level] = current;
+    it->path_idx[level] = 0;
+    current = current->child[0];
+  }
+  it->leaf = (const LeafNode *) current;
+  it->leaf_start = next_start;
+}
+
+static void iterator_prev_leaf(RRBIterator *it) {
+  if (it->height == 0 || it->leaf_start == it->rrb->head_len) {
+    // no path recorded for the tail, or we're going into the head, so have to
+    // walk down from the root.
+    iterator_find_leaf(it, it->leaf_start - 1);
+    return;
+  }
+  uint32_t level = it->height;
+  while (it->path_idx[level-1] == 0) {
+    level--;
+  }
+  it->path_idx[level-1]--;
+  const InternalNode *current = it->path[level-1]->child[it->path_idx[level-1]];
+  for (; level < it->height; level++) {
+    it->path[level] = current;
+    it->path_idx[level] = current->len - 1;
+    current = current->child[current->len - 1];
+  }
+  it->leaf = (const LeafNode *) current;
+  it->leaf_start -= it->leaf->len;
+}
+
+RRBIterator* rrb_iterator_create(const RRB *rrb, uint32_t index) {
+  if (index > rrb_count(rrb)) {
+    return NULL;
+  }
+  RRBIterator *it = RRB_MALLOC(sizeof(RRBIterator));
+  it->rrb = rrb;
+  it->index = index;
+  iterator_find_leaf(it, index);
+  return it;
+}
+
+void rrb_iterator_destroy(RRBIterator *it) {
+  RRB_FREE(it);
+}
+
+RRBIterator* rrb_iterator_seek(RRBIterator *it, uint32_t index) {
+  if (index > rrb_count(it->rrb)) {
+    return NULL;
+  }
+  // Stay in the current leaf if we can
+  if (index < it->leaf_start || it->leaf_start + it->leaf->len < index) {
+    iterator_find_leaf(it, index);
+  }
+  it->index = index;
+  return it;
+}
+
+uint32_t rrb_iterator_index(const RRBIterator *it) {
+  return it->index;
+}
+
+char rrb_iterator_has_next(const RRBIterator *it) {
+  return it->index < rrb_count(it->rrb);
+}
+
+char rrb_iterator_has_prev(const RRBIterator *it) {
+  return it->index > 0;
+}
+
+// The iterator invariant is leaf_start <= index <= leaf_start + leaf->len, so
+// we only switch leaves when we're at either edge of the current one.
+
+void* rrb_iterator_next(RRBIterator *it) {
+  if (it->index >= rrb_count(it->rrb)) {
+    return NULL;
+  }
+  if (it->index - it->leaf_start == it->leaf->len) {
+    iterator_next_leaf(it);
+  }
+  return (void *) it->leaf->child[it->index++ - it->leaf_start];
+}
+
+void* rrb_iterator_prev(RRBIterator *it) {
+  if (it->index == 0) {
+    return NULL;
+  }
+  if (it->index == it->leaf_start) {
+    iterator_prev_leaf(it);
+  }
+  return (void *) it->leaf->child[--it->index - it->leaf_start];
+}
+
+const void *const * rrb_iterator_next_chunk(RRBIterator *it, uint32_t *len) {
+  if (it->index >= rrb_count(it->rrb)) {
+    *len = 0;
+    return NULL;
+  }
+  if (it->index - it->leaf_start == it->leaf->len) {
+    iterator_next_leaf(it);
+  }
+  const uint32_t offset = it->index - it->leaf_start;
+  *len = it->leaf->len - offset;
+  it->index += *len;
+  return &it->leaf->child[offset];
+}
+
+const void *const * rrb_iterator_prev_chunk(RRBIterator *it, uint32_t *len) {
+  if (it->index == 0) {
+    *len = 0;
+    return NULL;
+  }
+  if (it->index == it->leaf_start) {
+    iterator_prev_leaf(it);
+  }
+  *len = it->index - it->leaf_start;
+  it->index = it->leaf_start;
+  return &it->leaf->child[0];
+}
+
+uint32_t rrb_copy_range(const RRB *rrb, uint32_t from, uint32_t to,
+                        void **dst) {
+  to = MIN(to, rrb_count(rrb));
+  if (to <= from) {
+    return 0;
+  }
+  RRBIterator it;
+  it.rrb = rrb;
+  it.index = from;
+  iterator_find_leaf(&it, from);
+
+  uint32_t copied = 0;
+  while (copied < to - from) {
+    uint32_t len;
+    const void *const *chunk = rrb_iterator_next_chunk(&it, &len);
+    len = MIN(len, to - from - copied);
+    memcpy(&dst[copied], chunk, len * sizeof(void *));
+    copied += len;
+  }
+  return copied;
+}
+
+/**
+ * Walks down to the leaf containing index, which must be in the trie (not the
+ * head or the tail), and is counted from the start of the trie. Starts from
+ * the lowest cached node covering index, so nearby lookups only have to walk
+ * up to their lowest common ancestor.
+ */
+static void cursor_find_leaf(RRBCursor *cursor, uint32_t index) {
+  const RRB *rrb = cursor->rrb;
+  uint32_t level = 0;
+  if (cursor->leaf != NULL) {
+    level = cursor->height;
+    while (level > 0 && (index < cursor->path_start[level-1] ||
+                         cursor->path_end[level-1] <= index)) {
+      level--;
+    }
+  }
+
+  const InternalNode *current;
+  uint32_t start, end;
+  if (level == 0) {
+    current = (const InternalNode *) rrb->root;
+    start = 0;
+    end = rrb->cnt - rrb->tail_len;
+  }
+  else {
+    // redo the choice of child in the lowest node covering index
+    level--;
+    current = cursor->path[level];
+    start = cursor->path_start[level];
+    end = cursor->path_end[level];
+  }
+
+  for (uint32_t shift = RRB_SHIFT(rrb) - level * RRB_BITS; shift > 0;
+       shift -= RRB_BITS, level++) {
+    cursor->path[level] = current;
+    cursor->path_start[level] = start;
+    cursor->path_end[level] = end;
+
+    uint32_t idx = index - start;
+    uint32_t child_index;
+    if (current->size_table == NULL) {
+      child_index = (idx >> shift) & RRB_MASK;
+      start += child_index << shift;
+      end = MIN(end, start + (1u << shift));
+    }
+    else {
+      child_index = sized_pos(current, &idx, shift);
+      end = start + current->size_table->size[child_index];
+      start = index - idx;
+    }
+    cursor->path_idx[level] = child_index;
+    current = current->child[child_index];
+  }
+  cursor->height = level;
+  cursor->leaf = (const LeafNode *) current;
+  cursor->leaf_start = start;
+}
+
+static inline void cursor_seek(RRBCursor *cursor, uint32_t index) {
+  if (cursor->leaf == NULL ||
+      (cursor->edits != NULL && cursor->seen_edits != *cursor->edits)) {
+    cursor->leaf = NULL;
+    if (cursor->edits != NULL) {
+      cursor->seen_edits = *cursor->edits;
+    }
+    cursor_find_leaf(cursor, index);
+  }
+  else if (index < cursor->leaf_start ||
+           cursor->leaf_start + cursor->leaf->len <= index) {
+    cursor_find_leaf(cursor, index);
+  }
+}
+
+RRBCursor* rrb_cursor_create(const RRB *rrb) {
+  RRBCursor *cursor = RRB_MALLOC(sizeof(RRBCursor));
+  cursor->rrb = rrb;
+  cursor->edits = NULL;
+  cursor->leaf = NULL;
+  return cursor;
+}
+
+void rrb_cursor_destroy(RRBCursor *cursor) {
+  RRB_FREE(cursor);
+}
+
+void* rrb_cursor_nth(RRBCursor *cursor, uint32_t index) {
+  const RRB *rrb = cursor->rrb;
+  if (index < rrb->head_len) {
+    return (void *) rrb->head->child[index];
+  }
+  index -= rrb->head_len;
+  if (index >= rrb->cnt) {
+    return NULL;
+  }
+  const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
+  if (tail_offset <= index) {
+    return (void *) rrb->tail->child[index - tail_offset];
   }
+  cursor_seek(cursor, index);
+  return (void *) cursor->leaf->child[index - cursor->leaf_start];
 }
 
 #include "rrb_transients.h"
+#include "rrb_parallel.h"
 
 #ifdef RRB_DEBUG
 #include "rrb_debug.h"
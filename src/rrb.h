@@ -24,6 +24,7 @@
 #ifndef RRB_H
 #define RRB_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define RRB_BITS 5
@@ -37,23 +38,117 @@
 
 typedef struct RRB_ RRB;
 
+typedef void* (*RRBMapFn)(void *elt, void *ctx);
+typedef char (*RRBPredFn)(void *elt, void *ctx);
+typedef int (*RRBCmpFn)(void *a, void *b, void *ctx);
+
 const RRB* rrb_create(void);
+const RRB* rrb_create_pointer_free(void);
+const RRB* rrb_from_array(const void **items, uint32_t n);
+const RRB* rrb_retain(const RRB *rrb);
+void rrb_release(const RRB *rrb);
 
 uint32_t rrb_count(const RRB *rrb);
 void* rrb_nth(const RRB *rrb, uint32_t index);
+void rrb_nth_many(const RRB *rrb, const uint32_t *indices, uint32_t n, void **out);
+uint32_t rrb_lower_bound(const RRB *rrb, const void *key, RRBCmpFn cmp,
+                         void *ctx);
+uint32_t rrb_upper_bound(const RRB *rrb, const void *key, RRBCmpFn cmp,
+                         void *ctx);
 const RRB* rrb_pop(const RRB *rrb);
 void* rrb_peek(const RRB *rrb);
 const RRB* rrb_push(const RRB *restrict rrb, const void *restrict elt);
 const RRB* rrb_update(const RRB *restrict rrb, uint32_t index, const void *restrict elt);
+const RRB* rrb_update_many(const RRB *rrb, const uint32_t *indices,
+                           const void *const *elts, uint32_t n);
+const RRB* rrb_write_range(const RRB *rrb, uint32_t from,
+                           const void *const *elts, uint32_t n);
+const RRB* rrb_map(const RRB *rrb, RRBMapFn fn, void *ctx);
+const RRB* rrb_filter(const RRB *rrb, RRBPredFn pred, void *ctx);
+void rrb_partition(const RRB *rrb, RRBPredFn pred, void *ctx,
+                   const RRB **kept, const RRB **rejected);
+const RRB* rrb_sort(const RRB *rrb, RRBCmpFn cmp, void *ctx);
+const RRB* rrb_insert_at(const RRB *restrict rrb, uint32_t index,
+                         const void *restrict elt);
+const RRB* rrb_remove_at(const RRB *rrb, uint32_t index);
+const RRB* rrb_push_front(const RRB *restrict rrb, const void *restrict elt);
+const RRB* rrb_pop_front(const RRB *rrb);
 
 const RRB* rrb_concat(const RRB *left, const RRB *right);
+const RRB* rrb_concat_many(const RRB *const *parts, uint32_t n);
 const RRB* rrb_slice(const RRB *rrb, uint32_t from, uint32_t to);
+const RRB* rrb_splice(const RRB *rrb, uint32_t from, uint32_t to,
+                      const RRB *insert);
+void rrb_split_n(const RRB *rrb, uint32_t k, const RRB **out);
+
+// Iterators
+
+typedef struct RRBIterator_ RRBIterator;
+
+RRBIterator* rrb_iterator_create(const RRB *rrb, uint32_t index);
+void rrb_iterator_destroy(RRBIterator *it);
+RRBIterator* rrb_iterator_seek(RRBIterator *it, uint32_t index);
+uint32_t rrb_iterator_index(const RRBIterator *it);
+char rrb_iterator_has_next(const RRBIterator *it);
+char rrb_iterator_has_prev(const RRBIterator *it);
+void* rrb_iterator_next(RRBIterator *it);
+void* rrb_iterator_prev(RRBIterator *it);
+const void *const * rrb_iterator_next_chunk(RRBIterator *it, uint32_t *len);
+const void *const * rrb_iterator_prev_chunk(RRBIterator *it, uint32_t *len);
+uint32_t rrb_copy_range(const RRB *rrb, uint32_t from, uint32_t to, void **dst);
+
+// Cursors
+
+typedef struct RRBCursor_ RRBCursor;
+
+RRBCursor* rrb_cursor_create(const RRB *rrb);
+void rrb_cursor_destroy(RRBCursor *cursor);
+void* rrb_cursor_nth(RRBCursor *cursor, uint32_t index);
+
+// Parallel operations
+
+typedef void (*RRBForEachFn)(void *elt, uint32_t index, void *ctx);
+typedef void* (*RRBReduceFn)(void *acc, void *elt, void *ctx);
+typedef void* (*RRBCombineFn)(void *left, void *right, void *ctx);
+
+void rrb_parallel_set_threads(uint32_t threads);
+void rrb_parallel_for_each(const RRB *rrb, RRBForEachFn fn, void *ctx);
+void* rrb_parallel_reduce(const RRB *rrb, RRBReduceFn reduce,
+                          RRBCombineFn combine, void *init, void *ctx);
+const RRB* rrb_parallel_map(const RRB *rrb, RRBMapFn fn, void *ctx);
+const RRB* rrb_parallel_filter(const RRB *rrb, RRBPredFn pred, void *ctx);
+void rrb_parallel_partition(const RRB *rrb, RRBPredFn pred, void *ctx,
+                            const RRB **kept, const RRB **rejected);
+const RRB* rrb_parallel_sort(const RRB *rrb, RRBCmpFn cmp, void *ctx);
+
+// Allocators
+
+/**
+ * Where the library gets its memory from. alloc must return zeroed memory,
+ * alloc_atomic memory that will never contain pointers to other allocations,
+ * and resize behaves like realloc.
+ */
+typedef struct RRBAllocator_ {
+  void* (*alloc)(size_t size, void *ctx);
+  void* (*alloc_atomic)(size_t size, void *ctx);
+  void* (*resize)(void *ptr, size_t size, void *ctx);
+  void (*dealloc)(void *ptr, void *ctx);
+  void *ctx;
+} RRBAllocator;
+
+void rrb_set_allocator(const RRBAllocator *allocator);
+const RRBAllocator* rrb_get_allocator(void);
+const RRBAllocator* rrb_gc_allocator(void);
+const RRBAllocator* rrb_malloc_allocator(void);
+RRBAllocator* rrb_slab_allocator_create(void);
+void rrb_slab_allocator_destroy(RRBAllocator *slab);
 
 // Transients
 
 typedef struct TransientRRB_ TransientRRB;
 
 TransientRRB* rrb_to_transient(const RRB *rrb);
+TransientRRB* rrb_to_transient_arena(const RRB *rrb);
 const RRB* transient_to_rrb(TransientRRB *trrb);
 
 uint32_t transient_rrb_count(const TransientRRB *trrb);
@@ -61,8 +156,26 @@ void* transient_rrb_nth(const TransientRRB *trrb, uint32_t index);
 TransientRRB* transient_rrb_pop(TransientRRB *trrb);
 void* transient_rrb_peek(const TransientRRB *trrb);
 TransientRRB* transient_rrb_push(TransientRRB *restrict trrb, const void *restrict elt);
+TransientRRB* transient_rrb_push_many(TransientRRB *restrict trrb,
+                                      const void **items, uint32_t n);
 TransientRRB* transient_rrb_update(TransientRRB *restrict trrb, uint32_t index, const void *restrict elt);
+TransientRRB* transient_rrb_insert_at(TransientRRB *restrict trrb,
+                                      uint32_t index, const void *restrict elt);
+TransientRRB* transient_rrb_remove_at(TransientRRB *trrb, uint32_t index);
+TransientRRB* transient_rrb_push_front(TransientRRB *restrict trrb,
+                                       const void *restrict elt);
+TransientRRB* transient_rrb_pop_front(TransientRRB *trrb);
+TransientRRB* transient_rrb_concat(TransientRRB *left, const RRB *right);
 TransientRRB* transient_rrb_slice(TransientRRB *trrb, uint32_t from, uint32_t to);
+TransientRRB* transient_rrb_splice(TransientRRB *restrict trrb, uint32_t from,
+                                   uint32_t to, const RRB *restrict insert);
+
+RRBCursor* transient_rrb_cursor_create(const TransientRRB *trrb);
+void* transient_rrb_cursor_nth(RRBCursor *cursor, uint32_t index);
+TransientRRB* transient_rrb_cursor_update(RRBCursor *cursor, uint32_t index,
+                                          const void *restrict elt);
+uint32_t transient_rrb_copy_range(const TransientRRB *trrb, uint32_t from,
+                                  uint32_t to, void **dst);
 
 #define RRB_DEBUG @RRB_DEBUG@
 #ifdef RRB_DEBUG
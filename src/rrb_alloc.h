@@ -24,10 +24,301 @@
 #ifndef RRB_ALLOC_H
 #define RRB_ALLOC_H
 
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "rrb_thread.h"
+
+// Define RRB_NO_GC to build without Boehm GC, in which case the system
+// allocator is the default.
+#ifndef RRB_NO_GC
+// Threads started by the library must be known to the collector, which
+// GC_THREADS takes care of by redirecting pthread_create.
+#define GC_THREADS
 #include <gc/gc.h>
+#include <gc/gc_typed.h>
+#endif
+
+static RRBAllocator rrb_allocator;
+
+#define RRB_MALLOC(size) (rrb_allocator.alloc((size), rrb_allocator.ctx))
+#define RRB_MALLOC_ATOMIC(size) \
+  (rrb_allocator.alloc_atomic((size), rrb_allocator.ctx))
+#define RRB_REALLOC(ptr, size) \
+  (rrb_allocator.resize((ptr), (size), rrb_allocator.ctx))
+#define RRB_FREE(ptr) (rrb_allocator.dealloc((ptr), rrb_allocator.ctx))
+
+#ifndef RRB_NO_GC
+
+// Nodes are small and allocated at a high rate, and every GC_MALLOC takes the
+// allocator lock. Each thread therefore keeps a free list per size class, in
+// multiples of RRB_GC_GRAIN bytes, which GC_malloc_many refills with a whole
+// batch of objects under a single lock. Larger objects go to GC_MALLOC.
+#define RRB_GC_GRAIN 16
+#define RRB_GC_CACHE_MAX 512
+#define GC_ROUND(size) \
+  (((size) + RRB_GC_GRAIN - 1) / RRB_GC_GRAIN * RRB_GC_GRAIN)
+
+// Uncollectable, so that the collector sees the objects on the free lists.
+typedef struct RRBGcCache_ {
+  void *free_lists[RRB_GC_CACHE_MAX / RRB_GC_GRAIN + 1];
+} RRBGcCache;
+
+static pthread_once_t rrb_gc_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rrb_gc_cache_key;
+
+// The objects left on the free lists are collected once the cache is gone.
+static void gc_cache_free(void *cache) {
+  GC_FREE(cache);
+}
+
+static void gc_cache_key_create() {
+  pthread_key_create(&rrb_gc_cache_key, gc_cache_free);
+}
+
+static void* gc_alloc(size_t size, void *ctx) {
+  (void) ctx;
+  const size_t rounded = GC_ROUND(size == 0 ? 1 : size);
+  if (rounded > RRB_GC_CACHE_MAX) {
+    return GC_MALLOC(size);
+  }
+  pthread_once(&rrb_gc_cache_once, gc_cache_key_create);
+  RRBGcCache *cache = pthread_getspecific(rrb_gc_cache_key);
+  if (cache == NULL) {
+    cache = GC_MALLOC_UNCOLLECTABLE(sizeof(RRBGcCache));
+    pthread_setspecific(rrb_gc_cache_key, cache);
+  }
+  void **free_list = &cache->free_lists[rounded / RRB_GC_GRAIN];
+  if (*free_list == NULL) {
+    *free_list = GC_malloc_many(rounded);
+    if (*free_list == NULL) {
+      return GC_MALLOC(size);
+    }
+  }
+  // The objects are cleared, except for the link to the next one.
+  void *obj = *free_list;
+  *free_list = GC_NEXT(obj);
+  GC_NEXT(obj) = NULL;
+  return obj;
+}
+
+static void* gc_alloc_atomic(size_t size, void *ctx) {
+  (void) ctx;
+  return GC_MALLOC_ATOMIC(size);
+}
+
+static void* gc_resize(void *ptr, size_t size, void *ctx) {
+  (void) ctx;
+  return GC_REALLOC(ptr, size);
+}
+
+static void gc_dealloc(void *ptr, void *ctx) {
+  (void) ctx;
+  GC_FREE(ptr);
+}
+
+static const RRBAllocator rrb_gc = {.alloc = gc_alloc,
+                                    .alloc_atomic = gc_alloc_atomic,
+                                    .resize = gc_resize,
+                                    .dealloc = gc_dealloc, .ctx = NULL};
+
+#endif
+
+static void* system_alloc(size_t size, void *ctx) {
+  (void) ctx;
+  return calloc(1, size);
+}
+
+static void* system_alloc_atomic(size_t size, void *ctx) {
+  (void) ctx;
+  return malloc(size);
+}
+
+static void* system_resize(void *ptr, size_t size, void *ctx) {
+  (void) ctx;
+  return realloc(ptr, size);
+}
+
+static void system_dealloc(void *ptr, void *ctx) {
+  (void) ctx;
+  free(ptr);
+}
+
+static const RRBAllocator rrb_system = {.alloc = system_alloc,
+                                        .alloc_atomic = system_alloc_atomic,
+                                        .resize = system_resize,
+                                        .dealloc = system_dealloc,
+                                        .ctx = NULL};
+
+#ifndef RRB_NO_GC
+static RRBAllocator rrb_allocator = {.alloc = gc_alloc,
+                                     .alloc_atomic = gc_alloc_atomic,
+                                     .resize = gc_resize,
+                                     .dealloc = gc_dealloc, .ctx = NULL};
+#else
+static RRBAllocator rrb_allocator = {.alloc = system_alloc,
+                                     .alloc_atomic = system_alloc_atomic,
+                                     .resize = system_resize,
+                                     .dealloc = system_dealloc, .ctx = NULL};
+#endif
+
+void rrb_set_allocator(const RRBAllocator *allocator) {
+  if (allocator == NULL) {
+#ifndef RRB_NO_GC
+    allocator = &rrb_gc;
+#else
+    allocator = &rrb_system;
+#endif
+  }
+  rrb_allocator = *allocator;
+}
+
+const RRBAllocator* rrb_get_allocator() {
+  return &rrb_allocator;
+}
+
+const RRBAllocator* rrb_gc_allocator() {
+#ifndef RRB_NO_GC
+  return &rrb_gc;
+#else
+  return NULL;
+#endif
+}
+
+const RRBAllocator* rrb_malloc_allocator() {
+  return &rrb_system;
+}
+
+// The slab allocator hands out blocks in multiples of RRB_SLAB_GRAIN bytes,
+// carved out of chunks of RRB_SLAB_CHUNK bytes. Freed blocks are put on a free
+// list for their size, and are only given back to the system when the
+// allocator is destroyed. Blocks above RRB_SLAB_MAX bytes get a chunk of their
+// own, which is given back as soon as the block is freed.
+#define RRB_SLAB_GRAIN 16
+#define RRB_SLAB_MAX 1024
+#define RRB_SLAB_CHUNK (1 << 16)
+#define SLAB_ROUND(size) \
+  (((size) + RRB_SLAB_GRAIN - 1) / RRB_SLAB_GRAIN * RRB_SLAB_GRAIN)
+
+// All chunks are in a circular list, so that they can be freed on their own
+// and all at once.
+typedef struct RRBSlabChunk_ {
+  struct RRBSlabChunk_ *prev;
+  struct RRBSlabChunk_ *next;
+} RRBSlabChunk;
+
+// Every block is preceded by a grain holding its size.
+#define SLAB_BLOCK_SIZE(block) (*(size_t *) ((char *) (block) - RRB_SLAB_GRAIN))
+#define SLAB_CHUNK_HEADER SLAB_ROUND(sizeof(RRBSlabChunk))
+
+typedef struct RRBSlab_ {
+  RRBAllocator allocator;
+  pthread_mutex_t lock;
+  void *free_lists[RRB_SLAB_MAX / RRB_SLAB_GRAIN + 1];
+  char *next;
+  char *end;
+  RRBSlabChunk chunks;
+} RRBSlab;
+
+// Returns the space after a new chunk with size bytes. The lock must be held.
+static char* slab_chunk_create(RRBSlab *slab, size_t size) {
+  RRBSlabChunk *chunk = malloc(SLAB_CHUNK_HEADER + size);
+  chunk->prev = &slab->chunks;
+  chunk->next = slab->chunks.next;
+  chunk->next->prev = chunk;
+  slab->chunks.next = chunk;
+  return (char *) chunk + SLAB_CHUNK_HEADER;
+}
+
+static void* slab_alloc_atomic(size_t size, void *ctx) {
+  RRBSlab *slab = ctx;
+  const size_t rounded = SLAB_ROUND(size == 0 ? 1 : size);
+  pthread_mutex_lock(&slab->lock);
+  char *block;
+  if (rounded > RRB_SLAB_MAX) {
+    block = slab_chunk_create(slab, RRB_SLAB_GRAIN + rounded) + RRB_SLAB_GRAIN;
+    SLAB_BLOCK_SIZE(block) = rounded;
+  }
+  else if (slab->free_lists[rounded / RRB_SLAB_GRAIN] != NULL) {
+    block = slab->free_lists[rounded / RRB_SLAB_GRAIN];
+    slab->free_lists[rounded / RRB_SLAB_GRAIN] = *(void **) block;
+  }
+  else {
+    if ((size_t) (slab->end - slab->next) < RRB_SLAB_GRAIN + rounded) {
+      slab->next = slab_chunk_create(slab, RRB_SLAB_CHUNK);
+      slab->end = slab->next + RRB_SLAB_CHUNK;
+    }
+    block = slab->next + RRB_SLAB_GRAIN;
+    slab->next += RRB_SLAB_GRAIN + rounded;
+    SLAB_BLOCK_SIZE(block) = rounded;
+  }
+  pthread_mutex_unlock(&slab->lock);
+  return block;
+}
+
+static void* slab_alloc(size_t size, void *ctx) {
+  void *block = slab_alloc_atomic(size, ctx);
+  memset(block, 0, size);
+  return block;
+}
+
+static void slab_dealloc(void *ptr, void *ctx) {
+  if (ptr == NULL) {
+    return;
+  }
+  RRBSlab *slab = ctx;
+  const size_t size = SLAB_BLOCK_SIZE(ptr);
+  pthread_mutex_lock(&slab->lock);
+  if (size > RRB_SLAB_MAX) {
+    RRBSlabChunk *chunk = (RRBSlabChunk *)
+      ((char *) ptr - RRB_SLAB_GRAIN - SLAB_CHUNK_HEADER);
+    chunk->prev->next = chunk->next;
+    chunk->next->prev = chunk->prev;
+    free(chunk);
+  }
+  else {
+    *(void **) ptr = slab->free_lists[size / RRB_SLAB_GRAIN];
+    slab->free_lists[size / RRB_SLAB_GRAIN] = ptr;
+  }
+  pthread_mutex_unlock(&slab->lock);
+}
+
+static void* slab_resize(void *ptr, size_t size, void *ctx) {
+  if (ptr == NULL) {
+    return slab_alloc_atomic(size, ctx);
+  }
+  const size_t old_size = SLAB_BLOCK_SIZE(ptr);
+  if (size <= old_size) {
+    return ptr;
+  }
+  void *resized = slab_alloc_atomic(size, ctx);
+  memcpy(resized, ptr, old_size);
+  slab_dealloc(ptr, ctx);
+  return resized;
+}
+
+RRBAllocator* rrb_slab_allocator_create() {
+  RRBSlab *slab = calloc(1, sizeof(RRBSlab));
+  slab->allocator.alloc = slab_alloc;
+  slab->allocator.alloc_atomic = slab_alloc_atomic;
+  slab->allocator.resize = slab_resize;
+  slab->allocator.dealloc = slab_dealloc;
+  slab->allocator.ctx = slab;
+  pthread_mutex_init(&slab->lock, NULL);
+  slab->chunks.prev = slab->chunks.next = &slab->chunks;
+  return &slab->allocator;
+}
 
-#define RRB_MALLOC GC_MALLOC
-#define RRB_REALLOC GC_REALLOC
-#define RRB_MALLOC_ATOMIC GC_MALLOC_ATOMIC
+void rrb_slab_allocator_destroy(RRBAllocator *allocator) {
+  RRBSlab *slab = allocator->ctx;
+  RRBSlabChunk *chunk = slab->chunks.next;
+  while (chunk != &slab->chunks) {
+    RRBSlabChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  pthread_mutex_destroy(&slab->lock);
+  free(slab);
+}
 
 #endif
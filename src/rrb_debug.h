@@ -170,9 +170,16 @@ int rrb_to_dot(DotFile dot, const RRB *rrb) {
             "    <td height=\"36\" width=\"25\" port=\"root\"></td>\n"
             "    <td height=\"36\" width=\"25\">%d</td>\n"
             "    <td height=\"36\" width=\"25\" port=\"tail\"></td>\n"
+            "    <td height=\"36\" width=\"25\">%d</td>\n"
+            "    <td height=\"36\" width=\"25\" port=\"head\"></td>\n"
             "  </tr>\n"
             "</table>>];\n",
-                          rrb, rrb->cnt, rrb->shift, rrb->tail_len));
+                          rrb, rrb->cnt, rrb->shift, rrb->tail_len,
+                          rrb->head_len));
+    if (rrb->head != NULL) {
+      SHORT_CIRCUIT(fprintf(dot.file, "  s%p:head -> s%p:body;\n", rrb, rrb->head));
+      SHORT_CIRCUIT(leaf_node_to_dot(dot, rrb->head));
+    }
     if (rrb->tail == NULL) {
       SHORT_CIRCUIT(fprintf(dot.file, "  s%d [label=\"NIL\"];\n", null_counter));
       SHORT_CIRCUIT(fprintf(dot.file, "  s%p:tail -> s%d;\n", rrb, null_counter++));
@@ -454,9 +461,35 @@ uint32_t validate_rrb(const RRB *rrb) {
     }
   }
   else {
+    if (rrb->cnt <= RRB_BRANCHING) {
+      printf("The vector has %u elements, which should all be in the tail, but "
+             "the root\nisn't null.\n", rrb->cnt);
+      fail = 1;
+    }
+    if (rrb->shift == LEAF_NODE_SHIFT && rrb->root->len != RRB_BRANCHING) {
+      printf("The root is a leaf node of length %u, but root leaves must be "
+             "full.\n", rrb->root->len);
+      fail = 1;
+    }
     validate_subtree(rrb->root, rrb->cnt - rrb->tail_len,
                       rrb->shift, &fail);
   }
+  if (rrb->head_len == 0) {
+    if (rrb->head != NULL) {
+      printf("The head of this rrb-tree is empty, but isn't null.\n");
+      fail = 1;
+    }
+  }
+  else if (rrb->head == NULL || rrb->head->len != rrb->head_len) {
+    printf("The rrb head claims the head is %u elements long, but it is "
+           "of length %u.\n", rrb->head_len,
+           rrb->head == NULL ? 0 : rrb->head->len);
+    fail = 1;
+  }
+  else {
+    validate_subtree((TreeNode *) rrb->head, rrb->head_len, LEAF_NODE_SHIFT,
+                     &fail);
+  }
   return fail;
 }
 
@@ -468,6 +501,7 @@ uint32_t rrb_memory_usage(const RRB *const *rrbs, uint32_t rrb_count) {
       dot_array_add(set, (const void *) rrbs[i]);
       sum += sizeof(RRB) + node_size(set, rrbs[i]->root);
       sum += node_size(set, (const TreeNode*) rrbs[i]->tail);
+      sum += node_size(set, (const TreeNode*) rrbs[i]->head);
     }
   }
   return sum;
@@ -0,0 +1,692 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RRB_PARALLEL_H
+#define RRB_PARALLEL_H
+
+#include <unistd.h>
+#include "rrb_thread.h"
+
+// Subtries with at most this many items are handled by a single task, so that
+// the time spent on scheduling is small compared to the time spent scanning.
+#define RRB_PARALLEL_GRAIN (1 << 15)
+
+typedef struct RRBParallelOps_ RRBParallelOps;
+typedef struct RRBTask_ RRBTask;
+typedef struct RRBJoin_ RRBJoin;
+typedef struct RRBWorker_ RRBWorker;
+typedef struct RRBPool_ RRBPool;
+
+/**
+ * What a parallel operation does with the trie. seq handles a subtrie on its
+ * own, starting at index, and returns its result. join gets the results of all
+ * the children of node, in order, and returns the result for node. join may be
+ * NULL if there are no results.
+ */
+struct RRBParallelOps_ {
+  void* (*seq)(const TreeNode *node, uint32_t shift, uint32_t index,
+               void *ctx);
+  void* (*join)(const InternalNode *node, uint32_t shift, void **results,
+                void *ctx);
+  void *ctx;
+};
+
+struct RRBTask_ {
+  const RRBParallelOps *ops;
+  const TreeNode *node;
+  uint32_t shift;
+  uint32_t index;
+  uint32_t size;
+  void **result;
+  RRBJoin *join;
+#ifdef RRB_REFCOUNT
+  // The scope of the call that made the task, see rrb_refcount.h.
+  RRBScope *scope;
+#endif
+};
+
+// The number of tasks that are yet to finish, guarded by the pool lock.
+struct RRBJoin_ {
+  uint32_t pending;
+};
+
+// Every thread, including the one that started the operation, has a deque of
+// tasks. It pushes and pops its own tasks at the bottom, and steals from the
+// top of the others when it runs out.
+struct RRBWorker_ {
+  RRBPool *pool;
+  uint32_t id;
+  RRBTask **tasks;
+  uint32_t top;
+  uint32_t bottom;
+  uint32_t cap;
+};
+
+// Tasks are whole subtries, so there are few of them, and a single lock for
+// all the deques doesn't show up when profiling.
+struct RRBPool_ {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pthread_mutex_t enter;
+  uint32_t threads;
+  uint32_t queued;
+  RRBWorker *workers;
+};
+
+static void* parallel_run(const RRBParallelOps *ops, const TreeNode *root,
+                          uint32_t shift, uint32_t index, uint32_t size);
+static void parallel_range(const RRBParallelOps *ops, uint32_t n);
+static RRBPool* pool_get(void);
+static void pool_create(void);
+static RRBWorker* pool_enter(RRBPool *pool, char *nested);
+static void pool_leave(RRBPool *pool, char nested);
+static void* worker_main(void *arg);
+static RRBTask* worker_take(RRBWorker *worker);
+static void worker_push(RRBWorker *worker, RRBTask *tasks, uint32_t n);
+static void worker_join(RRBWorker *worker, RRBJoin *join);
+static void task_run(RRBWorker *worker, RRBTask *task);
+static void leaves_walk(const TreeNode *node, uint32_t shift, uint32_t index,
+                        void (*visit)(const LeafNode *leaf, uint32_t index,
+                                      void *state),
+                        void *state);
+
+static RRBPool *rrb_pool = NULL;
+static uint32_t rrb_pool_threads = 0;
+static pthread_once_t rrb_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rrb_pool_worker;
+
+void rrb_parallel_set_threads(uint32_t threads) {
+  rrb_pool_threads = threads;
+}
+
+static RRBPool* pool_get() {
+  pthread_once(&rrb_pool_once, pool_create);
+  return rrb_pool;
+}
+
+static void pool_create() {
+  uint32_t threads = rrb_pool_threads;
+  if (threads == 0) {
+    threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 1) {
+      threads = (uint32_t) cpus;
+    }
+#endif
+  }
+  // The pool lives as long as the process, so it's taken from the system
+  // allocator rather than whatever allocator is in use at the time.
+  RRBPool *pool = calloc(1, sizeof(RRBPool));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->changed, NULL);
+  pthread_mutex_init(&pool->enter, NULL);
+  pthread_key_create(&rrb_pool_worker, NULL);
+  pool->threads = threads;
+  pool->workers = calloc(threads, sizeof(RRBWorker));
+  for (uint32_t i = 0; i < threads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+  }
+  rrb_pool = pool;
+
+  // Worker 0 belongs to the thread that starts an operation.
+  for (uint32_t i = 1; i < threads; i++) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, worker_main, &pool->workers[i]);
+    pthread_detach(thread);
+  }
+}
+
+static void* worker_main(void *arg) {
+  RRBWorker *worker = arg;
+  RRBPool *pool = worker->pool;
+  pthread_setspecific(rrb_pool_worker, worker);
+  while (true) {
+    pthread_mutex_lock(&pool->lock);
+    RRBTask *task;
+    while ((task = worker_take(worker)) == NULL) {
+      pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    task_run(worker, task);
+  }
+  return NULL;
+}
+
+// Takes a task from the bottom of the worker's own deque, or from the top of
+// another one. The pool lock must be held.
+static RRBTask* worker_take(RRBWorker *worker) {
+  RRBPool *pool = worker->pool;
+  if (pool->queued == 0) {
+    return NULL;
+  }
+  if (worker->top < worker->bottom) {
+    pool->queued--;
+    return worker->tasks[--worker->bottom];
+  }
+  for (uint32_t i = 1; i < pool->threads; i++) {
+    RRBWorker *victim = &pool->workers[(worker->id + i) % pool->threads];
+    if (victim->top < victim->bottom) {
+      pool->queued--;
+      return victim->tasks[victim->top++];
+    }
+  }
+  return NULL;
+}
+
+// Pushes the tasks so that the first one is popped first.
+static void worker_push(RRBWorker *worker, RRBTask *tasks, uint32_t n) {
+  RRBPool *pool = worker->pool;
+  pthread_mutex_lock(&pool->lock);
+  if (worker->top == worker->bottom) {
+    worker->top = worker->bottom = 0;
+  }
+  if (worker->cap < worker->bottom + n) {
+    worker->cap = 2 * (worker->bottom + n);
+    worker->tasks = realloc(worker->tasks, worker->cap * sizeof(RRBTask *));
+  }
+  for (uint32_t i = n; i --> 0;) {
+    worker->tasks[worker->bottom++] = &tasks[i];
+  }
+  pool->queued += n;
+  pthread_cond_broadcast(&pool->changed);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Runs tasks until all the ones in join have finished. These are usually
+// still on our own deque, but if not, we help whoever stole them.
+static void worker_join(RRBWorker *worker, RRBJoin *join) {
+  RRBPool *pool = worker->pool;
+  pthread_mutex_lock(&pool->lock);
+  while (join->pending > 0) {
+    RRBTask *task = worker_take(worker);
+    if (task == NULL) {
+      pthread_cond_wait(&pool->changed, &pool->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    task_run(worker, task);
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void task_run(RRBWorker *worker, RRBTask *task) {
+  const RRBParallelOps *ops = task->ops;
+  void *result;
+#ifdef RRB_REFCOUNT
+  RRBScopeSave saved;
+  scope_task_begin(task->scope, &saved);
+#endif
+  if (task->shift == LEAF_NODE_SHIFT || task->size <= RRB_PARALLEL_GRAIN) {
+    result = ops->seq(task->node, task->shift, task->index, ops->ctx);
+  }
+  else {
+    // Give the children away, and take the first one ourselves.
+    const InternalNode *node = (const InternalNode *) task->node;
+    uint32_t sizes[RRB_BRANCHING];
+    cumulative_sizes(node, task->shift, sizes);
+    void **results = RRB_MALLOC(node->len * sizeof(void *));
+    RRBTask *children = RRB_MALLOC(node->len * sizeof(RRBTask));
+    RRBJoin join = {.pending = node->len - 1};
+    for (uint32_t i = 0; i < node->len; i++) {
+      const uint32_t start = (i == 0) ? 0 : sizes[i - 1];
+      children[i].ops = ops;
+      children[i].node = (const TreeNode *) node->child[i];
+      children[i].shift = DEC_SHIFT(task->shift);
+      children[i].index = task->index + start;
+      children[i].size = sizes[i] - start;
+      children[i].result = &results[i];
+      children[i].join = (i == 0) ? NULL : &join;
+#ifdef RRB_REFCOUNT
+      children[i].scope = task->scope;
+#endif
+    }
+    if (node->len > 1) {
+      worker_push(worker, &children[1], node->len - 1);
+    }
+    task_run(worker, &children[0]);
+    worker_join(worker, &join);
+    result = (ops->join != NULL)
+      ? ops->join(node, task->shift, results, ops->ctx)
+      : NULL;
+    RRB_FREE(results);
+    RRB_FREE(children);
+  }
+#ifdef RRB_REFCOUNT
+  // Before the join is signalled, as the scope may end right after it.
+  scope_task_end(task->scope, &saved);
+#endif
+
+  if (task->result != NULL) {
+    *task->result = result;
+  }
+  if (task->join != NULL) {
+    RRBPool *pool = worker->pool;
+    pthread_mutex_lock(&pool->lock);
+    if (--task->join->pending == 0) {
+      pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/**
+ * Runs ops over the trie root, whose first item is at index, and returns the
+ * result. Small tries are handled by the calling thread alone. Calls made from
+ * within a running operation run on the same workers, as part of the task that
+ * made them.
+ */
+static void* parallel_run(const RRBParallelOps *ops, const TreeNode *root,
+                          uint32_t shift, uint32_t index, uint32_t size) {
+  if (size <= RRB_PARALLEL_GRAIN || shift == LEAF_NODE_SHIFT) {
+    return ops->seq(root, shift, index, ops->ctx);
+  }
+  RRBPool *pool = pool_get();
+  if (pool->threads == 1) {
+    return ops->seq(root, shift, index, ops->ctx);
+  }
+
+  void *result = NULL;
+  RRBTask task = {.ops = ops, .node = root, .shift = shift, .index = index,
+                  .size = size, .result = &result, .join = NULL};
+#ifdef RRB_REFCOUNT
+  task.scope = refs_state()->scope;
+#endif
+  char nested;
+  RRBWorker *worker = pool_enter(pool, &nested);
+  task_run(worker, &task);
+  pool_leave(pool, nested);
+  return result;
+}
+
+/**
+ * Runs ops->seq with index i and no node for every i below n, and returns
+ * when all of them have finished. For work that isn't shaped like a trie.
+ */
+static void parallel_range(const RRBParallelOps *ops, uint32_t n) {
+  RRBPool *pool = pool_get();
+  if (pool->threads == 1 || n <= 1) {
+    for (uint32_t i = 0; i < n; i++) {
+      ops->seq(NULL, LEAF_NODE_SHIFT, i, ops->ctx);
+    }
+    return;
+  }
+
+  RRBTask *tasks = RRB_MALLOC(n * sizeof(RRBTask));
+  RRBJoin join = {.pending = n - 1};
+  for (uint32_t i = 0; i < n; i++) {
+    tasks[i].ops = ops;
+    tasks[i].node = NULL;
+    tasks[i].shift = LEAF_NODE_SHIFT;
+    tasks[i].index = i;
+    tasks[i].size = 0;
+    tasks[i].result = NULL;
+    tasks[i].join = (i == 0) ? NULL : &join;
+#ifdef RRB_REFCOUNT
+    tasks[i].scope = refs_state()->scope;
+#endif
+  }
+  char nested;
+  RRBWorker *worker = pool_enter(pool, &nested);
+  worker_push(worker, &tasks[1], n - 1);
+  task_run(worker, &tasks[0]);
+  worker_join(worker, &join);
+  pool_leave(pool, nested);
+  RRB_FREE(tasks);
+}
+
+// Returns the worker of the calling thread. A thread outside the pool takes
+// worker 0, which only one such thread can have at a time.
+static RRBWorker* pool_enter(RRBPool *pool, char *nested) {
+  RRBWorker *worker = pthread_getspecific(rrb_pool_worker);
+  *nested = (worker != NULL);
+  if (worker == NULL) {
+    pthread_mutex_lock(&pool->enter);
+    worker = &pool->workers[0];
+    pthread_setspecific(rrb_pool_worker, worker);
+  }
+  return worker;
+}
+
+static void pool_leave(RRBPool *pool, char nested) {
+  if (!nested) {
+    pthread_setspecific(rrb_pool_worker, NULL);
+    pthread_mutex_unlock(&pool->enter);
+  }
+}
+
+// Calls visit on every leaf in the subtrie, with the index of its first item.
+static void leaves_walk(const TreeNode *node, uint32_t shift, uint32_t index,
+                        void (*visit)(const LeafNode *leaf, uint32_t index,
+                                      void *state),
+                        void *state) {
+  if (shift == LEAF_NODE_SHIFT) {
+    visit((const LeafNode *) node, index, state);
+    return;
+  }
+  const InternalNode *internal = (const InternalNode *) node;
+  const uint32_t child_shift = DEC_SHIFT(shift);
+  for (uint32_t i = 0; i < internal->len; i++) {
+    uint32_t start = i << shift;
+    if (internal->size_table != NULL) {
+      start = (i == 0) ? 0 : internal->size_table->size[i - 1];
+    }
+    leaves_walk((const TreeNode *) internal->child[i], child_shift,
+                index + start, visit, state);
+  }
+}
+
+// for_each
+
+typedef struct {
+  RRBForEachFn fn;
+  void *ctx;
+} ForEachState;
+
+static void for_each_leaf(const LeafNode *leaf, uint32_t index, void *state) {
+  const ForEachState *fe = state;
+  for (uint32_t i = 0; i < leaf->len; i++) {
+    fe->fn((void *) leaf->child[i], index + i, fe->ctx);
+  }
+}
+
+static void* for_each_seq(const TreeNode *node, uint32_t shift, uint32_t index,
+                          void *ctx) {
+  leaves_walk(node, shift, index, for_each_leaf, ctx);
+  return NULL;
+}
+
+void rrb_parallel_for_each(const RRB *rrb, RRBForEachFn fn, void *ctx) {
+  ForEachState fe = {.fn = fn, .ctx = ctx};
+  if (rrb->head_len != 0) {
+    for_each_leaf(rrb->head, 0, &fe);
+  }
+  if (rrb->root != NULL) {
+    const RRBParallelOps ops = {.seq = for_each_seq, .join = NULL, .ctx = &fe};
+    parallel_run(&ops, rrb->root, RRB_SHIFT(rrb), rrb->head_len,
+                 rrb->cnt - rrb->tail_len);
+  }
+  if (rrb->tail_len != 0) {
+    for_each_leaf(rrb->tail, rrb->head_len + rrb->cnt - rrb->tail_len, &fe);
+  }
+}
+
+// reduce
+
+typedef struct {
+  RRBReduceFn reduce;
+  RRBCombineFn combine;
+  void *init;
+  void *ctx;
+} ReduceOps;
+
+typedef struct {
+  const ReduceOps *ops;
+  void *acc;
+} ReduceState;
+
+static void reduce_leaf(const LeafNode *leaf, uint32_t index, void *state) {
+  (void) index;
+  ReduceState *rs = state;
+  for (uint32_t i = 0; i < leaf->len; i++) {
+    rs->acc = rs->ops->reduce(rs->acc, (void *) leaf->child[i], rs->ops->ctx);
+  }
+}
+
+static void* reduce_seq(const TreeNode *node, uint32_t shift, uint32_t index,
+                        void *ctx) {
+  ReduceState rs = {.ops = ctx, .acc = ((const ReduceOps *) ctx)->init};
+  leaves_walk(node, shift, index, reduce_leaf, &rs);
+  return rs.acc;
+}
+
+static void* reduce_join(const InternalNode *node, uint32_t shift,
+                         void **results, void *ctx) {
+  (void) shift;
+  const ReduceOps *ops = ctx;
+  void *acc = results[0];
+  for (uint32_t i = 1; i < node->len; i++) {
+    acc = ops->combine(acc, results[i], ops->ctx);
+  }
+  return acc;
+}
+
+void* rrb_parallel_reduce(const RRB *rrb, RRBReduceFn reduce,
+                          RRBCombineFn combine, void *init, void *ctx) {
+  ReduceOps ops = {.reduce = reduce, .combine = combine, .init = init,
+                   .ctx = ctx};
+  ReduceState rs = {.ops = &ops, .acc = init};
+  if (rrb->head_len != 0) {
+    reduce_leaf(rrb->head, 0, &rs);
+  }
+  if (rrb->root != NULL) {
+    const RRBParallelOps parallel_ops = {.seq = reduce_seq,
+                                         .join = reduce_join, .ctx = &ops};
+    void *trie_acc = parallel_run(&parallel_ops, rrb->root, RRB_SHIFT(rrb),
+                                  rrb->head_len, rrb->cnt - rrb->tail_len);
+    rs.acc = (rrb->head_len != 0) ? combine(rs.acc, trie_acc, ctx) : trie_acc;
+  }
+  if (rrb->tail_len != 0) {
+    if (rrb->head_len == 0 && rrb->root == NULL) {
+      reduce_leaf(rrb->tail, 0, &rs);
+    }
+    else {
+      ReduceState tail = {.ops = &ops, .acc = init};
+      reduce_leaf(rrb->tail, 0, &tail);
+      rs.acc = combine(rs.acc, tail.acc, ctx);
+    }
+  }
+  return rs.acc;
+}
+
+// map
+
+typedef struct {
+  RRBMapFn fn;
+  void *ctx;
+  char pointer_free;
+} MapState;
+
+static void* map_seq(const TreeNode *node, uint32_t shift, uint32_t index,
+                     void *ctx) {
+  (void) index;
+  const MapState *ms = ctx;
+  return map_rec(node, shift, ms->fn, ms->ctx, ms->pointer_free);
+}
+
+static void* map_join(const InternalNode *node, uint32_t shift,
+                      void **results, void *ctx) {
+  (void) shift;
+  (void) ctx;
+  InternalNode *mapped = internal_node_create(node->len);
+  mapped->size_table = node->size_table;
+  memcpy(mapped->child, results, node->len * sizeof(InternalNode *));
+  return mapped;
+}
+
+const RRB* rrb_parallel_map(const RRB *rrb, RRBMapFn fn, void *ctx) {
+  RRB_SCOPE_BEGIN();
+  if (rrb->head_len == 0 && rrb->cnt == 0) {
+    return RRB_SCOPE_END(rrb);
+  }
+  MapState ms = {.fn = fn, .ctx = ctx, .pointer_free = rrb->pointer_free};
+  RRB *new_rrb = rrb_head_clone(rrb);
+  if (rrb->head_len != 0) {
+    new_rrb->head = leaf_node_map(rrb->head, rrb->head_len, fn, ctx,
+                                  rrb->pointer_free);
+  }
+  if (rrb->root != NULL) {
+    const RRBParallelOps ops = {.seq = map_seq, .join = map_join, .ctx = &ms};
+    new_rrb->root = parallel_run(&ops, rrb->root, RRB_SHIFT(rrb),
+                                 rrb->head_len, rrb->cnt - rrb->tail_len);
+  }
+  if (rrb->tail_len != 0) {
+    new_rrb->tail = leaf_node_map(rrb->tail, rrb->tail_len, fn, ctx,
+                                  rrb->pointer_free);
+  }
+  return RRB_SCOPE_END(new_rrb);
+}
+
+// partition
+
+typedef struct {
+  RRBPredFn pred;
+  void *ctx;
+  char reject;
+  char pointer_free;
+} PartitionOps;
+
+typedef struct {
+  const PartitionOps *ops;
+  TransientRRB *kept;
+  TransientRRB *rejected;
+} PartitionState;
+
+typedef struct {
+  const RRB *kept;
+  const RRB *rejected;
+} PartitionResult;
+
+static void partition_leaf(const LeafNode *leaf, uint32_t index, void *state) {
+  (void) index;
+  PartitionState *ps = state;
+  partition_items(leaf->child, leaf->len, ps->ops->pred, ps->ops->ctx,
+                  &ps->kept, ps->ops->reject ? &ps->rejected : NULL);
+}
+
+// Every task partitions its subtrie into transients of its own, so the
+// workers never share a tree that is being built.
+static void* partition_seq(const TreeNode *node, uint32_t shift,
+                           uint32_t index, void *ctx) {
+  const PartitionOps *ops = ctx;
+  const RRB *empty = rrb_empty(ops->pointer_free);
+  PartitionState ps = {.ops = ops, .kept = rrb_to_transient(empty),
+                       .rejected = ops->reject ? rrb_to_transient(empty)
+                                               : NULL};
+  leaves_walk(node, shift, index, partition_leaf, &ps);
+  PartitionResult *result = RRB_MALLOC(sizeof(PartitionResult));
+  result->kept = transient_to_rrb(ps.kept);
+  result->rejected = ops->reject ? transient_to_rrb(ps.rejected) : NULL;
+  return result;
+}
+
+// Joins the n results with a single k-way concatenation each, so the tree is
+// rebalanced once per level instead of once per child.
+static PartitionResult* partition_concat(void *const *results, uint32_t n,
+                                         const PartitionOps *ops) {
+  const RRB *parts[RRB_BRANCHING] = {NULL};
+  PartitionResult *result = RRB_MALLOC(sizeof(PartitionResult));
+  for (uint32_t i = 0; i < n; i++) {
+    parts[i] = ((const PartitionResult *) results[i])->kept;
+  }
+  result->kept = rrb_concat_many(parts, n);
+  if (ops->reject) {
+    for (uint32_t i = 0; i < n; i++) {
+      parts[i] = ((const PartitionResult *) results[i])->rejected;
+    }
+    result->rejected = rrb_concat_many(parts, n);
+  }
+  return result;
+}
+
+static void* partition_join(const InternalNode *node, uint32_t shift,
+                            void **results, void *ctx) {
+  (void) shift;
+  PartitionResult *result = partition_concat(results, node->len, ctx);
+  for (uint32_t i = 0; i < node->len; i++) {
+    RRB_FREE(results[i]);
+  }
+  return result;
+}
+
+void rrb_parallel_partition(const RRB *rrb, RRBPredFn pred, void *ctx,
+                            const RRB **kept, const RRB **rejected) {
+  const uint32_t trie_len = rrb->cnt - rrb->tail_len;
+  if (trie_len <= RRB_PARALLEL_GRAIN) {
+    rrb_partition(rrb, pred, ctx, kept, rejected);
+    return;
+  }
+  RRB_SCOPE_BEGIN();
+  PartitionOps ops = {.pred = pred, .ctx = ctx, .reject = (rejected != NULL),
+                      .pointer_free = rrb->pointer_free};
+  const RRBParallelOps parallel_ops = {.seq = partition_seq,
+                                       .join = partition_join, .ctx = &ops};
+
+  // The head and the tail are partitioned by the calling thread, and joined
+  // with the trie like the children of any other node.
+  PartitionResult empty = {.kept = rrb_empty(rrb->pointer_free),
+                           .rejected = rrb_empty(rrb->pointer_free)};
+  void *results[3];
+  results[0] = (rrb->head_len != 0)
+    ? partition_seq((const TreeNode *) rrb->head, LEAF_NODE_SHIFT, 0, &ops)
+    : &empty;
+  results[1] = parallel_run(&parallel_ops, rrb->root, RRB_SHIFT(rrb),
+                            rrb->head_len, trie_len);
+  results[2] = partition_seq((const TreeNode *) rrb->tail, LEAF_NODE_SHIFT, 0,
+                             &ops);
+  PartitionResult *result = partition_concat(results, 3, &ops);
+  *kept = result->kept;
+  if (rejected != NULL) {
+    *rejected = result->rejected;
+  }
+  if (rrb->head_len != 0) {
+    RRB_FREE(results[0]);
+  }
+  RRB_FREE(results[1]);
+  RRB_FREE(results[2]);
+  RRB_FREE(result);
+  const RRB *parts[2] = {*kept, (rejected != NULL) ? *rejected : NULL};
+  RRB_SCOPE_END_MANY(parts, 2);
+}
+
+const RRB* rrb_parallel_filter(const RRB *rrb, RRBPredFn pred, void *ctx) {
+  RRB_SCOPE_BEGIN();
+  const RRB *kept;
+  rrb_parallel_partition(rrb, pred, ctx, &kept, NULL);
+  return RRB_SCOPE_END(kept);
+}
+
+// sort
+
+static void* sort_piece_task(const TreeNode *node, uint32_t shift,
+                             uint32_t index, void *ctx) {
+  (void) node;
+  (void) shift;
+  SortState *s = ctx;
+  s->piece(s, index);
+  return NULL;
+}
+
+static void sort_run_parallel(SortState *s, uint32_t pieces) {
+  const RRBParallelOps ops = {.seq = sort_piece_task, .join = NULL, .ctx = s};
+  parallel_range(&ops, pieces);
+}
+
+const RRB* rrb_parallel_sort(const RRB *rrb, RRBCmpFn cmp, void *ctx) {
+  RRB_SCOPE_BEGIN();
+  return RRB_SCOPE_END(sort_tree(rrb, cmp, ctx, sort_run_parallel));
+}
+
+#endif
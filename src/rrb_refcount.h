@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RRB_REFCOUNT_H
+#define RRB_REFCOUNT_H
+
+#include <pthread.h>
+
+// Reference counting, used instead of a tracing collector when RRB_REFCOUNT is
+// defined.
+//
+// The reference count of a node, size table or RRB head is the number of nodes
+// and heads pointing to it, plus the number of references the user holds. New
+// objects start out at zero, and their pointers to other objects aren't counted
+// yet, so the operations can build and throw away nodes without touching any
+// counts. Every new object is put in the nursery of its thread instead.
+//
+// When the outermost call into the library returns, its results are acquired:
+// the count of every result is incremented, and an object going from zero to
+// one gets the objects it points to acquired in turn. Old objects are never at
+// zero, so this only walks the new ones. The objects in the nursery that are
+// still at zero were temporaries, and are freed.
+//
+// Transients keep their new objects in a nursery of their own until they are
+// made persistent, as they modify them in place across calls.
+
+// The count of objects that are never freed, such as the empty RRB-tree.
+#define RRB_STATIC_REFS UINT32_MAX
+
+#ifdef RRB_REFCOUNT_ATOMIC
+#ifndef __GNUC__
+#error "Atomic reference counts need the __atomic builtins of GCC or Clang"
+#endif
+#define REFS_INC(obj) __atomic_fetch_add(&(obj)->refs, 1, __ATOMIC_RELAXED)
+#define REFS_DEC(obj) __atomic_sub_fetch(&(obj)->refs, 1, __ATOMIC_ACQ_REL)
+#else
+#define REFS_INC(obj) ((obj)->refs++)
+#define REFS_DEC(obj) (--(obj)->refs)
+#endif
+
+// Deep enough to walk a trie of the maximum height, keeping the siblings left
+// to visit on every level.
+#define REFS_STACK_SIZE ((RRB_MAX_HEIGHT + 2) * RRB_BRANCHING)
+
+typedef struct RRBCounted_ {
+  REFS_DECLARATION
+} RRBCounted;
+
+// The nurseries are bookkeeping of the library, and are taken from the system
+// allocator like the thread pool.
+typedef struct RRBRefArray_ {
+  void **elems;
+  size_t len;
+  size_t cap;
+} RRBRefArray;
+
+// The outermost call into the library on a thread. Its objects are the ones in
+// the nursery from base onwards, and the ones other threads made while running
+// its parallel tasks.
+typedef struct RRBScope_ {
+  size_t base;
+  RRBRefArray adopted;
+} RRBScope;
+
+typedef struct RRBRefState_ {
+  RRBScope *scope; // NULL outside of the library
+  uint32_t depth;
+  RRBRefArray nursery;
+} RRBRefState;
+
+// The scope a thread was in before it ran a callback or someone else's task.
+typedef struct RRBScopeSave_ {
+  RRBScope *scope;
+  uint32_t depth;
+  size_t mark;
+} RRBScopeSave;
+
+#define RRB_FRESH(obj) refs_fresh(obj)
+#define RRB_REFS_RESET(obj) ((obj)->refs = 0)
+#define RRB_SCOPE_BEGIN() RRBScope rrb_scope; scope_begin(&rrb_scope)
+#define RRB_SCOPE_END(rrb) scope_end(rrb)
+#define RRB_SCOPE_END_MANY(rrbs, n) scope_end_many(rrbs, n)
+// User callbacks run outside the scope of the call that runs them, so that the
+// RRB-trees they return to the user are acquired.
+#define RRB_CALLBACKS_BEGIN() RRBScopeSave rrb_callbacks = callbacks_begin()
+#define RRB_CALLBACKS_END() callbacks_end(&rrb_callbacks)
+
+static void ref_array_push(RRBRefArray *arr, void *elem);
+static void ref_array_append(RRBRefArray *arr, void *const *elems, size_t n);
+static RRBRefState* refs_state(void);
+static void refs_state_free(void *state);
+static void refs_key_create(void);
+static void refs_fresh(void *obj);
+static void refs_sweep(void *const *elems, size_t n);
+static void scope_begin(RRBScope *scope);
+static char scope_leave(RRBRefState *state);
+static void scope_close(RRBRefState *state);
+static const RRB* scope_end(const RRB *rrb);
+static void scope_end_many(const RRB *const *rrbs, uint32_t n);
+static RRBScopeSave callbacks_begin(void);
+static void callbacks_end(const RRBScopeSave *saved);
+static void scope_task_begin(RRBScope *scope, RRBScopeSave *saved);
+static void scope_task_end(RRBScope *scope, const RRBScopeSave *saved);
+static void head_acquire(const RRB *rrb);
+static void head_release(const RRB *rrb);
+
+static pthread_once_t rrb_refs_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rrb_refs_key;
+static pthread_mutex_t rrb_adopt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ref_array_push(RRBRefArray *arr, void *elem) {
+  if (arr->len == arr->cap) {
+    arr->cap = (arr->cap == 0) ? 256 : 2 * arr->cap;
+    arr->elems = realloc(arr->elems, arr->cap * sizeof(void *));
+  }
+  arr->elems[arr->len++] = elem;
+}
+
+static void ref_array_append(RRBRefArray *arr, void *const *elems, size_t n) {
+  if (arr->cap < arr->len + n) {
+    arr->cap = MAX(2 * arr->cap, arr->len + n);
+    arr->elems = realloc(arr->elems, arr->cap * sizeof(void *));
+  }
+  if (n != 0) {
+    memcpy(&arr->elems[arr->len], elems, n * sizeof(void *));
+  }
+  arr->len += n;
+}
+
+static RRBRefState* refs_state() {
+  pthread_once(&rrb_refs_once, refs_key_create);
+  RRBRefState *state = pthread_getspecific(rrb_refs_key);
+  if (state == NULL) {
+    state = calloc(1, sizeof(RRBRefState));
+    pthread_setspecific(rrb_refs_key, state);
+  }
+  return state;
+}
+
+static void refs_state_free(void *state) {
+  free(((RRBRefState *) state)->nursery.elems);
+  free(state);
+}
+
+static void refs_key_create() {
+  pthread_key_create(&rrb_refs_key, refs_state_free);
+}
+
+// Called on every new object, also when it's a copy of an old one.
+static void refs_fresh(void *obj) {
+  ((RRBCounted *) obj)->refs = 0;
+  ref_array_push(&refs_state()->nursery, obj);
+}
+
+// Frees the objects nothing refers to. Their own pointers were never counted.
+static void refs_sweep(void *const *elems, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (((RRBCounted *) elems[i])->refs == 0) {
+      RRB_FREE(elems[i]);
+    }
+  }
+}
+
+static void scope_begin(RRBScope *scope) {
+  RRBRefState *state = refs_state();
+  if (state->depth++ == 0) {
+    scope->base = state->nursery.len;
+    scope->adopted = (RRBRefArray) {.elems = NULL, .len = 0, .cap = 0};
+    state->scope = scope;
+  }
+}
+
+// Returns true if the outermost call is returning, in which case the results
+// must be acquired before the scope is closed.
+static char scope_leave(RRBRefState *state) {
+  return --state->depth == 0;
+}
+
+static void scope_close(RRBRefState *state) {
+  RRBScope *scope = state->scope;
+  refs_sweep(&state->nursery.elems[scope->base],
+             state->nursery.len - scope->base);
+  refs_sweep(scope->adopted.elems, scope->adopted.len);
+  free(scope->adopted.elems);
+  state->nursery.len = scope->base;
+  state->scope = NULL;
+}
+
+static const RRB* scope_end(const RRB *rrb) {
+  RRBRefState *state = refs_state();
+  if (scope_leave(state)) {
+    head_acquire(rrb);
+    scope_close(state);
+  }
+  return rrb;
+}
+
+static void scope_end_many(const RRB *const *rrbs, uint32_t n) {
+  RRBRefState *state = refs_state();
+  if (scope_leave(state)) {
+    for (uint32_t i = 0; i < n; i++) {
+      head_acquire(rrbs[i]);
+    }
+    scope_close(state);
+  }
+}
+
+static RRBScopeSave callbacks_begin() {
+  RRBRefState *state = refs_state();
+  RRBScopeSave saved = {.scope = state->scope, .depth = state->depth,
+                        .mark = state->nursery.len};
+  state->scope = NULL;
+  state->depth = 0;
+  return saved;
+}
+
+static void callbacks_end(const RRBScopeSave *saved) {
+  RRBRefState *state = refs_state();
+  state->scope = saved->scope;
+  state->depth = saved->depth;
+}
+
+// A thread running a parallel task joins the scope of the call that made it.
+// If that call is on another thread, the objects made by the task are handed
+// over to it at the end.
+static void scope_task_begin(RRBScope *scope, RRBScopeSave *saved) {
+  RRBRefState *state = refs_state();
+  saved->scope = state->scope;
+  saved->depth = state->depth;
+  saved->mark = state->nursery.len;
+  if (scope != state->scope) {
+    state->scope = scope;
+    state->depth = (scope != NULL) ? 1 : 0;
+  }
+}
+
+static void scope_task_end(RRBScope *scope, const RRBScopeSave *saved) {
+  RRBRefState *state = refs_state();
+  if (scope != saved->scope && scope != NULL) {
+    pthread_mutex_lock(&rrb_adopt_lock);
+    ref_array_append(&scope->adopted, &state->nursery.elems[saved->mark],
+                     state->nursery.len - saved->mark);
+    pthread_mutex_unlock(&rrb_adopt_lock);
+    state->nursery.len = saved->mark;
+  }
+  state->scope = saved->scope;
+  state->depth = saved->depth;
+}
+
+// Counts a new reference to rrb, and acquires what it points to if it's the
+// first one.
+static void head_acquire(const RRB *rrb) {
+  RRB *head = (RRB *) rrb;
+  if (head == NULL || head->refs == RRB_STATIC_REFS || REFS_INC(head) != 0) {
+    return;
+  }
+  TreeNode *stack[REFS_STACK_SIZE];
+  uint32_t len = 0;
+  stack[len++] = head->root;
+  stack[len++] = (TreeNode *) head->tail;
+  stack[len++] = (TreeNode *) head->head;
+  while (len > 0) {
+    TreeNode *node = stack[--len];
+    if (node == NULL || node->refs == RRB_STATIC_REFS || REFS_INC(node) != 0) {
+      continue;
+    }
+    if (node->type == INTERNAL_NODE) {
+      InternalNode *internal = (InternalNode *) node;
+      if (internal->size_table != NULL) {
+        REFS_INC(internal->size_table);
+      }
+      for (uint32_t i = 0; i < internal->len; i++) {
+        stack[len++] = (TreeNode *) internal->child[i];
+      }
+    }
+  }
+}
+
+// Drops a reference to rrb, and frees whatever that leaves unreferenced. Uses
+// a stack of its own rather than recursion, so that the depth of the release
+// doesn't depend on the shape of the tree.
+static void head_release(const RRB *rrb) {
+  RRB *head = (RRB *) rrb;
+  if (head == NULL || head->refs == RRB_STATIC_REFS || REFS_DEC(head) != 0) {
+    return;
+  }
+  TreeNode *stack[REFS_STACK_SIZE];
+  uint32_t len = 0;
+  stack[len++] = head->root;
+  stack[len++] = (TreeNode *) head->tail;
+  stack[len++] = (TreeNode *) head->head;
+  RRB_FREE(head);
+  while (len > 0) {
+    TreeNode *node = stack[--len];
+    if (node == NULL || node->refs == RRB_STATIC_REFS || REFS_DEC(node) != 0) {
+      continue;
+    }
+    if (node->type == INTERNAL_NODE) {
+      InternalNode *internal = (InternalNode *) node;
+      RRBSizeTable *table = internal->size_table;
+      if (table != NULL && REFS_DEC(table) == 0) {
+        RRB_FREE(table);
+      }
+      for (uint32_t i = 0; i < internal->len; i++) {
+        stack[len++] = (TreeNode *) internal->child[i];
+      }
+    }
+    RRB_FREE(node);
+  }
+}
+
+#endif
@@ -24,44 +24,94 @@
 #include "rrb_thread.h"
 
 struct TransientRRB_ {
+  REFS_DECLARATION
   uint32_t cnt;
   uint32_t shift;
   uint32_t tail_len;
   LeafNode *tail;
   TreeNode *root;
+  uint32_t head_len;
+  char pointer_free;
+  LeafNode *head;
   RRBThread owner;
   GUID_DECLARATION
+  // Bumped by every modification, so that cursors notice them.
+  uint32_t edits;
+#ifdef RRB_REFCOUNT
+  // The objects made by the transient, which are freed or acquired once it is
+  // made persistent, and the RRB-trees it refers to until then.
+  RRBRefArray fresh;
+  RRBRefArray pins;
+#endif
 };
 
+#ifdef RRB_REFCOUNT
+#define RRB_TRANSIENT_SCOPE_END(trrb, result) transient_scope_end(trrb, result)
+#define RRB_TRANSIENT_SCOPE_CLOSE(trrb, rrb) transient_scope_close(trrb, rrb)
+#define RRB_TRANSIENT_PIN(trrb, rrb) transient_pin(trrb, rrb)
+#else
+#define RRB_TRANSIENT_SCOPE_END(trrb, result) (result)
+#define RRB_TRANSIENT_SCOPE_CLOSE(trrb, rrb) (rrb)
+#define RRB_TRANSIENT_PIN(trrb, rrb) ((void) 0)
+#endif
+
 
 static const void* rrb_guid_create(void);
 static TransientRRB* transient_rrb_head_create(const RRB* rrb);
 static void check_transience(const TransientRRB *trrb);
-
-static RRBSizeTable* transient_size_table_create(void);
-static InternalNode* transient_internal_node_create(void);
-static LeafNode* transient_leaf_node_create(void);
+static void transient_edit(TransientRRB *trrb);
+#ifdef RRB_REFCOUNT
+static TransientRRB* transient_scope_end(TransientRRB *trrb,
+                                         TransientRRB *result);
+static const RRB* transient_scope_close(TransientRRB *trrb, const RRB *rrb);
+static void transient_pin(TransientRRB *trrb, const RRB *rrb);
+#endif
+
+static RRBSizeTable* transient_size_table_create(const void *guid);
+static InternalNode* transient_internal_node_create(const void *guid);
+static LeafNode* transient_leaf_node_create(const void *guid,
+                                            char pointer_free);
 static RRBSizeTable* transient_size_table_clone(const RRBSizeTable *table,
                                                 uint32_t len, const void *guid);
 static InternalNode* transient_internal_node_clone(const InternalNode *internal,
                                                    const void *guid);
-static LeafNode* transient_leaf_node_clone(const LeafNode *leaf, const void *guid);
+static LeafNode* transient_leaf_node_clone(const LeafNode *leaf,
+                                           const void *guid, char pointer_free);
 
 static RRBSizeTable* ensure_size_table_editable(const RRBSizeTable *table,
                                                 uint32_t len, const void *guid);
 static InternalNode* ensure_internal_editable(InternalNode *internal, const void *guid);
-static LeafNode* ensure_leaf_editable(LeafNode *leaf, const void *guid);
+static LeafNode* ensure_leaf_editable(LeafNode *leaf, const void *guid,
+                                      char pointer_free);
 
 static void transient_promote_rightmost_leaf(TransientRRB* trrb);
+static void transient_fill_root_leaf(TransientRRB *trrb);
+static LeafNode* transient_head_editable(TransientRRB *trrb);
+static void transient_hold_pointers(TransientRRB *trrb);
+static void transient_push_down_head(TransientRRB *trrb);
+static void transient_promote_leftmost_leaf(TransientRRB *trrb);
+
+// The guids are taken from a counter rather than from an allocation, as a
+// freed guid could be reused while nodes still carry it: nodes are freed
+// through reference counts, and the collector doesn't look at the guids of
+// internal nodes and leaves, see internal_node_alloc. They are even, as odd
+// guids are arenas.
+static pthread_mutex_t rrb_guid_lock = PTHREAD_MUTEX_INITIALIZER;
+static uintptr_t rrb_guid_last = 0;
 
 static const void* rrb_guid_create() {
-  return (const void *) RRB_MALLOC_ATOMIC(1);
+  pthread_mutex_lock(&rrb_guid_lock);
+  rrb_guid_last += 2;
+  const uintptr_t guid = rrb_guid_last;
+  pthread_mutex_unlock(&rrb_guid_lock);
+  return (const void *) guid;
 }
 
 static TransientRRB* transient_rrb_head_create(const RRB* rrb) {
   TransientRRB *trrb = RRB_MALLOC(sizeof(TransientRRB));
   memcpy(trrb, rrb, sizeof(RRB));
   trrb->owner = RRB_THREAD_ID();
+  trrb->edits = 0;
   return trrb;
 }
 
@@ -76,34 +126,164 @@ static void check_transience(const TransientRRB *trrb) {
   }
 }
 
-static InternalNode* transient_internal_node_create() {
-  InternalNode *node = RRB_MALLOC(sizeof(InternalNode)
-                              + RRB_BRANCHING * sizeof(InternalNode *));
+static void transient_edit(TransientRRB *trrb) {
+  check_transience(trrb);
+  trrb->edits++;
+}
+
+#ifdef RRB_REFCOUNT
+
+// Moves the objects made by the outermost call on a transient into the nursery
+// of the transient, where they stay until it is made persistent.
+static TransientRRB* transient_scope_end(TransientRRB *trrb,
+                                         TransientRRB *result) {
+  RRBRefState *state = refs_state();
+  if (scope_leave(state)) {
+    RRBScope *scope = state->scope;
+    ref_array_append(&trrb->fresh, &state->nursery.elems[scope->base],
+                     state->nursery.len - scope->base);
+    ref_array_append(&trrb->fresh, scope->adopted.elems, scope->adopted.len);
+    free(scope->adopted.elems);
+    state->nursery.len = scope->base;
+    state->scope = NULL;
+  }
+  return result;
+}
+
+// Ends the call making trrb persistent as rrb. The objects of the transient
+// become those of the call, so they are acquired through rrb or freed, and the
+// transient itself is freed.
+static const RRB* transient_scope_close(TransientRRB *trrb, const RRB *rrb) {
+  RRBRefState *state = refs_state();
+  ref_array_append(&state->nursery, trrb->fresh.elems, trrb->fresh.len);
+  free(trrb->fresh.elems);
+  RRBRefArray pins = trrb->pins;
+  RRB_FREE(trrb);
+  scope_end(rrb);
+  for (size_t i = 0; i < pins.len; i++) {
+    head_release(pins.elems[i]);
+  }
+  free(pins.elems);
+  return rrb;
+}
+
+// The nodes of the transient are not counted until it's made persistent, so
+// the user's RRB-trees it refers to are kept alive until then. Within the
+// library, the calling operation keeps them alive.
+static void transient_pin(TransientRRB *trrb, const RRB *rrb) {
+  if (refs_state()->depth == 1) {
+    head_acquire(rrb);
+    ref_array_push(&trrb->pins, (void *) rrb);
+  }
+}
+
+#endif
+
+// Transients made by rrb_to_transient_arena bump allocate their nodes out of
+// chunks of RRB_ARENA_CHUNK bytes. When the transient is made persistent, the
+// nodes still in use are copied out, and the chunks are freed along with every
+// node superseded during the session. The guid of such a transient is the
+// address of its arena with the lowest bit set, so that the nodes find their
+// arena through their guid. Other guids are always even.
+#define RRB_ARENA_CHUNK (1 << 16)
+#define RRB_ARENA_GRAIN 16
+#define ARENA_ROUND(size) \
+  (((size) + RRB_ARENA_GRAIN - 1) / RRB_ARENA_GRAIN * RRB_ARENA_GRAIN)
+
+typedef struct RRBArenaChunk_ {
+  struct RRBArenaChunk_ *next;
+} RRBArenaChunk;
+
+#define ARENA_CHUNK_HEADER ARENA_ROUND(sizeof(RRBArenaChunk))
+
+typedef struct RRBArena_ {
+  char *next;
+  char *end;
+  RRBArenaChunk *chunks;
+} RRBArena;
+
+#define ARENA_GUID(arena) ((const void *) ((uintptr_t) (arena) | 1))
+#define GUID_ARENA(guid) \
+  (((uintptr_t) (guid) & 1) ? (RRBArena *) ((uintptr_t) (guid) - 1) : NULL)
+
+// The chunks are allocated through the current allocator, so that the
+// collector sees the pointers in them, and are zeroed already.
+static void* arena_alloc(RRBArena *arena, size_t size) {
+  const size_t rounded = ARENA_ROUND(size);
+  if ((size_t) (arena->end - arena->next) < rounded) {
+    RRBArenaChunk *chunk = RRB_MALLOC(ARENA_CHUNK_HEADER + RRB_ARENA_CHUNK);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->next = (char *) chunk + ARENA_CHUNK_HEADER;
+    arena->end = arena->next + RRB_ARENA_CHUNK;
+  }
+  void *block = arena->next;
+  arena->next += rounded;
+  return block;
+}
+
+static void arena_clear(RRBArena *arena) {
+  RRBArenaChunk *chunk = arena->chunks;
+  while (chunk != NULL) {
+    RRBArenaChunk *next = chunk->next;
+    RRB_FREE(chunk);
+    chunk = next;
+  }
+  arena->chunks = NULL;
+  arena->next = arena->end = NULL;
+}
+
+// Returns NULL if the transient with guid has no arena. Nodes in an arena are
+// never freed on their own, so they are not fresh.
+static void* transient_arena_alloc(size_t size, const void *guid) {
+  RRBArena *arena = GUID_ARENA(guid);
+  return (arena != NULL) ? arena_alloc(arena, size) : NULL;
+}
+
+static InternalNode* transient_internal_node_create(const void *guid) {
+  InternalNode *node =
+    transient_arena_alloc(sizeof(InternalNode)
+                          + RRB_BRANCHING * sizeof(InternalNode *), guid);
+  if (node == NULL) {
+    node = internal_node_alloc(RRB_BRANCHING);
+    RRB_FRESH(node);
+  }
   node->type = INTERNAL_NODE;
   node->size_table = NULL;
+  node->guid = guid;
   return node;
 }
 
-static RRBSizeTable* transient_size_table_create() {
-  // this atomic allocation is, strictly speaking, NOT ok. Small chance of guid
-  // being reallocated at same position if lost. Note when porting over to
-  // different GC/Precise mode.
-  RRBSizeTable *table = RRB_MALLOC_ATOMIC(sizeof(RRBSizeTable)
-                                          + RRB_BRANCHING * sizeof(void *));
+static RRBSizeTable* transient_size_table_create(const void *guid) {
+  RRBSizeTable *table =
+    transient_arena_alloc(sizeof(RRBSizeTable)
+                          + RRB_BRANCHING * sizeof(uint32_t), guid);
+  if (table == NULL) {
+    table = size_table_create(RRB_BRANCHING);
+  }
+  table->guid = guid;
   return table;
 }
 
-static LeafNode* transient_leaf_node_create() {
-  LeafNode *node = RRB_MALLOC(sizeof(LeafNode)
-                              + RRB_BRANCHING * sizeof(void *));
+static LeafNode* transient_leaf_node_create(const void *guid,
+                                            char pointer_free) {
+  LeafNode *node = transient_arena_alloc(sizeof(LeafNode)
+                                         + RRB_BRANCHING * sizeof(void *),
+                                         guid);
+  if (node == NULL) {
+    node = leaf_node_alloc(RRB_BRANCHING, pointer_free);
+    RRB_FRESH(node);
+  }
   node->type = LEAF_NODE;
+  node->guid = guid;
   return node;
 }
 
 static RRBSizeTable* transient_size_table_clone(const RRBSizeTable *table,
                                                 uint32_t len, const void *guid) {
-  RRBSizeTable *copy = transient_size_table_create();
+  RRBSizeTable *copy = transient_size_table_create(guid);
   memcpy(copy, table, sizeof(RRBSizeTable) + len * sizeof(uint32_t));
+  RRB_REFS_RESET(copy);
   copy->guid = guid;
   return copy;
 }
@@ -111,16 +291,19 @@ static RRBSizeTable* transient_size_table_clone(const RRBSizeTable *table,
 
 static InternalNode* transient_internal_node_clone(const InternalNode *internal,
                                                    const void *guid) {
-  InternalNode *copy = transient_internal_node_create();
+  InternalNode *copy = transient_internal_node_create(guid);
   memcpy(copy, internal,
          sizeof(InternalNode) + internal->len * sizeof(InternalNode *));
+  RRB_REFS_RESET(copy);
   copy->guid = guid;
   return copy;
 }
 
-static LeafNode* transient_leaf_node_clone(const LeafNode *leaf, const void *guid) {
-  LeafNode *copy = transient_leaf_node_create();
+static LeafNode* transient_leaf_node_clone(const LeafNode *leaf,
+                                           const void *guid, char pointer_free) {
+  LeafNode *copy = transient_leaf_node_create(guid, pointer_free);
   memcpy(copy, leaf, sizeof(LeafNode) + leaf->len * sizeof(void *));
+  RRB_REFS_RESET(copy);
   copy->guid = guid;
   return copy;
 }
@@ -144,32 +327,103 @@ static InternalNode* ensure_internal_editable(InternalNode *internal, const void
   }
 }
 
-static LeafNode* ensure_leaf_editable(LeafNode *leaf, const void *guid) {
+static LeafNode* ensure_leaf_editable(LeafNode *leaf, const void *guid,
+                                      char pointer_free) {
   if (leaf->guid == guid) {
     return leaf;
   }
   else {
-    return transient_leaf_node_clone(leaf, guid);
+    return transient_leaf_node_clone(leaf, guid, pointer_free);
   }
 }
 
 TransientRRB* rrb_to_transient(const RRB *rrb) {
+  RRB_SCOPE_BEGIN();
   TransientRRB* trrb = transient_rrb_head_create(rrb);
   const void *guid = rrb_guid_create();
   trrb->guid = guid;
-  trrb->tail = transient_leaf_node_clone(rrb->tail, guid);
-  return trrb;
+  trrb->tail = transient_leaf_node_clone(rrb->tail, guid, trrb->pointer_free);
+  RRB_TRANSIENT_PIN(trrb, rrb);
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+TransientRRB* rrb_to_transient_arena(const RRB *rrb) {
+  RRB_SCOPE_BEGIN();
+  TransientRRB* trrb = transient_rrb_head_create(rrb);
+  RRBArena *arena = RRB_MALLOC(sizeof(RRBArena));
+  const void *guid = ARENA_GUID(arena);
+  trrb->guid = guid;
+  trrb->tail = transient_leaf_node_clone(rrb->tail, guid, trrb->pointer_free);
+  RRB_TRANSIENT_PIN(trrb, rrb);
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+// Copies the nodes we own in the subtree out of the arena, at their exact size
+// and without a guid.
+static TreeNode* arena_evacuate(TreeNode *node, const void *guid,
+                                char pointer_free) {
+  // Nodes we don't own never refer to nodes we own.
+  if (node == NULL || node->guid != guid) {
+    return node;
+  }
+  if (node->type == LEAF_NODE) {
+    LeafNode *leaf = (LeafNode *) node;
+    LeafNode *copy = leaf_node_create(leaf->len, pointer_free);
+    memcpy(copy->child, leaf->child, leaf->len * sizeof(void *));
+    return (TreeNode *) copy;
+  }
+  InternalNode *internal = (InternalNode *) node;
+  InternalNode *copy = internal_node_create(internal->len);
+  RRBSizeTable *table = internal->size_table;
+  if (table != NULL && table->guid == guid) {
+    copy->size_table = size_table_create(internal->len);
+    memcpy(copy->size_table->size, table->size,
+           internal->len * sizeof(uint32_t));
+  }
+  else {
+    copy->size_table = table;
+  }
+  for (uint32_t i = 0; i < internal->len; i++) {
+    copy->child[i] = (InternalNode *)
+      arena_evacuate((TreeNode *) internal->child[i], guid, pointer_free);
+  }
+  return (TreeNode *) copy;
+}
+
+// Moves the transient out of its arena, leaving the arena empty.
+static void transient_evacuate(TransientRRB *trrb) {
+  const void *guid = trrb->guid;
+  trrb->root = arena_evacuate(trrb->root, guid, trrb->pointer_free);
+  trrb->tail = (LeafNode *) arena_evacuate((TreeNode *) trrb->tail, guid,
+                                           trrb->pointer_free);
+  trrb->head = (trrb->head_len == 0)
+             ? NULL
+             : (LeafNode *) arena_evacuate((TreeNode *) trrb->head, guid,
+                                           trrb->pointer_free);
+  arena_clear(GUID_ARENA(guid));
 }
 
 const RRB* transient_to_rrb(TransientRRB *trrb) {
-  // Deny further modifications on the tree.
-  trrb->guid = NULL;
-  // reshrink tail
-  // In case of optimisation where tail len is not modified (NOT yet tested!)
-  // we have to handle it here first.
-  trrb->tail = leaf_node_clone(trrb->tail);
+  RRB_SCOPE_BEGIN();
+  RRBArena *arena = GUID_ARENA(trrb->guid);
+  if (arena != NULL) {
+    // The evacuated nodes have no guid, so the arena can go as well.
+    transient_evacuate(trrb);
+    RRB_FREE(arena);
+    trrb->guid = NULL;
+  }
+  else {
+    // Deny further modifications on the tree.
+    trrb->guid = NULL;
+    // reshrink tail
+    // In case of optimisation where tail len is not modified (NOT yet tested!)
+    // we have to handle it here first.
+    trrb->tail = leaf_node_clone(trrb->tail, trrb->pointer_free);
+    trrb->head = (trrb->head_len == 0)
+      ? NULL : leaf_node_clone(trrb->head, trrb->pointer_free);
+  }
   RRB* rrb = rrb_head_clone((const RRB *) trrb);
-  return rrb;
+  return RRB_TRANSIENT_SCOPE_CLOSE(trrb, rrb);
 }
 
 uint32_t transient_rrb_count(const TransientRRB *trrb) {
@@ -196,22 +450,28 @@ static InternalNode** mutate_first_k(TransientRRB *trrb, const uint32_t k);
 static InternalNode** new_editable_path(InternalNode **to_set,
                                         uint32_t empty_height, const void *guid);
 
+static uint32_t transient_append_leaves(InternalNode *node, uint32_t shift,
+                                        LeafNode **leaves, uint32_t count,
+                                        uint32_t *size, const void *guid);
+static void transient_push_down_leaves(TransientRRB *trrb, LeafNode **leaves,
+                                       uint32_t count);
+
 TransientRRB* transient_rrb_push(TransientRRB *restrict trrb, const void *restrict elt) {
-  check_transience(trrb);
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
   if (trrb->tail_len < RRB_BRANCHING) {
     trrb->tail->child[trrb->tail_len] = elt;
     trrb->cnt++;
     trrb->tail_len++;
     trrb->tail->len++;
     // ^ consider deferring incrementing this until insertion and/or persistentified.
-    return trrb;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
   }
 
   trrb->cnt++;
   const void *guid = trrb->guid;
 
-  LeafNode *new_tail = transient_leaf_node_create();
-  new_tail->guid = guid;
+  LeafNode *new_tail = transient_leaf_node_create(guid, trrb->pointer_free);
   new_tail->child[0] = elt;
   new_tail->len = 1;
   trrb->tail_len = 1;
@@ -222,7 +482,7 @@ TransientRRB* transient_rrb_push(TransientRRB *restrict trrb, const void *restri
   if (trrb->root == NULL) { // If it's  null, we can't just mutate it down.
     trrb->shift = LEAF_NODE_SHIFT;
     trrb->root = (TreeNode *) old_tail;
-    return trrb;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
   }
   // mutable count starts here
 
@@ -308,8 +568,7 @@ TransientRRB* transient_rrb_push(TransientRRB *restrict trrb, const void *restri
   // Increasing height of tree.
   if (nodes_to_mutate == 0) {
     const InternalNode *old_root = (const InternalNode *) trrb->root;
-    InternalNode *new_root = transient_internal_node_create();
-    new_root->guid = guid;
+    InternalNode *new_root = transient_internal_node_create(guid);
     new_root->len = 2;
     new_root->child[0] = (InternalNode *) trrb->root;
     trrb->root = (TreeNode *) new_root;
@@ -318,8 +577,7 @@ TransientRRB* transient_rrb_push(TransientRRB *restrict trrb, const void *restri
     // create size table if the original rrb root has a size table.
     if (old_root->type != LEAF_NODE &&
         ((const InternalNode *) old_root)->size_table != NULL) {
-      RRBSizeTable *table = transient_size_table_create();
-      table->guid = trrb->guid;
+      RRBSizeTable *table = transient_size_table_create(trrb->guid);
       table->size[0] = trrb->cnt - (old_tail->len + 1);
       // If we insert the tail, the old size minus (new size minus one) the old
       // tail size will be the amount of elements in the left branch. If there
@@ -346,7 +604,7 @@ TransientRRB* transient_rrb_push(TransientRRB *restrict trrb, const void *restri
     *to_set = (InternalNode *) old_tail;
   }
 
-  return trrb;
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
 }
 
 static InternalNode** mutate_first_k(TransientRRB *trrb, const uint32_t k) {
@@ -369,8 +627,10 @@ static InternalNode** mutate_first_k(TransientRRB *trrb, const uint32_t k) {
     }
 
     if (current->size_table != NULL) {
-      // Ensure size table is editable too
-      RRBSizeTable *table = ensure_size_table_editable(current->size_table, current->len, guid);
+      // Ensure size table is editable too. If the node was just widened, the
+      // old table is one entry shorter, and that entry is set below.
+      const uint32_t table_len = (i == k) ? current->len - 1 : current->len;
+      RRBSizeTable *table = ensure_size_table_editable(current->size_table, table_len, guid);
       if (i != k) {
         // Tail will always be 32 long, otherwise we insert a single element only
         table->size[current->len-1] += RRB_BRANCHING;
@@ -404,7 +664,8 @@ static InternalNode** mutate_first_k(TransientRRB *trrb, const uint32_t k) {
 
   // check if we need to mutate the leaf node. Very likely to happen (31/32)
   if (i == k) {
-    LeafNode *leaf = ensure_leaf_editable((LeafNode *) current, guid);
+    LeafNode *leaf = ensure_leaf_editable((LeafNode *) current, guid,
+                                          trrb->pointer_free);
     leaf->len++;
     *to_set = (InternalNode *) leaf;
   }
@@ -414,14 +675,12 @@ static InternalNode** mutate_first_k(TransientRRB *trrb, const uint32_t k) {
 static InternalNode** new_editable_path(InternalNode **to_set, uint32_t empty_height,
                                         const void* guid) {
   if (0 < empty_height) {
-    InternalNode *leaf = transient_internal_node_create();
-    leaf->guid = guid;
+    InternalNode *leaf = transient_internal_node_create(guid);
     leaf->len = 1;
 
     InternalNode *empty = (InternalNode *) leaf;
     for (uint32_t i = 1; i < empty_height; i++) {
-      InternalNode *new_empty = transient_internal_node_create();
-      new_empty->guid = guid;
+      InternalNode *new_empty = transient_internal_node_create(guid);
       new_empty->len = 1;
       new_empty->child[0] = empty;
       empty = new_empty;
@@ -434,18 +693,434 @@ static InternalNode** new_editable_path(InternalNode **to_set, uint32_t empty_he
   }
 }
 
+// Appends as many of the leaves as there is room for to the right edge of node,
+// which must be editable and may be empty. Once the rightmost child of node is
+// full, the leaves are placed in new subtrees built directly below node. All
+// leaves except the last must be full. Returns the number of leaves appended,
+// and adds the number of elements in them to size.
+static uint32_t transient_append_leaves(InternalNode *node, uint32_t shift,
+                                        LeafNode **leaves, uint32_t count,
+                                        uint32_t *size, const void *guid) {
+  uint32_t appended = 0;
+  if (shift > RRB_BITS && node->len != 0) {
+    const uint32_t last = node->len - 1;
+    InternalNode *child = ensure_internal_editable(node->child[last], guid);
+    node->child[last] = child;
+    uint32_t added_size = 0;
+    appended = transient_append_leaves(child, DEC_SHIFT(shift), leaves, count,
+                                       &added_size, guid);
+    if (appended != 0 && node->size_table != NULL) {
+      node->size_table = ensure_size_table_editable(node->size_table, node->len,
+                                                    guid);
+      node->size_table->size[last] += added_size;
+    }
+    *size += added_size;
+  }
+
+  while (appended < count && node->len < RRB_BRANCHING) {
+    uint32_t added, added_size = 0;
+    if (shift == RRB_BITS) {
+      node->child[node->len] = (InternalNode *) leaves[appended];
+      added = 1;
+      added_size = leaves[appended]->len;
+    }
+    else {
+      InternalNode *child = transient_internal_node_create(guid);
+      child->len = 0;
+      node->child[node->len] = child;
+      added = transient_append_leaves(child, DEC_SHIFT(shift),
+                                      &leaves[appended], count - appended,
+                                      &added_size, guid);
+    }
+    if (node->size_table != NULL) {
+      node->size_table = ensure_size_table_editable(node->size_table, node->len,
+                                                    guid);
+      node->size_table->size[node->len] =
+        (node->len == 0 ? 0 : node->size_table->size[node->len-1]) + added_size;
+    }
+    node->len++;
+    appended += added;
+    *size += added_size;
+  }
+  return appended;
+}
+
+// Pushes the leaves down into the trie, increasing its height as needed. Does
+// not touch the tail or the count.
+static void transient_push_down_leaves(TransientRRB *trrb, LeafNode **leaves,
+                                       uint32_t count) {
+  const void *guid = trrb->guid;
+  uint32_t trie_cnt = trrb->cnt - trrb->tail_len;
+  uint32_t pushed = 0;
+  if (trrb->root == NULL) {
+    trrb->shift = LEAF_NODE_SHIFT;
+    trrb->root = (TreeNode *) leaves[0];
+    trie_cnt += leaves[0]->len;
+    pushed = 1;
+  }
+  else if (trrb->shift != LEAF_NODE_SHIFT) {
+    InternalNode *root = ensure_internal_editable((InternalNode *) trrb->root,
+                                                  guid);
+    trrb->root = (TreeNode *) root;
+    pushed = transient_append_leaves(root, RRB_SHIFT(trrb), leaves, count,
+                                     &trie_cnt, guid);
+  }
+
+  // Increase the height of the tree until the remaining leaves fit.
+  while (pushed < count) {
+    const InternalNode *old_root = (const InternalNode *) trrb->root;
+    InternalNode *new_root = transient_internal_node_create(guid);
+    new_root->len = 1;
+    new_root->child[0] = (InternalNode *) old_root;
+    if (old_root->type != LEAF_NODE && old_root->size_table != NULL) {
+      RRBSizeTable *table = transient_size_table_create(guid);
+      table->size[0] = trie_cnt;
+      new_root->size_table = table;
+    }
+    trrb->root = (TreeNode *) new_root;
+    trrb->shift = INC_SHIFT(RRB_SHIFT(trrb));
+
+    pushed += transient_append_leaves(new_root, RRB_SHIFT(trrb),
+                                      &leaves[pushed], count - pushed,
+                                      &trie_cnt, guid);
+  }
+}
+
+TransientRRB* transient_rrb_push_many(TransientRRB *restrict trrb,
+                                      const void **items, uint32_t n) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  const void *guid = trrb->guid;
+
+  const uint32_t fill = MIN(RRB_BRANCHING - trrb->tail_len, n);
+  memcpy(&trrb->tail->child[trrb->tail_len], items, fill * sizeof(void *));
+  trrb->tail_len += fill;
+  trrb->tail->len += fill;
+  trrb->cnt += fill;
+  items += fill;
+  n -= fill;
+  if (n == 0) {
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+
+  // The tail is full, and will be pushed down along with every full leaf of
+  // items except the last 1-32 items, which become the new tail.
+  const uint32_t tail_len = ((n - 1) & RRB_MASK) + 1;
+  const uint32_t count = 1 + ((n - tail_len) >> RRB_BITS);
+  LeafNode **leaves = RRB_MALLOC(count * sizeof(LeafNode *));
+  leaves[0] = trrb->tail;
+  for (uint32_t i = 1; i < count; i++) {
+    LeafNode *leaf = transient_leaf_node_create(guid, trrb->pointer_free);
+    leaf->len = RRB_BRANCHING;
+    memcpy(leaf->child, &items[(i - 1) << RRB_BITS],
+           RRB_BRANCHING * sizeof(void *));
+    leaves[i] = leaf;
+  }
+
+  transient_push_down_leaves(trrb, leaves, count);
+  RRB_FREE(leaves);
+
+  LeafNode *new_tail = transient_leaf_node_create(guid, trrb->pointer_free);
+  new_tail->len = tail_len;
+  memcpy(new_tail->child, &items[n - tail_len], tail_len * sizeof(void *));
+  trrb->tail = new_tail;
+  trrb->tail_len = tail_len;
+  trrb->cnt += n;
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+// Concatenation follows rrb_concat closely, but nodes owned by the transient
+// are reused instead of copied. Rebalancing only moves elements towards the
+// left: The i'th redistributed node never starts before the i'th original one.
+// Therefore, an owned original node can be overwritten in place to become the
+// redistributed node at the same position.
+
+static InternalNode* transient_internal_node_new_above1(InternalNode *child,
+                                                        const void *guid) {
+  InternalNode *above = transient_internal_node_create(guid);
+  above->len = 1;
+  above->child[0] = child;
+  return above;
+}
+
+static InternalNode* transient_internal_node_new_above(InternalNode *left,
+                                                       InternalNode *right,
+                                                       const void *guid) {
+  InternalNode *above = transient_internal_node_create(guid);
+  above->len = 2;
+  above->child[0] = left;
+  above->child[1] = right;
+  return above;
+}
+
+static InternalNode* transient_set_sizes(InternalNode *node, uint32_t shift,
+                                         const void *guid) {
+  RRBSizeTable *table = node->size_table;
+  if (table == NULL || table->guid != guid) {
+    table = transient_size_table_create(guid);
+  }
+  uint32_t sum = 0;
+  const uint32_t child_shift = DEC_SHIFT(shift);
+  for (uint32_t i = 0; i < node->len; i++) {
+    sum += size_sub_trie((TreeNode *) node->child[i], child_shift);
+    table->size[i] = sum;
+  }
+  node->size_table = table;
+  return node;
+}
+
+static void transient_execute_concat_plan(InternalNode *all,
+                                          uint32_t *node_size, uint32_t slen,
+                                          uint32_t shift,
+                                          InternalNode **new_children,
+                                          const void *guid, char pointer_free) {
+  uint32_t idx = 0;
+  uint32_t offset = 0;
+  // Nodes moved over as they are can't be reused, as they're still in use.
+  char moved[2 * RRB_BRANCHING] = {0};
+
+  for (uint32_t i = 0; i < slen; i++) {
+    const uint32_t new_size = node_size[i];
+    if (offset == 0 && new_size == all->child[idx]->len) {
+      new_children[i] = all->child[idx];
+      moved[idx] = true;
+      idx++;
+      continue;
+    }
+
+    // The old node at position i has either been consumed already, or we are
+    // about to read from it at an offset no smaller than where we write.
+    TreeNode *reusable = (TreeNode *) all->child[i];
+    const char reuse = !moved[i] && reusable->guid == guid;
+    uint32_t cur_size = 0;
+    if (shift == INC_SHIFT(LEAF_NODE_SHIFT)) {
+      LeafNode *new_node;
+      if (reuse) {
+        new_node = (LeafNode *) reusable;
+      }
+      else {
+        new_node = transient_leaf_node_create(guid, pointer_free);
+      }
+      while (cur_size < new_size) {
+        const LeafNode *old_node = (LeafNode *) all->child[idx];
+        const uint32_t copy = MIN(new_size - cur_size, old_node->len - offset);
+        memmove(&new_node->child[cur_size], &old_node->child[offset],
+                copy * sizeof(void *));
+        cur_size += copy;
+        offset += copy;
+        if (offset == old_node->len) {
+          idx++;
+          offset = 0;
+        }
+      }
+      new_node->len = new_size;
+      new_children[i] = (InternalNode *) new_node;
+    }
+    else {
+      InternalNode *new_node;
+      if (reuse) {
+        new_node = (InternalNode *) reusable;
+      }
+      else {
+        new_node = transient_internal_node_create(guid);
+      }
+      while (cur_size < new_size) {
+        const InternalNode *old_node = all->child[idx];
+        const uint32_t copy = MIN(new_size - cur_size, old_node->len - offset);
+        memmove(&new_node->child[cur_size], &old_node->child[offset],
+                copy * sizeof(InternalNode *));
+        cur_size += copy;
+        offset += copy;
+        if (offset == old_node->len) {
+          idx++;
+          offset = 0;
+        }
+      }
+      new_node->len = new_size;
+      new_children[i] = transient_set_sizes(new_node, DEC_SHIFT(shift), guid);
+    }
+  }
+}
+
+static InternalNode* transient_rebalance(InternalNode *left,
+                                         InternalNode *centre,
+                                         InternalNode *right, uint32_t shift,
+                                         char is_top, const void *guid,
+                                         char pointer_free) {
+  InternalNode *all = internal_node_merge(left, centre, right);
+  uint32_t top_len;
+  uint32_t *node_count = create_concat_plan(all, &top_len);
+
+  // all contains at most 31 + 2 + 31 nodes.
+  InternalNode *new_children[2 * RRB_BRANCHING];
+  transient_execute_concat_plan(all, node_count, top_len, shift, new_children,
+                                guid, pointer_free);
+  RRB_FREE(node_count);
+
+  // The children of left are in all now, so left can be reused as well.
+  InternalNode *new_left;
+  if (left != NULL && left->guid == guid) {
+    new_left = left;
+  }
+  else {
+    new_left = transient_internal_node_create(guid);
+  }
+  new_left->len = MIN(top_len, RRB_BRANCHING);
+  memcpy(new_left->child, new_children, new_left->len * sizeof(InternalNode *));
+
+  if (top_len <= RRB_BRANCHING) {
+    if (is_top == false) {
+      return transient_internal_node_new_above1(
+               transient_set_sizes(new_left, shift, guid), guid);
+    }
+    else {
+      return new_left;
+    }
+  }
+  else {
+    InternalNode *new_right = transient_internal_node_create(guid);
+    new_right->len = top_len - RRB_BRANCHING;
+    memcpy(new_right->child, &new_children[RRB_BRANCHING],
+           new_right->len * sizeof(InternalNode *));
+    return transient_internal_node_new_above(
+             transient_set_sizes(new_left, shift, guid),
+             transient_set_sizes(new_right, shift, guid), guid);
+  }
+}
+
+static InternalNode* transient_concat_sub_tree(TreeNode *left_node,
+                                               uint32_t left_shift,
+                                               TreeNode *right_node,
+                                               uint32_t right_shift,
+                                               char is_top, const void *guid,
+                                               char pointer_free) {
+  if (left_shift > right_shift) {
+    InternalNode *left_internal = (InternalNode *) left_node;
+    InternalNode *centre_node =
+      transient_concat_sub_tree((TreeNode *) left_internal->child[left_internal->len - 1],
+                                DEC_SHIFT(left_shift), right_node, right_shift,
+                                false, guid, pointer_free);
+    return transient_rebalance(left_internal, centre_node, NULL, left_shift,
+                               is_top, guid, pointer_free);
+  }
+  else if (left_shift < right_shift) {
+    InternalNode *right_internal = (InternalNode *) right_node;
+    InternalNode *centre_node =
+      transient_concat_sub_tree(left_node, left_shift,
+                                (TreeNode *) right_internal->child[0],
+                                DEC_SHIFT(right_shift), false, guid,
+                                pointer_free);
+    return transient_rebalance(NULL, centre_node, right_internal, right_shift,
+                               is_top, guid, pointer_free);
+  }
+  else if (left_shift == LEAF_NODE_SHIFT) {
+    LeafNode *left_leaf = (LeafNode *) left_node;
+    LeafNode *right_leaf = (LeafNode *) right_node;
+    if (is_top && (left_leaf->len + right_leaf->len) <= RRB_BRANCHING) {
+      LeafNode *merged = ensure_leaf_editable(left_leaf, guid, pointer_free);
+      memcpy(&merged->child[merged->len], right_leaf->child,
+             right_leaf->len * sizeof(void *));
+      merged->len += right_leaf->len;
+      return transient_internal_node_new_above1((InternalNode *) merged, guid);
+    }
+    else {
+      return transient_internal_node_new_above((InternalNode *) left_leaf,
+                                               (InternalNode *) right_leaf,
+                                               guid);
+    }
+  }
+  else {
+    InternalNode *left_internal = (InternalNode *) left_node;
+    InternalNode *right_internal = (InternalNode *) right_node;
+    InternalNode *centre_node =
+      transient_concat_sub_tree((TreeNode *) left_internal->child[left_internal->len - 1],
+                                DEC_SHIFT(left_shift),
+                                (TreeNode *) right_internal->child[0],
+                                DEC_SHIFT(right_shift), false, guid,
+                                pointer_free);
+    return transient_rebalance(left_internal, centre_node, right_internal,
+                               left_shift, is_top, guid, pointer_free);
+  }
+}
+
+// Makes trrb hold pointers from now on, once it's combined with an RRB-tree
+// that isn't pointer free. The leaves we own may be atomic, so we take a new
+// guid, for none of them to be modified in place, and a tail of our own. The
+// leaves of an arena are never atomic, so it keeps its guid.
+static void transient_hold_pointers(TransientRRB *trrb) {
+  if (!trrb->pointer_free) {
+    return;
+  }
+  trrb->pointer_free = false;
+  if (GUID_ARENA(trrb->guid) == NULL) {
+    trrb->guid = rrb_guid_create();
+    trrb->tail = transient_leaf_node_clone(trrb->tail, trrb->guid, false);
+  }
+}
+
+TransientRRB* transient_rrb_concat(TransientRRB *left, const RRB *right) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(left);
+  if (!right->pointer_free) {
+    transient_hold_pointers(left);
+  }
+  RRB_TRANSIENT_PIN(left, right);
+  const void *guid = left->guid;
+  if (right->head_len != 0) {
+    right = flush_head(right);
+  }
+  if (right->cnt == 0) {
+    return RRB_TRANSIENT_SCOPE_END(left, left);
+  }
+  else if (left->cnt == 0) {
+    left->cnt = right->cnt;
+    left->shift = right->shift;
+    left->root = right->root;
+    left->tail_len = right->tail_len;
+    left->tail = transient_leaf_node_clone(right->tail, guid,
+                                           left->pointer_free);
+    return RRB_TRANSIENT_SCOPE_END(left, left);
+  }
+  else if (right->root == NULL) {
+    transient_rrb_push_many(left, (const void **) right->tail->child,
+                            right->tail_len);
+    return RRB_TRANSIENT_SCOPE_END(left, left);
+  }
+
+  LeafNode *left_tail = left->tail;
+  transient_push_down_leaves(left, &left_tail, 1);
+
+  InternalNode *root_candidate =
+    transient_concat_sub_tree(left->root, RRB_SHIFT(left), right->root,
+                              RRB_SHIFT(right), true, guid,
+                              left->pointer_free);
+  left->shift = find_shift((TreeNode *) root_candidate);
+  left->root = (TreeNode *) transient_set_sizes(root_candidate,
+                                                RRB_SHIFT(left), guid);
+  left->cnt += right->cnt;
+  left->tail = transient_leaf_node_clone(right->tail, guid, left->pointer_free);
+  left->tail_len = right->tail_len;
+  return RRB_TRANSIENT_SCOPE_END(left, left);
+}
+
 // transient_rrb_update is effectively the same as rrb_update, but may mutate
 // nodes if it's safe to do so (replacing clone calls with ensure_editable
 // calls)
 TransientRRB* transient_rrb_update(TransientRRB *restrict trrb, uint32_t index,
                                    const void *restrict elt) {
-  check_transience(trrb);
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
   const void* guid = trrb->guid;
+  if (index < trrb->head_len) {
+    transient_head_editable(trrb)->child[index] = elt;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  index -= trrb->head_len;
   if (index < trrb->cnt) {
     const uint32_t tail_offset = trrb->cnt - trrb->tail_len;
     if (tail_offset <= index) {
       trrb->tail->child[index - tail_offset] = elt;
-      return trrb;
+      return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
     }
     InternalNode **previous_pointer = (InternalNode **) &trrb->root;
     InternalNode *current = (InternalNode *) trrb->root;
@@ -465,37 +1140,48 @@ TransientRRB* transient_rrb_update(TransientRRB *restrict trrb, uint32_t index,
     }
 
     LeafNode *leaf = (LeafNode *) current;
-    leaf = ensure_leaf_editable((LeafNode *) leaf, guid);
+    leaf = ensure_leaf_editable((LeafNode *) leaf, guid, trrb->pointer_free);
     *previous_pointer = (InternalNode *) leaf;
     leaf->child[index & RRB_MASK] = elt;
-    return trrb;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
   }
   else {
-    return NULL;
+    return RRB_TRANSIENT_SCOPE_END(trrb, NULL);
   }
 }
 
 TransientRRB* transient_rrb_pop(TransientRRB *trrb) {
-  check_transience(trrb);
-  if (trrb->cnt == 1) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  if (trrb->cnt == 0) { // only the head is left
+    LeafNode *head = transient_head_editable(trrb);
+    trrb->head_len--;
+    head->child[trrb->head_len] = NULL;
+    head->len--;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  else if (trrb->cnt == 1) {
     trrb->cnt = 0;
     trrb->tail_len = 0;
     trrb->tail->child[0] = NULL;
     trrb->tail->len = 0;
-    return trrb;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
   }
   trrb->cnt--;
 
   if (trrb->tail_len == 1) {
     transient_promote_rightmost_leaf(trrb);
-    return trrb;
+    transient_fill_root_leaf(trrb);
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
   }
   else {
     trrb->tail->child[trrb->tail_len - 1] = NULL;
     trrb->tail_len--;
     trrb->tail->len--;
-
-    return trrb;
+    if (trrb->cnt <= RRB_BRANCHING) {
+      transient_fill_root_leaf(trrb);
+    }
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
   }
 }
 
@@ -514,8 +1200,10 @@ void transient_promote_rightmost_leaf(TransientRRB* trrb) {
 
   const uint32_t height = i;
 
-  // Set leaf node as tail.
-  trrb->tail = (LeafNode *) path[height];
+  // Set leaf node as tail. The tail is written to directly, so it has to be
+  // ours.
+  trrb->tail = ensure_leaf_editable((LeafNode *) path[height], guid,
+                                    trrb->pointer_free);
   trrb->tail_len = path[height]->len;
   const uint32_t tail_len = trrb->tail_len;
 
@@ -533,9 +1221,10 @@ void transient_promote_rightmost_leaf(TransientRRB* trrb) {
       path[i] = ensure_internal_editable(path[i], guid);
       path[i]->child[path[i]->len-1] = path[i+1];
       if (path[i+1] == NULL) {
+        // The size table is still correct for the remaining children.
         path[i]->len--;
       }
-      if (path[i]->size_table != NULL) { // this is decrement-size-table*
+      else if (path[i]->size_table != NULL) { // this is decrement-size-table*
         path[i]->size_table = ensure_size_table_editable(path[i]->size_table,
                                                          path[i]->len, guid);
         path[i]->size_table->size[path[i]->len-1] -= tail_len;
@@ -546,11 +1235,929 @@ void transient_promote_rightmost_leaf(TransientRRB* trrb) {
   trrb->root = (TreeNode *) path[0];
 }
 
-// TODO: more efficient slicing algorithm for transients. Should in theory just
-// require some size table magic and converting cloning over to ensure_editable.
+// Transient slicing is slice_right and slice_left with clones replaced by
+// ensure_editable calls, trimming the nodes and size tables we own in place.
+// Cut slots are cleared so the GC doesn't keep their contents alive.
+
+static void transient_rrb_clear(TransientRRB *trrb) {
+  memset(trrb->tail->child, 0, trrb->tail_len * sizeof(void *));
+  trrb->tail->len = 0;
+  trrb->tail_len = 0;
+  trrb->cnt = 0;
+  trrb->shift = LEAF_NODE_SHIFT;
+  trrb->root = NULL;
+}
+
+// As fill_root_leaf, but moves the items within the nodes we own.
+static void transient_fill_root_leaf(TransientRRB *trrb) {
+  if (trrb->root == NULL) {
+    return;
+  }
+  LeafNode *tail = trrb->tail;
+  if (trrb->cnt <= RRB_BRANCHING) {
+    const uint32_t trie_len = trrb->cnt - trrb->tail_len;
+    memmove(&tail->child[trie_len], tail->child,
+            trrb->tail_len * sizeof(void *));
+    rrb_copy_range((const RRB *) trrb, trrb->head_len,
+                   trrb->head_len + trie_len, (void **) tail->child);
+    tail->len = trrb->cnt;
+    trrb->tail_len = trrb->cnt;
+    trrb->shift = LEAF_NODE_SHIFT;
+    trrb->root = NULL;
+  }
+  else if (RRB_SHIFT(trrb) == 0 && trrb->cnt - trrb->tail_len < RRB_BRANCHING) {
+    LeafNode *new_root = ensure_leaf_editable((LeafNode *) trrb->root,
+                                              trrb->guid, trrb->pointer_free);
+    const uint32_t tail_cut = RRB_BRANCHING - new_root->len;
+    memcpy(&new_root->child[new_root->len], tail->child,
+           tail_cut * sizeof(void *));
+    new_root->len = RRB_BRANCHING;
+
+    trrb->tail_len -= tail_cut;
+    memmove(tail->child, &tail->child[tail_cut],
+            trrb->tail_len * sizeof(void *));
+    memset(&tail->child[trrb->tail_len], 0, tail_cut * sizeof(void *));
+    tail->len = trrb->tail_len;
+    trrb->root = (TreeNode *) new_root;
+  }
+}
+
+static TreeNode* transient_slice_right_rec(uint32_t *total_shift,
+                                           TreeNode *root, uint32_t right,
+                                           uint32_t shift, char has_left,
+                                           const void *guid,
+                                           char pointer_free) {
+  const uint32_t subshift = DEC_SHIFT(shift);
+  uint32_t subidx = right >> shift;
+  if (shift > LEAF_NODE_SHIFT) {
+    InternalNode *internal_root = (InternalNode *) root;
+    const RRBSizeTable *table = internal_root->size_table;
+    uint32_t idx = right;
+    if (table == NULL) {
+      idx -= subidx << shift;
+    }
+    else {
+      subidx = size_table_search(table, subidx, idx);
+      if (subidx != 0) {
+        idx -= table->size[subidx-1];
+      }
+    }
+
+    TreeNode *right_hand_node =
+      transient_slice_right_rec(total_shift,
+                                (TreeNode *) internal_root->child[subidx], idx,
+                                subshift, (subidx != 0) | has_left, guid,
+                                pointer_free);
+    if (subidx == 0 && !has_left) {
+      return right_hand_node;
+    }
+
+    InternalNode *sliced_root = ensure_internal_editable(internal_root, guid);
+    memset(&sliced_root->child[subidx + 1], 0,
+           (sliced_root->len - subidx - 1) * sizeof(InternalNode *));
+    sliced_root->len = subidx + 1;
+    sliced_root->child[subidx] = (InternalNode *) right_hand_node;
+    if (table != NULL) {
+      RRBSizeTable *sliced_table =
+        ensure_size_table_editable(table, subidx + 1, guid);
+      sliced_table->size[subidx] = right + 1;
+      sliced_root->size_table = sliced_table;
+    }
+    *total_shift = shift;
+    return (TreeNode *) sliced_root;
+  }
+  else { // if (shift <= RRB_BRANCHING)
+    LeafNode *left_vals = ensure_leaf_editable((LeafNode *) root, guid,
+                                               pointer_free);
+    memset(&left_vals->child[subidx + 1], 0,
+           (left_vals->len - subidx - 1) * sizeof(void *));
+    left_vals->len = subidx + 1;
+    *total_shift = shift;
+    return (TreeNode *) left_vals;
+  }
+}
+
+static void transient_slice_right(TransientRRB *trrb, uint32_t right) {
+  if (right == 0) {
+    transient_rrb_clear(trrb);
+  }
+  else if (right < trrb->cnt) {
+    const uint32_t tail_offset = trrb->cnt - trrb->tail_len;
+    if (tail_offset < right) {
+      const uint32_t new_tail_len = right - tail_offset;
+      memset(&trrb->tail->child[new_tail_len], 0,
+             (trrb->tail_len - new_tail_len) * sizeof(void *));
+      trrb->tail->len = new_tail_len;
+      trrb->tail_len = new_tail_len;
+      trrb->cnt = right;
+      return;
+    }
+
+    trrb->root = transient_slice_right_rec(&RRB_SHIFT(trrb), trrb->root,
+                                           right - 1, RRB_SHIFT(trrb), false,
+                                           trrb->guid, trrb->pointer_free);
+    trrb->cnt = right;
+    transient_promote_rightmost_leaf(trrb);
+  }
+}
+
+static TreeNode* transient_slice_left_rec(uint32_t *total_shift,
+                                          TreeNode *root, uint32_t left,
+                                          uint32_t shift, char has_right,
+                                          const void *guid, char pointer_free) {
+  const uint32_t subshift = DEC_SHIFT(shift);
+  uint32_t subidx = left >> shift;
+  if (shift > LEAF_NODE_SHIFT) {
+    InternalNode *internal_root = (InternalNode *) root;
+    const RRBSizeTable *table = internal_root->size_table;
+    const uint32_t len = internal_root->len;
+    uint32_t idx = left;
+    if (table == NULL) {
+      idx -= subidx << shift;
+    }
+    else {
+      subidx = size_table_search(table, subidx, idx);
+      if (subidx != 0) {
+        idx -= table->size[subidx - 1];
+      }
+    }
+
+    const uint32_t last_slot = len - 1;
+    TreeNode *left_hand_node =
+      transient_slice_left_rec(total_shift,
+                               (TreeNode *) internal_root->child[subidx], idx,
+                               subshift, (subidx != last_slot) | has_right,
+                               guid, pointer_free);
+    if (subidx == last_slot && !has_right) {
+      return left_hand_node;
+    }
+
+    InternalNode *sliced_root = ensure_internal_editable(internal_root, guid);
+    if (subidx == last_slot) { // No more slots left
+      sliced_root->child[0] = (InternalNode *) left_hand_node;
+      memset(&sliced_root->child[1], 0, last_slot * sizeof(InternalNode *));
+      sliced_root->len = 1;
+
+      const InternalNode *internal_left_hand_node =
+        (InternalNode *) left_hand_node;
+      if (subshift != LEAF_NODE_SHIFT &&
+          internal_left_hand_node->size_table != NULL) {
+        RRBSizeTable *sliced_table = (table != NULL && table->guid == guid)
+                                   ? (RRBSizeTable *) table
+                                   : transient_size_table_create(guid);
+        sliced_table->size[0] =
+          internal_left_hand_node->size_table->size[internal_left_hand_node->len-1];
+        sliced_root->size_table = sliced_table;
+      }
+      else {
+        sliced_root->size_table = NULL;
+      }
+    }
+    else { // if (subidx != last_slot)
+      const uint32_t sliced_len = len - subidx;
+      memmove(&sliced_root->child[1], &sliced_root->child[subidx + 1],
+              (sliced_len - 1) * sizeof(InternalNode *));
+      memset(&sliced_root->child[sliced_len], 0,
+             subidx * sizeof(InternalNode *));
+      sliced_root->child[0] = (InternalNode *) left_hand_node;
+      sliced_root->len = sliced_len;
+
+      RRBSizeTable *sliced_table;
+      if (table == NULL) {
+        sliced_table = transient_size_table_create(guid);
+        for (uint32_t i = 0; i < sliced_len; i++) {
+          // As in slice_left_rec, the top function fixes the last slot.
+          sliced_table->size[i] = (subidx + 1 + i) << shift;
+        }
+      }
+      else {
+        sliced_table = ensure_size_table_editable(table, len, guid);
+        memmove(sliced_table->size, &sliced_table->size[subidx],
+                sliced_len * sizeof(uint32_t));
+      }
+      for (uint32_t i = 0; i < sliced_len; i++) {
+        sliced_table->size[i] -= left;
+      }
+      sliced_root->size_table = sliced_table;
+    }
+    *total_shift = shift;
+    return (TreeNode *) sliced_root;
+  }
+  else { // if (shift <= RRB_BRANCHING)
+    LeafNode *right_vals = ensure_leaf_editable((LeafNode *) root, guid,
+                                                pointer_free);
+    const uint32_t right_vals_len = right_vals->len - subidx;
+    memmove(right_vals->child, &right_vals->child[subidx],
+            right_vals_len * sizeof(void *));
+    memset(&right_vals->child[right_vals_len], 0, subidx * sizeof(void *));
+    right_vals->len = right_vals_len;
+    *total_shift = shift;
+    return (TreeNode *) right_vals;
+  }
+}
+
+static void transient_slice_left(TransientRRB *trrb, uint32_t left) {
+  if (left >= trrb->cnt) {
+    transient_rrb_clear(trrb);
+    return;
+  }
+  else if (left > 0) {
+    const uint32_t remaining = trrb->cnt - left;
+
+    if (remaining <= trrb->tail_len) {
+      LeafNode *tail = trrb->tail;
+      const uint32_t cut = trrb->tail_len - remaining;
+      memmove(tail->child, &tail->child[cut], remaining * sizeof(void *));
+      memset(&tail->child[remaining], 0, cut * sizeof(void *));
+      tail->len = remaining;
+      trrb->tail_len = remaining;
+      trrb->cnt = remaining;
+      trrb->shift = LEAF_NODE_SHIFT;
+      trrb->root = NULL;
+      return;
+    }
+
+    InternalNode *root = (InternalNode *)
+      transient_slice_left_rec(&RRB_SHIFT(trrb), trrb->root, left,
+                               RRB_SHIFT(trrb), false, trrb->guid,
+                               trrb->pointer_free);
+    trrb->cnt = remaining;
+    trrb->root = (TreeNode *) root;
+
+    if (RRB_SHIFT(trrb) != LEAF_NODE_SHIFT && root->size_table != NULL) {
+      root->size_table->size[root->len-1] = trrb->cnt - trrb->tail_len;
+    }
+  }
+
+  transient_fill_root_leaf(trrb);
+}
+
 TransientRRB* transient_rrb_slice(TransientRRB *trrb, uint32_t from, uint32_t to) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  const uint32_t head_len = trrb->head_len;
+  if (head_len == 0) {
+    transient_slice_right(trrb, to);
+    transient_slice_left(trrb, from);
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  // As rrb_slice: slice the trie and tail without the head, then trim the head.
+  const uint32_t head_from = MIN(from, head_len);
+  const uint32_t head_to = MIN(to, head_len);
+  trrb->head_len = 0;
+  transient_slice_right(trrb, to - head_to);
+  transient_slice_left(trrb, from - head_from);
+  trrb->head_len = head_to - head_from;
+  if (trrb->head_len == 0) {
+    trrb->head = NULL;
+  }
+  else if (trrb->head_len != head_len) {
+    LeafNode *head = transient_head_editable(trrb);
+    memmove(head->child, &head->child[head_from],
+            trrb->head_len * sizeof(void *));
+    memset(&head->child[trrb->head_len], 0,
+           (head_len - trrb->head_len) * sizeof(void *));
+    head->len = trrb->head_len;
+  }
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+TransientRRB* transient_rrb_splice(TransientRRB *restrict trrb, uint32_t from,
+                                   uint32_t to, const RRB *restrict insert) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  if (to > rrb_count((const RRB *) trrb) || from > to) {
+    return RRB_TRANSIENT_SCOPE_END(trrb, NULL);
+  }
+  RRB_TRANSIENT_PIN(trrb, insert);
+  if (!insert->pointer_free) {
+    transient_hold_pointers(trrb);
+  }
+  if (to - from + rrb_count(insert) <= RRB_BRANCHING) {
+    splice_items(trrb, from, to, insert);
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  // The spliced tree shares nodes with trrb, some of which we own, and may
+  // have copies of them with our guid but without room to grow. Take a new
+  // guid so that none of them are modified in place, and a tail of our own.
+  // An arena is emptied first instead, so that it can keep its guid.
+  const void *guid = trrb->guid;
+  if (GUID_ARENA(guid) != NULL) {
+    transient_evacuate(trrb);
+  }
+  else {
+    guid = rrb_guid_create();
+  }
+  const RRB *spliced = splice_trees((const RRB *) trrb, from, to, insert);
+  memcpy(trrb, spliced, sizeof(RRB));
+  trrb->guid = guid;
+  trrb->tail = transient_leaf_node_clone(trrb->tail, guid, trrb->pointer_free);
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+// Transient insert_at and remove_at follow the persistent ones, but shift the
+// items within the nodes we own instead of copying them, and reuse the owned
+// node as the left half when it has to be split.
+
+// Sets the size table of node to sizes minus offset, reusing the table if we
+// own it.
+static void transient_size_table_set(InternalNode *node, const uint32_t *sizes,
+                                     uint32_t offset, const void *guid) {
+  RRBSizeTable *table = node->size_table;
+  if (table == NULL || table->guid != guid) {
+    table = transient_size_table_create(guid);
+  }
+  for (uint32_t i = 0; i < node->len; i++) {
+    table->size[i] = sizes[i] - offset;
+  }
+  node->size_table = table;
+}
+
+static TreeNode* transient_insert_at_rec(TreeNode *root, uint32_t shift,
+                                         uint32_t index, const void *elt,
+                                         TreeNode **split, const void *guid,
+                                         char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    LeafNode *leaf = ensure_leaf_editable((LeafNode *) root, guid,
+                                          pointer_free);
+    if (leaf->len < RRB_BRANCHING) {
+      memmove(&leaf->child[index + 1], &leaf->child[index],
+              (leaf->len - index) * sizeof(void *));
+      leaf->child[index] = elt;
+      leaf->len++;
+      *split = NULL;
+      return (TreeNode *) leaf;
+    }
+
+    const uint32_t left_len = (RRB_BRANCHING + 1) / 2;
+    LeafNode *right = transient_leaf_node_create(guid, pointer_free);
+    right->len = RRB_BRANCHING + 1 - left_len;
+    if (index < left_len) {
+      memcpy(right->child, &leaf->child[left_len - 1],
+             right->len * sizeof(void *));
+      memmove(&leaf->child[index + 1], &leaf->child[index],
+              (left_len - 1 - index) * sizeof(void *));
+      leaf->child[index] = elt;
+    }
+    else {
+      const uint32_t right_index = index - left_len;
+      memcpy(right->child, &leaf->child[left_len],
+             right_index * sizeof(void *));
+      right->child[right_index] = elt;
+      memcpy(&right->child[right_index + 1], &leaf->child[index],
+             (RRB_BRANCHING - index) * sizeof(void *));
+    }
+    memset(&leaf->child[left_len], 0,
+           (RRB_BRANCHING - left_len) * sizeof(void *));
+    leaf->len = left_len;
+    *split = (TreeNode *) right;
+    return (TreeNode *) leaf;
+  }
+
+  InternalNode *internal = (InternalNode *) root;
+  const uint32_t child_shift = DEC_SHIFT(shift);
+  uint32_t len = internal->len;
+  uint32_t sizes[RRB_BRANCHING + 1];
+  cumulative_sizes(internal, shift, sizes);
+
+  uint32_t child_index;
+  if (internal->size_table == NULL) {
+    child_index = index >> shift;
+    index -= child_index << shift;
+  }
+  else {
+    child_index = sized_pos(internal, &index, shift);
+  }
+
+  internal = ensure_internal_editable(internal, guid);
+  TreeNode *right;
+  internal->child[child_index] = (InternalNode *)
+    transient_insert_at_rec((TreeNode *) internal->child[child_index],
+                            child_shift, index, elt, &right, guid,
+                            pointer_free);
+  for (uint32_t i = child_index; i < len; i++) {
+    sizes[i]++;
+  }
+  *split = NULL;
+
+  if (right != NULL) {
+    InternalNode *children[RRB_BRANCHING + 1];
+    memcpy(children, internal->child, len * sizeof(InternalNode *));
+    memmove(&children[child_index + 2], &children[child_index + 1],
+            (len - child_index - 1) * sizeof(InternalNode *));
+    memmove(&sizes[child_index + 1], &sizes[child_index],
+            (len - child_index) * sizeof(uint32_t));
+    children[child_index + 1] = (InternalNode *) right;
+    sizes[child_index] -= size_sub_trie(right, child_shift);
+    len++;
+
+    if (len > RRB_BRANCHING) {
+      const uint32_t left_len = len / 2;
+      InternalNode *right_internal = transient_internal_node_create(guid);
+      right_internal->len = len - left_len;
+      memcpy(right_internal->child, &children[left_len],
+             right_internal->len * sizeof(InternalNode *));
+      transient_size_table_set(right_internal, &sizes[left_len],
+                               sizes[left_len - 1], guid);
+      memset(&internal->child[left_len], 0,
+             (RRB_BRANCHING - left_len) * sizeof(InternalNode *));
+      *split = (TreeNode *) right_internal;
+      len = left_len;
+    }
+    memcpy(internal->child, children, len * sizeof(InternalNode *));
+    internal->len = len;
+  }
+  transient_size_table_set(internal, sizes, 0, guid);
+  return (TreeNode *) internal;
+}
+
+TransientRRB* transient_rrb_insert_at(TransientRRB *restrict trrb,
+                                      uint32_t index, const void *restrict elt) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  if (index <= trrb->head_len && trrb->head_len != 0) {
+    if (trrb->head_len == RRB_BRANCHING) {
+      // The head is full, so push it down and insert into the trie instead.
+      transient_push_down_head(trrb);
+    }
+    else {
+      LeafNode *head = transient_head_editable(trrb);
+      memmove(&head->child[index + 1], &head->child[index],
+              (trrb->head_len - index) * sizeof(void *));
+      head->child[index] = elt;
+      head->len++;
+      trrb->head_len++;
+      return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+    }
+  }
+  else {
+    index -= trrb->head_len;
+  }
+
+  if (index == trrb->cnt) {
+    return RRB_TRANSIENT_SCOPE_END(trrb, transient_rrb_push(trrb, elt));
+  }
+  else if (index > trrb->cnt) {
+    return RRB_TRANSIENT_SCOPE_END(trrb, NULL);
+  }
+
+  const uint32_t tail_offset = trrb->cnt - trrb->tail_len;
+  if (tail_offset <= index) {
+    LeafNode *tail = trrb->tail;
+    const uint32_t tail_index = index - tail_offset;
+    if (trrb->tail_len < RRB_BRANCHING) {
+      memmove(&tail->child[tail_index + 1], &tail->child[tail_index],
+              (trrb->tail_len - tail_index) * sizeof(void *));
+      tail->child[tail_index] = elt;
+      tail->len++;
+      trrb->tail_len++;
+      trrb->cnt++;
+      return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+    }
+    // The tail is full, so its last item is pushed as a new tail.
+    const void *last = tail->child[RRB_MASK];
+    memmove(&tail->child[tail_index + 1], &tail->child[tail_index],
+            (RRB_MASK - tail_index) * sizeof(void *));
+    tail->child[tail_index] = elt;
+    return RRB_TRANSIENT_SCOPE_END(trrb, transient_rrb_push(trrb, last));
+  }
+
+  const void *guid = trrb->guid;
+  TreeNode *split;
+  TreeNode *root = transient_insert_at_rec(trrb->root, RRB_SHIFT(trrb), index,
+                                           elt, &split, guid,
+                                           trrb->pointer_free);
+  if (split != NULL) {
+    InternalNode *new_root =
+      transient_internal_node_new_above((InternalNode *) root,
+                                        (InternalNode *) split, guid);
+    trrb->shift = INC_SHIFT(RRB_SHIFT(trrb));
+    root = (TreeNode *) transient_set_sizes(new_root, RRB_SHIFT(trrb), guid);
+  }
+  trrb->root = root;
+  trrb->cnt++;
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+// As node_merge, but appends the children of right to left if we own it.
+static TreeNode* transient_node_merge(TreeNode *left, const TreeNode *right,
+                                      uint32_t shift, const void *guid,
+                                      char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    LeafNode *merged = ensure_leaf_editable((LeafNode *) left, guid,
+                                            pointer_free);
+    const LeafNode *right_leaf = (const LeafNode *) right;
+    memcpy(&merged->child[merged->len], right_leaf->child,
+           right_leaf->len * sizeof(void *));
+    merged->len += right_leaf->len;
+    return (TreeNode *) merged;
+  }
+  const InternalNode *right_internal = (const InternalNode *) right;
+  uint32_t sizes[RRB_BRANCHING];
+  const uint32_t left_len = left->len;
+  cumulative_sizes((InternalNode *) left, shift, sizes);
+  cumulative_sizes(right_internal, shift, &sizes[left_len]);
+  for (uint32_t i = 0; i < right_internal->len; i++) {
+    sizes[left_len + i] += sizes[left_len - 1];
+  }
+
+  InternalNode *merged = ensure_internal_editable((InternalNode *) left, guid);
+  memcpy(&merged->child[left_len], right_internal->child,
+         right_internal->len * sizeof(InternalNode *));
+  merged->len += right_internal->len;
+  transient_size_table_set(merged, sizes, 0, guid);
+  return (TreeNode *) merged;
+}
+
+static TreeNode* transient_remove_at_rec(TreeNode *root, uint32_t shift,
+                                         uint32_t index, const void *guid,
+                                         char pointer_free) {
+  if (shift == LEAF_NODE_SHIFT) {
+    if (root->len == 1) {
+      return NULL;
+    }
+    LeafNode *leaf = ensure_leaf_editable((LeafNode *) root, guid,
+                                          pointer_free);
+    leaf->len--;
+    memmove(&leaf->child[index], &leaf->child[index + 1],
+            (leaf->len - index) * sizeof(void *));
+    leaf->child[leaf->len] = NULL;
+    return (TreeNode *) leaf;
+  }
+
+  InternalNode *internal = (InternalNode *) root;
+  const uint32_t child_shift = DEC_SHIFT(shift);
+  const uint32_t len = internal->len;
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(internal, shift, sizes);
+
+  uint32_t child_index;
+  if (internal->size_table == NULL) {
+    child_index = index >> shift;
+    index -= child_index << shift;
+  }
+  else {
+    child_index = sized_pos(internal, &index, shift);
+  }
+
+  TreeNode *child =
+    transient_remove_at_rec((TreeNode *) internal->child[child_index],
+                            child_shift, index, guid, pointer_free);
+  if (child == NULL && len == 1) {
+    return NULL;
+  }
+  internal = ensure_internal_editable(internal, guid);
+  for (uint32_t i = child_index; i < len; i++) {
+    sizes[i]--;
+  }
+
+  // As in remove_at_rec, a merged node is put in the right slot of the pair.
+  uint32_t drop = len;
+  if (child == NULL) {
+    drop = child_index;
+  }
+  else {
+    InternalNode **children = internal->child;
+    children[child_index] = (InternalNode *) child;
+    if (child_index > 0 &&
+        children[child_index - 1]->len + child->len <= RRB_BRANCHING) {
+      children[child_index] = (InternalNode *)
+        transient_node_merge((TreeNode *) children[child_index - 1], child,
+                             child_shift, guid, pointer_free);
+      drop = child_index - 1;
+    }
+    else if (child_index + 1 < len &&
+             child->len + children[child_index + 1]->len <= RRB_BRANCHING) {
+      children[child_index + 1] = (InternalNode *)
+        transient_node_merge(child, (TreeNode *) children[child_index + 1],
+                             child_shift, guid, pointer_free);
+      drop = child_index;
+    }
+  }
+
+  if (drop != len) {
+    memmove(&internal->child[drop], &internal->child[drop + 1],
+            (len - drop - 1) * sizeof(InternalNode *));
+    memmove(&sizes[drop], &sizes[drop + 1],
+            (len - drop - 1) * sizeof(uint32_t));
+    internal->child[len - 1] = NULL;
+    internal->len--;
+  }
+  transient_size_table_set(internal, sizes, 0, guid);
+  return (TreeNode *) internal;
+}
+
+TransientRRB* transient_rrb_remove_at(TransientRRB *trrb, uint32_t index) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  if (index < trrb->head_len) {
+    LeafNode *head = transient_head_editable(trrb);
+    trrb->head_len--;
+    memmove(&head->child[index], &head->child[index + 1],
+            (trrb->head_len - index) * sizeof(void *));
+    head->child[trrb->head_len] = NULL;
+    head->len--;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  index -= trrb->head_len;
+  if (index >= trrb->cnt) {
+    return RRB_TRANSIENT_SCOPE_END(trrb, NULL);
+  }
+
+  const uint32_t tail_offset = trrb->cnt - trrb->tail_len;
+  if (tail_offset <= index) {
+    if (trrb->tail_len == 1) {
+      return RRB_TRANSIENT_SCOPE_END(trrb, transient_rrb_pop(trrb));
+    }
+    LeafNode *tail = trrb->tail;
+    const uint32_t tail_index = index - tail_offset;
+    trrb->tail_len--;
+    memmove(&tail->child[tail_index], &tail->child[tail_index + 1],
+            (trrb->tail_len - tail_index) * sizeof(void *));
+    tail->child[trrb->tail_len] = NULL;
+    tail->len--;
+    trrb->cnt--;
+    transient_fill_root_leaf(trrb);
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+
+  TreeNode *root = transient_remove_at_rec(trrb->root, RRB_SHIFT(trrb), index,
+                                           trrb->guid, trrb->pointer_free);
+  while (root != NULL && RRB_SHIFT(trrb) > LEAF_NODE_SHIFT &&
+         root->len == 1) {
+    root = (TreeNode *) ((InternalNode *) root)->child[0];
+    trrb->shift = DEC_SHIFT(RRB_SHIFT(trrb));
+  }
+  if (root == NULL) {
+    trrb->shift = LEAF_NODE_SHIFT;
+  }
+  trrb->root = root;
+  trrb->cnt--;
+  transient_fill_root_leaf(trrb);
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+// Transient push_front and pop_front shift the items within the head, which is
+// owned and has room for RRB_BRANCHING items once it has been made editable.
+
+static LeafNode* transient_head_editable(TransientRRB *trrb) {
+  if (trrb->head == NULL) {
+    trrb->head = transient_leaf_node_create(trrb->guid, trrb->pointer_free);
+  }
+  else {
+    trrb->head = ensure_leaf_editable(trrb->head, trrb->guid,
+                                      trrb->pointer_free);
+  }
+  return trrb->head;
+}
+
+// As prepend_leaf_rec, but updates the nodes on the left edge in place if we
+// own them.
+static InternalNode* transient_prepend_leaf_rec(InternalNode *root,
+                                                uint32_t shift, LeafNode *leaf,
+                                                const void *guid) {
+  // The sizes have to be read before the child below is modified.
+  uint32_t len = root->len;
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(root, shift, sizes);
+
+  InternalNode *child = NULL;
+  if (shift > INC_SHIFT(LEAF_NODE_SHIFT)) {
+    child = transient_prepend_leaf_rec(root->child[0], DEC_SHIFT(shift), leaf,
+                                       guid);
+  }
+  if (child == NULL && len == RRB_BRANCHING) {
+    return NULL;
+  }
+
+  InternalNode *internal = ensure_internal_editable(root, guid);
+  if (child == NULL) {
+    memmove(&internal->child[1], &internal->child[0],
+            len * sizeof(InternalNode *));
+    memmove(&sizes[1], &sizes[0], len * sizeof(uint32_t));
+    sizes[0] = 0;
+    child = (InternalNode *) leaf;
+    for (uint32_t s = INC_SHIFT(LEAF_NODE_SHIFT); s < shift; s += RRB_BITS) {
+      child = transient_internal_node_new_above1(child, guid);
+    }
+    len++;
+    internal->len = len;
+  }
+  internal->child[0] = child;
+  for (uint32_t i = 0; i < len; i++) {
+    sizes[i] += leaf->len;
+  }
+  transient_size_table_set(internal, sizes, 0, guid);
+  return internal;
+}
+
+static void transient_push_down_head(TransientRRB *trrb) {
+  const void *guid = trrb->guid;
+  LeafNode *leaf = trrb->head;
+  trrb->head = NULL;
+  trrb->head_len = 0;
+
+  if (trrb->cnt == 0) {
+    // Swap the head and the empty tail, so that we keep a buffer for the head.
+    trrb->head = trrb->tail;
+    trrb->tail = ensure_leaf_editable(leaf, guid, trrb->pointer_free);
+    trrb->tail_len = leaf->len;
+    trrb->cnt = leaf->len;
+    return;
+  }
+  trrb->cnt += leaf->len;
+  if (trrb->root == NULL) {
+    trrb->root = (TreeNode *) leaf;
+    trrb->shift = LEAF_NODE_SHIFT;
+    return;
+  }
+
+  InternalNode *root = NULL;
+  if (RRB_SHIFT(trrb) > LEAF_NODE_SHIFT) {
+    root = transient_prepend_leaf_rec((InternalNode *) trrb->root,
+                                      RRB_SHIFT(trrb), leaf, guid);
+  }
+  if (root == NULL) { // Increasing height of tree.
+    InternalNode *left = (InternalNode *) leaf;
+    for (uint32_t s = LEAF_NODE_SHIFT; s < RRB_SHIFT(trrb); s += RRB_BITS) {
+      left = transient_internal_node_new_above1(left, guid);
+    }
+    root = transient_internal_node_new_above(left, (InternalNode *) trrb->root,
+                                             guid);
+    trrb->shift = INC_SHIFT(RRB_SHIFT(trrb));
+    root = transient_set_sizes(root, RRB_SHIFT(trrb), guid);
+  }
+  trrb->root = (TreeNode *) root;
+}
+
+// As drop_first_leaf_rec, but removes the leaf from the nodes we own in place.
+static InternalNode* transient_drop_first_leaf_rec(InternalNode *root,
+                                                   uint32_t shift,
+                                                   uint32_t leaf_len,
+                                                   const void *guid) {
+  uint32_t len = root->len;
+  uint32_t sizes[RRB_BRANCHING];
+  cumulative_sizes(root, shift, sizes);
+
+  InternalNode *child = NULL;
+  if (shift > INC_SHIFT(LEAF_NODE_SHIFT)) {
+    child = transient_drop_first_leaf_rec(root->child[0], DEC_SHIFT(shift),
+                                          leaf_len, guid);
+  }
+  if (child == NULL && len == 1) {
+    return NULL;
+  }
+
+  InternalNode *internal = ensure_internal_editable(root, guid);
+  if (child != NULL) {
+    internal->child[0] = child;
+  }
+  else {
+    len--;
+    memmove(&internal->child[0], &internal->child[1],
+            len * sizeof(InternalNode *));
+    internal->child[len] = NULL;
+    memmove(&sizes[0], &sizes[1], len * sizeof(uint32_t));
+    internal->len = len;
+  }
+  transient_size_table_set(internal, sizes, leaf_len, guid);
+  return internal;
+}
+
+static void transient_promote_leftmost_leaf(TransientRRB *trrb) {
+  const void *guid = trrb->guid;
+  if (trrb->root == NULL) {
+    // Swap the empty head and the tail, reusing the head as tail if we own it.
+    LeafNode *tail = trrb->head;
+    if (tail == NULL || tail->guid != guid) {
+      tail = transient_leaf_node_create(guid, trrb->pointer_free);
+    }
+    trrb->head = trrb->tail;
+    trrb->head_len = trrb->tail_len;
+    trrb->tail = tail;
+    trrb->tail_len = 0;
+    trrb->cnt = 0;
+    return;
+  }
+
+  const InternalNode *current = (const InternalNode *) trrb->root;
+  for (uint32_t shift = RRB_SHIFT(trrb); shift > 0; shift -= RRB_BITS) {
+    current = current->child[0];
+  }
+  trrb->head = (LeafNode *) current;
+  trrb->head_len = current->len;
+  trrb->cnt -= current->len;
+
+  TreeNode *root = NULL;
+  if (RRB_SHIFT(trrb) > LEAF_NODE_SHIFT) {
+    root = (TreeNode *)
+      transient_drop_first_leaf_rec((InternalNode *) trrb->root,
+                                    RRB_SHIFT(trrb), current->len, guid);
+  }
+  while (root != NULL && RRB_SHIFT(trrb) > LEAF_NODE_SHIFT &&
+         root->len == 1) {
+    root = (TreeNode *) ((InternalNode *) root)->child[0];
+    trrb->shift = DEC_SHIFT(RRB_SHIFT(trrb));
+  }
+  if (root == NULL) {
+    trrb->shift = LEAF_NODE_SHIFT;
+  }
+  trrb->root = root;
+  transient_fill_root_leaf(trrb);
+}
+
+TransientRRB* transient_rrb_push_front(TransientRRB *restrict trrb,
+                                       const void *restrict elt) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  if (trrb->head_len == RRB_BRANCHING) {
+    transient_push_down_head(trrb);
+  }
+  LeafNode *head = transient_head_editable(trrb);
+  memmove(&head->child[1], &head->child[0], trrb->head_len * sizeof(void *));
+  head->child[0] = elt;
+  head->len++;
+  trrb->head_len++;
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+TransientRRB* transient_rrb_pop_front(TransientRRB *trrb) {
+  RRB_SCOPE_BEGIN();
+  transient_edit(trrb);
+  if (trrb->head_len + trrb->cnt == 0) {
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  if (trrb->head_len == 0) {
+    transient_promote_leftmost_leaf(trrb);
+  }
+  LeafNode *head = transient_head_editable(trrb);
+  trrb->head_len--;
+  memmove(&head->child[0], &head->child[1], trrb->head_len * sizeof(void *));
+  head->child[trrb->head_len] = NULL;
+  head->len--;
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+RRBCursor* transient_rrb_cursor_create(const TransientRRB *trrb) {
   check_transience(trrb);
-  const RRB* rrb = rrb_slice((const RRB*) trrb, from, to);
-  memcpy(trrb, rrb, sizeof(RRB));
-  return trrb;
+  RRBCursor *cursor = rrb_cursor_create((const RRB *) trrb);
+  cursor->edits = &trrb->edits;
+  return cursor;
+}
+
+void* transient_rrb_cursor_nth(RRBCursor *cursor, uint32_t index) {
+  check_transience((const TransientRRB *) cursor->rrb);
+  return rrb_cursor_nth(cursor, index);
+}
+
+// Like transient_rrb_update, but walks down from the cached path. If the leaf
+// is already owned by this transient, so is every node above it, and we can
+// write to it directly.
+TransientRRB* transient_rrb_cursor_update(RRBCursor *cursor, uint32_t index,
+                                          const void *restrict elt) {
+  RRB_SCOPE_BEGIN();
+  TransientRRB *trrb = (TransientRRB *) cursor->rrb;
+  check_transience(trrb);
+  const void *guid = trrb->guid;
+  if (index < trrb->head_len) {
+    transient_edit(trrb);
+    transient_head_editable(trrb)->child[index] = elt;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  index -= trrb->head_len;
+  if (index >= trrb->cnt) {
+    return RRB_TRANSIENT_SCOPE_END(trrb, NULL);
+  }
+  const uint32_t tail_offset = trrb->cnt - trrb->tail_len;
+  if (tail_offset <= index) {
+    transient_edit(trrb);
+    trrb->tail->child[index - tail_offset] = elt;
+    return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+  }
+  // The path of this cursor is kept up to date, those of other ones aren't.
+  cursor_seek(cursor, index);
+  transient_edit(trrb);
+  cursor->seen_edits = trrb->edits;
+  LeafNode *leaf = (LeafNode *) cursor->leaf;
+  if (leaf->guid != guid) {
+    InternalNode **previous_pointer = (InternalNode **) &trrb->root;
+    for (uint32_t level = 0; level < cursor->height; level++) {
+      InternalNode *current = ensure_internal_editable((InternalNode *) cursor->path[level],
+                                                       guid);
+      *previous_pointer = current;
+      cursor->path[level] = current;
+      previous_pointer = &current->child[cursor->path_idx[level]];
+    }
+    leaf = ensure_leaf_editable(leaf, guid, trrb->pointer_free);
+    *previous_pointer = (InternalNode *) leaf;
+    cursor->leaf = leaf;
+  }
+  leaf->child[index - cursor->leaf_start] = elt;
+  return RRB_TRANSIENT_SCOPE_END(trrb, trrb);
+}
+
+uint32_t transient_rrb_copy_range(const TransientRRB *trrb, uint32_t from,
+                                  uint32_t to, void **dst) {
+  check_transience(trrb);
+  return rrb_copy_range((const RRB *) trrb, from, to, dst);
 }
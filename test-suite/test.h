@@ -21,14 +21,31 @@
  *
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include "rrb.h"
 
+// The allocations made through counting_allocator. live is the number of
+// allocations not yet handed back to dealloc.
+typedef struct AllocCounts_ {
+  long allocs;
+  long atomic_allocs;
+  size_t bytes;
+  size_t atomic_bytes;
+  long live;
+} AllocCounts;
+
 void randomize_rand(void);
 void print_rrb(const RRB *rrb);
+const RRB* relaxed_rrb(const RRB *base, uint32_t cats);
 void setup_rand(const char *str_seed);
+int check_vals(const RRB *rrb, void **vals, uint32_t cnt, const char *name,
+               uint32_t t, uint32_t op);
+const RRBAllocator* counting_allocator(void);
+AllocCounts alloc_counts(void);
+AllocCounts alloc_counts_since(AllocCounts before);
 
 #ifdef RRB_DEBUG
 #define CHECK_TREE(t) (validate_rrb(t))
@@ -64,3 +81,130 @@ void print_rrb(const RRB *rrb) {
   }
   printf("]\n");
 }
+
+// Concatenates cats random slices of base, so that the result has size tables.
+const RRB* relaxed_rrb(const RRB *base, uint32_t cats) {
+  const uint32_t size = rrb_count(base);
+  const RRB *rrb = rrb_create();
+  for (uint32_t i = 0; i < cats; i++) {
+    uint32_t from = (uint32_t) rand() % size;
+    uint32_t to = (uint32_t) (rand() % (size - from)) + from;
+    rrb = rrb_concat(rrb, rrb_slice(base, from, to));
+  }
+  return rrb;
+}
+
+// Checks that rrb contains exactly the cnt values in vals, through rrb_nth, an
+// iterator in both directions and a cursor.
+int check_vals(const RRB *rrb, void **vals, uint32_t cnt, const char *name,
+               uint32_t t, uint32_t op) {
+  if (rrb_count(rrb) != cnt) {
+    printf("In run %u, op %u: expected %s size %u, but was %u.\n", t, op, name,
+           cnt, rrb_count(rrb));
+    return 1;
+  }
+  int fail = 0;
+  RRBIterator *it = rrb_iterator_create(rrb, 0);
+  RRBCursor *cursor = rrb_cursor_create(rrb);
+  for (uint32_t i = 0; i < cnt; i++) {
+    void *nth = rrb_nth(rrb, i);
+    void *next = rrb_iterator_next(it);
+    void *cursor_nth = rrb_cursor_nth(cursor, i);
+    if (nth != vals[i] || next != vals[i] || cursor_nth != vals[i]) {
+      printf("In run %u, op %u: expected %s val at pos %u to be %ld, was "
+             "%ld (nth), %ld (iterator), %ld (cursor).\n", t, op, name, i,
+             (intptr_t) vals[i], (intptr_t) nth, (intptr_t) next,
+             (intptr_t) cursor_nth);
+      fail = 1;
+    }
+  }
+  for (uint32_t i = cnt; i --> 0;) {
+    void *prev = rrb_iterator_prev(it);
+    if (prev != vals[i]) {
+      printf("In run %u, op %u: expected %s val at pos %u to be %ld, was "
+             "%ld (reverse iterator).\n", t, op, name, i, (intptr_t) vals[i],
+             (intptr_t) prev);
+      fail = 1;
+    }
+  }
+  return fail;
+}
+
+pthread_mutex_t alloc_counts_lock = PTHREAD_MUTEX_INITIALIZER;
+AllocCounts alloc_counts_total;
+RRBAllocator counted_allocator;
+
+void* counting_alloc(size_t size, void *ctx) {
+  (void) ctx;
+  pthread_mutex_lock(&alloc_counts_lock);
+  alloc_counts_total.allocs++;
+  alloc_counts_total.bytes += size;
+  alloc_counts_total.live++;
+  pthread_mutex_unlock(&alloc_counts_lock);
+  return counted_allocator.alloc(size, counted_allocator.ctx);
+}
+
+void* counting_alloc_atomic(size_t size, void *ctx) {
+  (void) ctx;
+  pthread_mutex_lock(&alloc_counts_lock);
+  alloc_counts_total.atomic_allocs++;
+  alloc_counts_total.atomic_bytes += size;
+  alloc_counts_total.live++;
+  pthread_mutex_unlock(&alloc_counts_lock);
+  return counted_allocator.alloc_atomic(size, counted_allocator.ctx);
+}
+
+void* counting_resize(void *ptr, size_t size, void *ctx) {
+  (void) ctx;
+  if (ptr == NULL) {
+    pthread_mutex_lock(&alloc_counts_lock);
+    alloc_counts_total.live++;
+    pthread_mutex_unlock(&alloc_counts_lock);
+  }
+  return counted_allocator.resize(ptr, size, counted_allocator.ctx);
+}
+
+void counting_dealloc(void *ptr, void *ctx) {
+  (void) ctx;
+  if (ptr != NULL) {
+    pthread_mutex_lock(&alloc_counts_lock);
+    alloc_counts_total.live--;
+    pthread_mutex_unlock(&alloc_counts_lock);
+    counted_allocator.dealloc(ptr, counted_allocator.ctx);
+  }
+}
+
+const RRBAllocator counting = {
+  .alloc = counting_alloc,
+  .alloc_atomic = counting_alloc_atomic,
+  .resize = counting_resize,
+  .dealloc = counting_dealloc,
+  .ctx = NULL
+};
+
+// Returns an allocator that counts the allocations and passes them on to the
+// allocator in use when it is first called.
+const RRBAllocator* counting_allocator(void) {
+  if (counted_allocator.alloc == NULL) {
+    counted_allocator = *rrb_get_allocator();
+  }
+  return &counting;
+}
+
+AllocCounts alloc_counts(void) {
+  pthread_mutex_lock(&alloc_counts_lock);
+  AllocCounts counts = alloc_counts_total;
+  pthread_mutex_unlock(&alloc_counts_lock);
+  return counts;
+}
+
+AllocCounts alloc_counts_since(AllocCounts before) {
+  AllocCounts now = alloc_counts();
+  return (AllocCounts) {
+    .allocs = now.allocs - before.allocs,
+    .atomic_allocs = now.atomic_allocs - before.atomic_allocs,
+    .bytes = now.bytes - before.bytes,
+    .atomic_bytes = now.atomic_bytes - before.atomic_bytes,
+    .live = now.live - before.live
+  };
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 50000
+#define CATS 20
+
+static void* twice(void *elt, void *ctx) {
+  (void) ctx;
+  return (void *) (2 * (intptr_t) elt);
+}
+
+static int desc_cmp(void *a, void *b, void *ctx) {
+  (void) ctx;
+  const intptr_t x = (intptr_t) a, y = (intptr_t) b;
+  return (x < y) - (x > y);
+}
+
+// Runs the usual operations with the current allocator.
+static int check_operations(const char *name) {
+  int fail = 0;
+  intptr_t *vals = malloc(sizeof(intptr_t) * SIZE);
+
+  const RRB *rrb = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    vals[i] = rand();
+    rrb = rrb_push(rrb, (void *) vals[i]);
+  }
+  TransientRRB *trrb = rrb_to_transient(rrb_create());
+  for (uint32_t i = 0; i < SIZE; i++) {
+    trrb = transient_rrb_push(trrb, (void *) vals[i]);
+  }
+  const RRB *transient = transient_to_rrb(trrb);
+
+  // Concatenating slices of both gives a relaxed tree with the same items.
+  const RRB *cat = rrb_create();
+  for (uint32_t from = 0; from < SIZE;) {
+    const uint32_t to = from + (uint32_t) rand() % (SIZE / CATS) + 1;
+    cat = rrb_concat(cat, rrb_slice((from / 2) % 2 ? rrb : transient, from,
+                                    to));
+    from = to;
+  }
+  cat = rrb_push_front(rrb_pop_front(cat), (void *) vals[0]);
+
+  const RRB *mapped = rrb_parallel_map(cat, twice, NULL);
+  const RRB *sorted = rrb_sort(cat, desc_cmp, NULL);
+  fail |= CHECK_TREE(cat) | CHECK_TREE(mapped) | CHECK_TREE(sorted);
+  if (rrb_count(cat) != SIZE || rrb_count(mapped) != SIZE ||
+      rrb_count(sorted) != SIZE) {
+    printf("%s: expected size %u, but was %u.\n", name, SIZE, rrb_count(cat));
+    fail = 1;
+  }
+  for (uint32_t i = 0; i < SIZE && !fail; i++) {
+    if ((intptr_t) rrb_nth(cat, i) != vals[i] ||
+        (intptr_t) rrb_nth(mapped, i) != 2 * vals[i] ||
+        (i > 0 && rrb_nth(sorted, i - 1) < rrb_nth(sorted, i))) {
+      printf("%s: wrong item at index %u.\n", name, i);
+      fail = 1;
+    }
+  }
+  free(vals);
+  return fail;
+}
+
+// Blocks from the slab allocator must be reused, zeroed by alloc, and keep
+// their contents when resized.
+static int check_slab(const RRBAllocator *slab) {
+  int fail = 0;
+  const size_t sizes[] = {1, 16, 17, 300, 1024, 1025, 100000};
+  for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    const size_t size = sizes[i];
+    unsigned char *block = slab->alloc(size, slab->ctx);
+    memset(block, 0xff, size);
+    slab->dealloc(block, slab->ctx);
+    block = slab->alloc(size, slab->ctx);
+    for (size_t j = 0; j < size; j++) {
+      if (block[j] != 0) {
+        printf("A slab block of %zu bytes wasn't zeroed.\n", size);
+        fail = 1;
+        break;
+      }
+    }
+    memset(block, 0x5a, size);
+    unsigned char *resized = slab->resize(block, 2 * size, slab->ctx);
+    for (size_t j = 0; j < size; j++) {
+      if (resized[j] != 0x5a) {
+        printf("A slab block of %zu bytes lost its contents when resized.\n",
+               size);
+        fail = 1;
+        break;
+      }
+    }
+    slab->dealloc(resized, slab->ctx);
+  }
+  return fail;
+}
+
+/**
+ * Runs the usual operations with the system and slab allocators, and checks
+ * the slab allocator on its own. Doesn't depend on Boehm GC, so that it can
+ * be run when the library is built without it.
+ */
+int main(int argc, char *argv[]) {
+  setup_rand(argc == 2 ? argv[1] : NULL);
+  rrb_parallel_set_threads(4);
+
+  int fail = 0;
+
+  rrb_set_allocator(rrb_malloc_allocator());
+  if (rrb_get_allocator()->alloc != rrb_malloc_allocator()->alloc) {
+    printf("rrb_set_allocator didn't set the allocator.\n");
+    fail = 1;
+  }
+  fail |= check_operations("malloc");
+
+  RRBAllocator *slab = rrb_slab_allocator_create();
+  fail |= check_slab(slab);
+  rrb_set_allocator(slab);
+  fail |= check_operations("slab");
+  rrb_set_allocator(NULL);
+  rrb_slab_allocator_destroy(slab);
+
+  if (rrb_gc_allocator() != NULL &&
+      rrb_get_allocator()->alloc != rrb_gc_allocator()->alloc) {
+    printf("rrb_set_allocator(NULL) didn't restore the collector.\n");
+    fail = 1;
+  }
+
+  return fail;
+}
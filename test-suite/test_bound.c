@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 100000
+#define CATS 20
+#define TESTS 60
+#define SEARCHES 2000
+
+static int int_cmp(void *a, void *b, void *ctx) {
+  (void) ctx;
+  const intptr_t x = (intptr_t) a, y = (intptr_t) b;
+  return (x > y) - (x < y);
+}
+
+// The bounds by a plain binary search over rrb_nth.
+static uint32_t nth_bound(const RRB *rrb, intptr_t key, char upper) {
+  uint32_t lo = 0, hi = rrb_count(rrb);
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    const intptr_t elt = (intptr_t) rrb_nth(rrb, mid);
+    if (upper ? elt > key : elt >= key) {
+      hi = mid;
+    }
+    else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+/**
+ * Searches sorted dense, relaxed and small trees with heads and runs of equal
+ * items, for keys that are in them, between their items and outside them.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  // Sorted, with runs of up to 40 equal items, and every other number missing
+  // so that there are keys between the items. Starts at 1000 to leave room
+  // for heads.
+  const RRB *base = rrb_create();
+  intptr_t val = 1000;
+  while (rrb_count(base) < SIZE) {
+    const uint32_t run = (uint32_t) rand() % 40 + 1;
+    for (uint32_t i = 0; i < run; i++) {
+      base = rrb_push(base, (void *) val);
+    }
+    val += 2;
+  }
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *rrb;
+    switch (t % 3) {
+    case 0: rrb = rrb_slice(base, 0, (uint32_t) rand() % SIZE); break;
+    case 1: {
+      // Consecutive slices, so that the concatenation stays sorted.
+      rrb = rrb_create();
+      uint32_t from = 0;
+      for (uint32_t i = 0; i < CATS; i++) {
+        const uint32_t to = from + (uint32_t) rand() % ((SIZE - from) / 4 + 1);
+        rrb = rrb_concat(rrb, rrb_slice(base, from, to));
+        from = to;
+      }
+      break;
+    }
+    default: rrb = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    }
+    const uint32_t head_len = (uint32_t) rand() % 50;
+    for (uint32_t i = 0; i < head_len; i++) {
+      rrb = rrb_push_front(rrb, (void *) ((intptr_t) 999 - 2 * (i / 3)));
+    }
+
+    const intptr_t min = 900, max = val + 100;
+    for (uint32_t i = 0; i < SEARCHES; i++) {
+      const intptr_t key = min + rand() % (max - min);
+      const uint32_t lower = rrb_lower_bound(rrb, (void *) key, int_cmp, NULL);
+      const uint32_t upper = rrb_upper_bound(rrb, (void *) key, int_cmp, NULL);
+      if (lower != nth_bound(rrb, key, 0) || upper != nth_bound(rrb, key, 1)) {
+        printf("In run %u: bounds of %ld were [%u, %u), expected [%u, %u).\n",
+               t, (long) key, lower, upper, nth_bound(rrb, key, 0),
+               nth_bound(rrb, key, 1));
+        fail = 1;
+        break;
+      }
+    }
+  }
+
+  const RRB *empty = rrb_create();
+  if (rrb_lower_bound(empty, (void *) 1, int_cmp, NULL) != 0 ||
+      rrb_upper_bound(empty, (void *) 1, int_cmp, NULL) != 0) {
+    printf("The bounds in an empty tree weren't 0.\n");
+    fail = 1;
+  }
+
+  return fail;
+}
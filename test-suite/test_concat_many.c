@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define TESTS 40
+#define MAX_PARTS 3000
+#define MAX_CNT (MAX_PARTS * (2 * 60 + 40))
+
+// A random part of base, which may be empty, relaxed or have items in its head.
+static const RRB* rand_part(const RRB *base, uint32_t max_len) {
+  const uint32_t from = (uint32_t) rand() % SIZE;
+  const uint32_t len = (uint32_t) rand() % (max_len + 1);
+  const RRB *part = rrb_slice(base, from, from + len < SIZE ? from + len : SIZE);
+  switch (rand() % 4) {
+  case 0:
+    part = rrb_concat(part, rrb_slice(base, 0, (uint32_t) rand() % max_len + 1));
+    break;
+  case 1: {
+    const uint32_t head_len = (uint32_t) rand() % 40;
+    for (uint32_t i = 0; i < head_len; i++) {
+      part = rrb_push_front(part, (void *) ((intptr_t) rand()));
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return part;
+}
+
+/**
+ * Concatenates few and many, large and small parts at once, and checks that the
+ * result contains the items of all of them in order.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  const RRB **parts = GC_MALLOC(sizeof(RRB *) * MAX_PARTS);
+  void **vals = GC_MALLOC(sizeof(void *) * MAX_CNT);
+
+  if (rrb_count(rrb_concat_many(parts, 0)) != 0) {
+    printf("Concatenating no parts didn't give an empty tree.\n");
+    fail = 1;
+  }
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    uint32_t n, max_len;
+    switch (t % 4) {
+    case 0: n = (uint32_t) rand() % 5 + 1; max_len = SIZE; break;
+    case 1: n = (uint32_t) rand() % 100 + 1; max_len = 200; break;
+    case 2: n = (uint32_t) rand() % MAX_PARTS + 1; max_len = 3; break;
+    default: n = (uint32_t) rand() % MAX_PARTS + 1; max_len = 60; break;
+    }
+
+    uint32_t cnt = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      parts[i] = rand_part(base, max_len);
+      rrb_copy_range(parts[i], 0, rrb_count(parts[i]), &vals[cnt]);
+      cnt += rrb_count(parts[i]);
+    }
+
+    const RRB *rrb = rrb_concat_many(parts, n);
+    fail |= CHECK_TREE(rrb);
+    if (rrb_count(rrb) != cnt) {
+      printf("In run %u: expected size %u, but was %u.\n", t, cnt,
+             rrb_count(rrb));
+      fail = 1;
+      continue;
+    }
+    for (uint32_t i = 0; i < cnt; i++) {
+      if (rrb_nth(rrb, i) != vals[i]) {
+        printf("In run %u: expected val at pos %u to be %ld, was %ld.\n", t, i,
+               (intptr_t) vals[i], (intptr_t) rrb_nth(rrb, i));
+        fail = 1;
+      }
+    }
+
+    // The result must still work with the other operations.
+    const uint32_t from = (uint32_t) rand() % (cnt + 1);
+    const RRB *sliced = rrb_slice(rrb, from, cnt);
+    const RRB *recatted = rrb_concat(sliced, parts[0]);
+    fail |= CHECK_TREE(recatted);
+    for (uint32_t i = 0; i < cnt - from; i++) {
+      if (rrb_nth(recatted, i) != vals[from + i]) {
+        printf("In run %u: expected val at pos %u after slice and concat to be "
+               "%ld, was %ld.\n", t, i, (intptr_t) vals[from + i],
+               (intptr_t) rrb_nth(recatted, i));
+        fail = 1;
+      }
+    }
+  }
+
+  return fail;
+}
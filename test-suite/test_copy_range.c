@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 40
+#define RANGES 500
+
+static int check_range(const RRB *rrb, void **dst, uint32_t from, uint32_t to,
+                       uint32_t copied) {
+  int fail = 0;
+  const uint32_t cnt = rrb_count(rrb);
+  const uint32_t expected = (to <= cnt ? to : cnt) - (from < to ? from : to);
+  if (from < cnt && copied != expected) {
+    printf("Copied %u elements from [%u, %u), expected %u.\n", copied, from,
+           to, expected);
+    fail = 1;
+  }
+  for (uint32_t i = 0; i < copied; i++) {
+    if (dst[i] != rrb_nth(rrb, from + i)) {
+      printf("Range [%u, %u): expected val at pos %u to be %ld, was %ld.\n",
+             from, to, from + i, (intptr_t) rrb_nth(rrb, from + i),
+             (intptr_t) dst[i]);
+      fail = 1;
+    }
+  }
+  return fail;
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  void **dst = GC_MALLOC(sizeof(void *) * (SIZE * CATS));
+
+  for (uint32_t r = 0; r < RANGES; r++) {
+    const RRB *rrb = (r % 2 == 0) ? relaxed_rrb(base, CATS) : base;
+    const uint32_t cnt = rrb_count(rrb);
+    if (cnt == 0) {
+      continue;
+    }
+    const uint32_t from = (uint32_t) rand() % cnt;
+    // Let some ranges run past the end
+    const uint32_t to = from + (uint32_t) rand() % (cnt - from + 10);
+    uint32_t copied = rrb_copy_range(rrb, from, to, dst);
+    fail |= check_range(rrb, dst, from, to, copied);
+
+    TransientRRB *trrb = rrb_to_transient(rrb);
+    copied = transient_rrb_copy_range(trrb, from, to, dst);
+    fail |= check_range(rrb, dst, from, to, copied);
+  }
+
+  // Whole trees, and nothing at all
+  const RRB *rrb = relaxed_rrb(base, CATS);
+  uint32_t copied = rrb_copy_range(rrb, 0, rrb_count(rrb), dst);
+  fail |= check_range(rrb, dst, 0, rrb_count(rrb), copied);
+  if (rrb_copy_range(rrb, 10, 10, dst) != 0) {
+    printf("Copying an empty range copied something.\n");
+    fail = 1;
+  }
+  if (rrb_copy_range(rrb_create(), 0, 10, dst) != 0) {
+    printf("Copying from an empty rrb copied something.\n");
+    fail = 1;
+  }
+
+  return fail;
+}
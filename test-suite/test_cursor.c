@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 40
+#define LOOKUPS 100000
+#define MAX_JUMP 100
+
+// Random, but clustered, indices.
+static uint32_t next_index(uint32_t prev, uint32_t count) {
+  if (rand() % 50 == 0) {
+    return (uint32_t) rand() % count;
+  }
+  int64_t next = (int64_t) prev + (rand() % (2 * MAX_JUMP + 1)) - MAX_JUMP;
+  if (next < 0 || next >= count) {
+    return (uint32_t) rand() % count;
+  }
+  return (uint32_t) next;
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+  const RRB *rrb = relaxed_rrb(base, CATS);
+  const uint32_t count = rrb_count(rrb);
+
+  RRBCursor *cursor = rrb_cursor_create(rrb);
+  uint32_t idx = 0;
+  for (uint32_t i = 0; i < LOOKUPS; i++) {
+    idx = next_index(idx, count);
+    intptr_t expected = (intptr_t) rrb_nth(rrb, idx);
+    intptr_t actual = (intptr_t) rrb_cursor_nth(cursor, idx);
+    if (expected != actual) {
+      printf("Expected val at pos %u to be %ld, was %ld.\n", idx, expected,
+             actual);
+      fail = 1;
+    }
+  }
+  if (rrb_cursor_nth(cursor, count) != NULL) {
+    puts("Expected lookup out of bounds to return NULL.");
+    fail = 1;
+  }
+
+  // read-modify-write through a transient cursor
+  intptr_t *list = GC_MALLOC_ATOMIC(sizeof(intptr_t) * count);
+  intptr_t *original = GC_MALLOC_ATOMIC(sizeof(intptr_t) * count);
+  for (uint32_t i = 0; i < count; i++) {
+    list[i] = original[i] = (intptr_t) rrb_nth(rrb, i);
+  }
+  TransientRRB *trrb = rrb_to_transient(rrb);
+  RRBCursor *tcursor = transient_rrb_cursor_create(trrb);
+  for (uint32_t i = 0; i < LOOKUPS; i++) {
+    idx = next_index(idx, count);
+    intptr_t val = (intptr_t) transient_rrb_cursor_nth(tcursor, idx);
+    if (val != list[idx]) {
+      printf("Transient: expected val at pos %u to be %ld, was %ld.\n", idx,
+             list[idx], val);
+      fail = 1;
+    }
+    list[idx] = val + 1;
+    trrb = transient_rrb_cursor_update(tcursor, idx, (void *) (val + 1));
+  }
+
+  const RRB *updated = transient_to_rrb(trrb);
+  fail |= CHECK_TREE(updated);
+  for (uint32_t i = 0; i < count; i++) {
+    intptr_t actual = (intptr_t) rrb_nth(updated, i);
+    if (actual != list[i]) {
+      printf("Updated: expected val at pos %u to be %ld, was %ld.\n", i,
+             list[i], actual);
+      fail = 1;
+    }
+    // original must be left untouched
+    if ((intptr_t) rrb_cursor_nth(cursor, i) != original[i]) {
+      printf("Original changed at pos %u.\n", i);
+      fail = 1;
+    }
+  }
+
+  // Cursors notice modifications made by other means, also those that leave
+  // the root and the size of the transient unchanged.
+  trrb = rrb_to_transient(rrb);
+  tcursor = transient_rrb_cursor_create(trrb);
+  RRBCursor *other = transient_rrb_cursor_create(trrb);
+  for (uint32_t i = 0; i < LOOKUPS / 100; i++) {
+    idx = (uint32_t) rand() % count;
+    transient_rrb_cursor_nth(tcursor, idx);
+    transient_rrb_cursor_nth(other, idx);
+    switch (i % 3) {
+    case 0:
+      trrb = transient_rrb_insert_at(trrb, idx, (void *) (intptr_t) -1);
+      trrb = transient_rrb_remove_at(trrb, (idx + 1) % count);
+      break;
+    case 1:
+      trrb = transient_rrb_update(trrb, idx, (void *) (intptr_t) i);
+      break;
+    default:
+      trrb = transient_rrb_cursor_update(other, idx, (void *) (intptr_t) i);
+      break;
+    }
+    for (uint32_t j = idx; j < idx + 3 && j < count; j++) {
+      intptr_t expected = (intptr_t) transient_rrb_nth(trrb, j);
+      intptr_t actual = (intptr_t) transient_rrb_cursor_nth(tcursor, j);
+      if (expected != actual) {
+        printf("Stale cursor: expected val at pos %u to be %ld, was %ld.\n",
+               j, expected, actual);
+        fail = 1;
+      }
+    }
+  }
+  fail |= CHECK_TREE(transient_to_rrb(trrb));
+
+  return fail;
+}
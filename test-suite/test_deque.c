@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 20
+#define TESTS 60
+#define OPS 2000
+#define MAX_CNT (SIZE + OPS * 2)
+
+#define SHORT_SIZE 100
+#define SHORT_TESTS 300
+
+/**
+ * Pops short relaxed trees from the front and then from the back, until they
+ * are empty. A relaxed trie may hold few items, so popping the back of the tree
+ * must move the trie into the tail once the tree no longer needs one.
+ */
+static int check_short_pops(const RRB *base) {
+  int fail = 0;
+  void **vals = GC_MALLOC(sizeof(void *) * SHORT_SIZE * 4);
+  for (uint32_t t = 0; t < SHORT_TESTS && !fail; t++) {
+    const RRB *rrb = relaxed_rrb(rrb_slice(base, 0, SHORT_SIZE), 4);
+    uint32_t cnt = rrb_count(rrb);
+    const uint32_t fronts = (uint32_t) rand() % (cnt / 2 + 1);
+    for (uint32_t i = 0; i < fronts; i++) {
+      rrb = rrb_pop_front(rrb);
+    }
+    cnt -= fronts;
+    rrb_copy_range(rrb, 0, cnt, vals);
+
+    // The transient is only valid as an RRB-tree once it's persisted, so it
+    // stops at some point on the way.
+    TransientRRB *trrb = rrb_to_transient(rrb);
+    const uint32_t stop = (uint32_t) rand() % (cnt + 1);
+    for (uint32_t op = 0; cnt > 0 && !fail; op++) {
+      rrb = rrb_pop(rrb);
+      cnt--;
+      fail |= check_vals(rrb, vals, cnt, "short persistent", t, op);
+      fail |= CHECK_TREE(rrb);
+      if (trrb != NULL) {
+        trrb = transient_rrb_pop(trrb);
+      }
+      if (cnt == stop) {
+        const RRB *result = transient_to_rrb(trrb);
+        trrb = NULL;
+        fail |= check_vals(result, vals, cnt, "short transient", t, op);
+        fail |= CHECK_TREE(result);
+      }
+    }
+  }
+  return fail;
+}
+
+/**
+ * Uses persistent and transient trees as deques, pushing and popping at both
+ * ends, and mixes in the other operations to make sure they all see the items
+ * in the head. Every step is checked against a plain array, and the original
+ * tree must be left untouched.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+  fail |= check_short_pops(base);
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *original;
+    switch (t % 3) {
+    case 0: original = rrb_slice(relaxed_rrb(base, CATS), 0, SIZE); break;
+    case 1: original = base; break;
+    default: original = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    }
+    uint32_t cnt = rrb_count(original);
+    void **original_vals = GC_MALLOC(sizeof(void *) * cnt);
+    rrb_copy_range(original, 0, cnt, original_vals);
+
+    void **vals = GC_MALLOC(sizeof(void *) * MAX_CNT);
+    void **tmp = GC_MALLOC(sizeof(void *) * MAX_CNT);
+    rrb_copy_range(original, 0, cnt, vals);
+
+    const RRB *rrb = original;
+    TransientRRB *trrb = rrb_to_transient(original);
+    for (uint32_t op = 0; op < OPS; op++) {
+      // Mostly push to the front and pop from the back, as a queue would, but
+      // sometimes the other way around, so the head is drained into the trie
+      // and refilled from it.
+      const uint32_t kind = (uint32_t) rand() % 16;
+      void *val = (void *) ((intptr_t) rand());
+      if (kind < 6) {
+        rrb = rrb_push_front(rrb, val);
+        trrb = transient_rrb_push_front(trrb, val);
+        memmove(&vals[1], &vals[0], cnt * sizeof(void *));
+        vals[0] = val;
+        cnt++;
+      }
+      else if (kind < 9) {
+        if (cnt > 0) {
+          rrb = rrb_pop(rrb);
+          trrb = transient_rrb_pop(trrb);
+          cnt--;
+        }
+      }
+      else if (kind < 11) {
+        if (cnt > 0) {
+          rrb = rrb_pop_front(rrb);
+          trrb = transient_rrb_pop_front(trrb);
+          memmove(&vals[0], &vals[1], (cnt - 1) * sizeof(void *));
+          cnt--;
+        }
+      }
+      else if (kind == 11) {
+        rrb = rrb_push(rrb, val);
+        trrb = transient_rrb_push(trrb, val);
+        vals[cnt++] = val;
+      }
+      else if (kind == 12 && cnt > 0) {
+        const uint32_t index = (uint32_t) rand() % cnt;
+        rrb = rrb_update(rrb, index, val);
+        trrb = transient_rrb_update(trrb, index, val);
+        vals[index] = val;
+      }
+      else if (kind == 13) {
+        const uint32_t index = (uint32_t) rand() % (cnt + 1);
+        rrb = rrb_insert_at(rrb, index, val);
+        trrb = transient_rrb_insert_at(trrb, index, val);
+        memmove(&vals[index + 1], &vals[index], (cnt - index) * sizeof(void *));
+        vals[index] = val;
+        cnt++;
+      }
+      else if (kind == 14 && cnt > 0) {
+        const uint32_t index = (uint32_t) rand() % cnt;
+        rrb = rrb_remove_at(rrb, index);
+        trrb = transient_rrb_remove_at(trrb, index);
+        memmove(&vals[index], &vals[index + 1],
+                (cnt - index - 1) * sizeof(void *));
+        cnt--;
+      }
+      else if (kind == 15 && cnt < MAX_CNT / 2) {
+        // Slice off a few items at both ends, and concatenate with a tree that
+        // has a head of its own.
+        const uint32_t from = (uint32_t) rand() % (cnt / 8 + 1);
+        const uint32_t to = cnt - (uint32_t) rand() % ((cnt - from) / 8 + 1);
+        const uint32_t right_len = (uint32_t) rand() % 80;
+        const RRB *right = rrb_slice(base, 0, (uint32_t) rand() % 50);
+        for (uint32_t i = 0; i < right_len; i++) {
+          right = rrb_push_front(right, (void *) ((intptr_t) i));
+        }
+        const uint32_t right_cnt = rrb_count(right);
+        rrb_copy_range(right, 0, right_cnt, tmp);
+
+        rrb = rrb_concat(rrb_slice(rrb, from, to), right);
+        trrb = transient_rrb_concat(transient_rrb_slice(trrb, from, to),
+                                    right);
+        memmove(&vals[0], &vals[from], (to - from) * sizeof(void *));
+        memcpy(&vals[to - from], tmp, right_cnt * sizeof(void *));
+        cnt = to - from + right_cnt;
+      }
+
+      if (op % 64 == 0 || op == OPS - 1) {
+        fail |= check_vals(rrb, vals, cnt, "persistent", t, op);
+        fail |= CHECK_TREE(rrb);
+        fail |= check_vals((const RRB *) trrb, vals, cnt, "transient", t, op);
+      }
+    }
+
+    const RRB *transient_result = transient_to_rrb(trrb);
+    fail |= check_vals(transient_result, vals, cnt, "transient", t, OPS);
+    fail |= CHECK_TREE(transient_result);
+    fail |= check_vals(original, original_vals, rrb_count(original),
+                       "original", t, OPS);
+    fail |= CHECK_TREE(original);
+  }
+
+  return fail;
+}
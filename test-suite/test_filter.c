@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 200000
+#define CATS 20
+#define TESTS 30
+
+// Keeps the items that are 0 modulo *ctx, so that a modulus of 1 keeps
+// everything and a large one next to nothing.
+static char divisible(void *elt, void *ctx) {
+  return (intptr_t) elt % *(const intptr_t *) ctx == 0;
+}
+
+static int check_part(const RRB *part, const RRB *original, intptr_t modulus,
+                      char keep, const char *name, uint32_t t) {
+  if (CHECK_TREE(part)) {
+    return 1;
+  }
+  const uint32_t cnt = rrb_count(original);
+  const uint32_t part_cnt = rrb_count(part);
+  uint32_t j = 0;
+  for (uint32_t i = 0; i < cnt; i++) {
+    void *elt = rrb_nth(original, i);
+    if (divisible(elt, &modulus) != keep) {
+      continue;
+    }
+    if (j >= part_cnt || rrb_nth(part, j) != elt) {
+      printf("In run %u: %s item %u is wrong or missing.\n", t, name, j);
+      return 1;
+    }
+    j++;
+  }
+  if (j != part_cnt) {
+    printf("In run %u: expected %s size %u, but was %u.\n", t, name, j,
+           part_cnt);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Filters and partitions dense, relaxed and small trees with heads, both
+ * sequentially and in parallel, keeping everything, nothing or a fraction of
+ * the items, and checks the results against the originals.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+  rrb_parallel_set_threads(4);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  const intptr_t moduli[] = {1, 2, 7, 40, RAND_MAX};
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *original;
+    switch (t % 3) {
+    case 0: original = rrb_slice(base, 0, (uint32_t) rand() % SIZE); break;
+    case 1: {
+      original = rrb_create();
+      for (uint32_t i = 0; i < CATS; i++) {
+        const uint32_t from = (uint32_t) rand() % SIZE;
+        const uint32_t to = (uint32_t) (rand() % (SIZE - from)) + from;
+        original = rrb_concat(original, rrb_slice(base, from, to));
+      }
+      break;
+    }
+    default: original = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    }
+    const uint32_t head_len = (uint32_t) rand() % 50;
+    for (uint32_t i = 0; i < head_len; i++) {
+      original = rrb_push_front(original, (void *) ((intptr_t) rand()));
+    }
+    intptr_t modulus = moduli[t % (sizeof(moduli) / sizeof(moduli[0]))];
+
+    const RRB *kept, *rejected;
+    fail |= check_part(rrb_filter(original, divisible, &modulus), original,
+                       modulus, 1, "filtered", t);
+    rrb_partition(original, divisible, &modulus, &kept, &rejected);
+    fail |= check_part(kept, original, modulus, 1, "kept", t);
+    fail |= check_part(rejected, original, modulus, 0, "rejected", t);
+
+    fail |= check_part(rrb_parallel_filter(original, divisible, &modulus),
+                       original, modulus, 1, "parallel filtered", t);
+    rrb_parallel_partition(original, divisible, &modulus, &kept, &rejected);
+    fail |= check_part(kept, original, modulus, 1, "parallel kept", t);
+    fail |= check_part(rejected, original, modulus, 0, "parallel rejected", t);
+  }
+
+  return fail;
+}
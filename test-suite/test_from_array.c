@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define MAX_SIZE 40000
+#define RANDOM_SIZES 50
+
+static int check_from_array(const void **items, uint32_t n) {
+  int fail = 0;
+  const RRB *rrb = rrb_from_array(items, n);
+  fail |= CHECK_TREE(rrb);
+  if (rrb_count(rrb) != n) {
+    printf("rrb_from_array with %u items has size %u.\n", n, rrb_count(rrb));
+    return 1;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    if (rrb_nth(rrb, i) != items[i]) {
+      printf("Built from %u items: expected val at pos %u to be %ld, was %ld.\n",
+             n, i, (intptr_t) items[i], (intptr_t) rrb_nth(rrb, i));
+      fail = 1;
+    }
+  }
+
+  // The tree must be usable as any other: push onto and pop from it.
+  const RRB *pushed = rrb_push(rrb, (void *) ((intptr_t) 42));
+  fail |= CHECK_TREE(pushed);
+  if (rrb_count(pushed) != n + 1 || rrb_peek(pushed) != (void *) 42) {
+    printf("Pushing onto a tree built from %u items failed.\n", n);
+    fail = 1;
+  }
+  if (n > 0) {
+    const RRB *popped = rrb_pop(rrb);
+    fail |= CHECK_TREE(popped);
+    if (rrb_count(popped) != n - 1) {
+      printf("Popping from a tree built from %u items failed.\n", n);
+      fail = 1;
+    }
+  }
+  return fail;
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const void **items = GC_MALLOC(sizeof(void *) * MAX_SIZE);
+  for (uint32_t i = 0; i < MAX_SIZE; i++) {
+    items[i] = (void *) ((intptr_t) rand());
+  }
+
+  // Sizes around the leaf and level boundaries
+  const uint32_t sizes[] = {0, 1, 2, 31, 32, 33, 63, 64, 65, 1024, 1055, 1056,
+                            1057, 1088, 32800, 32801, 32832, 32833};
+  for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    fail |= check_from_array(items, sizes[i]);
+  }
+
+  for (uint32_t i = 0; i < RANDOM_SIZES; i++) {
+    fail |= check_from_array(items, (uint32_t) rand() % MAX_SIZE);
+  }
+
+  return fail;
+}
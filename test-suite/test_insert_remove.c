@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 20
+#define TESTS 60
+#define OPS 1500
+
+/**
+ * Inserts and removes items at random positions, with pushes and pops in
+ * between, in persistent and transient trees. Every step is checked against a
+ * plain array, and the original tree must be left untouched. The first phase
+ * of a run mostly inserts and the second mostly removes, so that nodes are
+ * split and merged all the way up to the root.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *original;
+    switch (t % 3) {
+    case 0: original = relaxed_rrb(base, CATS); break;
+    case 1: original = base; break;
+    default: original = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    }
+    uint32_t cnt = rrb_count(original);
+    void **original_vals = GC_MALLOC(sizeof(void *) * cnt);
+    rrb_copy_range(original, 0, cnt, original_vals);
+
+    void **vals = GC_MALLOC(sizeof(void *) * (cnt + OPS));
+    rrb_copy_range(original, 0, cnt, vals);
+
+    const RRB *rrb = original;
+    TransientRRB *trrb = rrb_to_transient(original);
+    for (uint32_t op = 0; op < OPS; op++) {
+      const int inserting = (op < OPS / 2) ? (rand() % 4 != 0)
+                                           : (rand() % 4 == 0);
+      const uint32_t kind = (uint32_t) rand() % 8;
+      if (inserting) {
+        void *val = (void *) ((intptr_t) rand());
+        if (kind == 0) {
+          rrb = rrb_push(rrb, val);
+          trrb = transient_rrb_push(trrb, val);
+          vals[cnt] = val;
+        }
+        else {
+          const uint32_t index = (uint32_t) rand() % (cnt + 1);
+          rrb = rrb_insert_at(rrb, index, val);
+          trrb = transient_rrb_insert_at(trrb, index, val);
+          memmove(&vals[index + 1], &vals[index],
+                  (cnt - index) * sizeof(void *));
+          vals[index] = val;
+        }
+        cnt++;
+      }
+      else if (cnt > 0) {
+        if (kind == 0) {
+          rrb = rrb_pop(rrb);
+          trrb = transient_rrb_pop(trrb);
+        }
+        else {
+          const uint32_t index = (uint32_t) rand() % cnt;
+          rrb = rrb_remove_at(rrb, index);
+          trrb = transient_rrb_remove_at(trrb, index);
+          memmove(&vals[index], &vals[index + 1],
+                  (cnt - index - 1) * sizeof(void *));
+        }
+        cnt--;
+      }
+
+      if (op % 64 == 0 || op == OPS - 1) {
+        fail |= check_vals(rrb, vals, cnt, "persistent", t, op);
+        fail |= CHECK_TREE(rrb);
+        fail |= check_vals((const RRB *) trrb, vals, cnt, "transient", t, op);
+        fail |= CHECK_TREE((const RRB *) trrb);
+      }
+    }
+
+    if (rrb_insert_at(rrb, cnt + 1, NULL) != NULL ||
+        rrb_remove_at(rrb, cnt) != NULL) {
+      printf("In run %u: out of range index didn't return NULL.\n", t);
+      fail = 1;
+    }
+
+    const RRB *transient_result = transient_to_rrb(trrb);
+    fail |= check_vals(transient_result, vals, cnt, "transient", t, OPS);
+    fail |= CHECK_TREE(transient_result);
+    fail |= check_vals(original, original_vals, rrb_count(original),
+                       "original", t, OPS);
+    fail |= CHECK_TREE(original);
+  }
+
+  return fail;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 40
+#define WALKS 200
+#define WALK_STEPS 500
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+  const RRB *rrb = relaxed_rrb(base, CATS);
+  fail |= CHECK_TREE(rrb);
+  const uint32_t count = rrb_count(rrb);
+
+  // forwards
+  RRBIterator *it = rrb_iterator_create(rrb, 0);
+  for (uint32_t i = 0; i < count; i++) {
+    intptr_t expected = (intptr_t) rrb_nth(rrb, i);
+    intptr_t actual = (intptr_t) rrb_iterator_next(it);
+    if (expected != actual) {
+      printf("Forward iteration: expected val at pos %u to be %ld, was %ld.\n",
+             i, expected, actual);
+      fail = 1;
+    }
+  }
+  if (rrb_iterator_has_next(it)) {
+    puts("Forward iteration: iterator claims to have more elements at the end.");
+    fail = 1;
+  }
+
+  // backwards
+  for (uint32_t i = count; i --> 0;) {
+    intptr_t expected = (intptr_t) rrb_nth(rrb, i);
+    intptr_t actual = (intptr_t) rrb_iterator_prev(it);
+    if (expected != actual) {
+      printf("Backward iteration: expected val at pos %u to be %ld, was %ld.\n",
+             i, expected, actual);
+      fail = 1;
+    }
+  }
+  if (rrb_iterator_has_prev(it)) {
+    puts("Backward iteration: iterator claims to have more elements at the start.");
+    fail = 1;
+  }
+
+  // chunks, forwards and backwards
+  uint32_t pos = 0, len;
+  const void *const *chunk;
+  while ((chunk = rrb_iterator_next_chunk(it, &len)) != NULL) {
+    for (uint32_t j = 0; j < len; j++, pos++) {
+      if (chunk[j] != rrb_nth(rrb, pos)) {
+        printf("Forward chunks: wrong val at pos %u.\n", pos);
+        fail = 1;
+      }
+    }
+  }
+  if (pos != count) {
+    printf("Forward chunks: expected to see %u elements, saw %u.\n", count, pos);
+    fail = 1;
+  }
+  while ((chunk = rrb_iterator_prev_chunk(it, &len)) != NULL) {
+    pos -= len;
+    for (uint32_t j = 0; j < len; j++) {
+      if (chunk[j] != rrb_nth(rrb, pos + j)) {
+        printf("Backward chunks: wrong val at pos %u.\n", pos + j);
+        fail = 1;
+      }
+    }
+  }
+  if (pos != 0) {
+    printf("Backward chunks: ended at pos %u, not 0.\n", pos);
+    fail = 1;
+  }
+
+  // random walks from random starting points
+  for (uint32_t i = 0; i < WALKS; i++) {
+    pos = (uint32_t) rand() % (count + 1);
+    if (i % 2 == 0) {
+      it = rrb_iterator_create(rrb, pos);
+    }
+    else {
+      it = rrb_iterator_seek(it, pos);
+    }
+    for (uint32_t step = 0; step < WALK_STEPS; step++) {
+      if (rand() % 2 == 0 && pos < count) {
+        if (rrb_iterator_next(it) != rrb_nth(rrb, pos)) {
+          printf("Walk %u: next returned wrong val at pos %u.\n", i, pos);
+          fail = 1;
+        }
+        pos++;
+      }
+      else if (pos > 0) {
+        pos--;
+        if (rrb_iterator_prev(it) != rrb_nth(rrb, pos)) {
+          printf("Walk %u: prev returned wrong val at pos %u.\n", i, pos);
+          fail = 1;
+        }
+      }
+      if (rrb_iterator_index(it) != pos) {
+        printf("Walk %u: iterator at index %u, expected %u.\n", i,
+               rrb_iterator_index(it), pos);
+        fail = 1;
+      }
+    }
+  }
+
+  if (rrb_iterator_create(rrb, count + 1) != NULL) {
+    puts("Creating an iterator past the end should return NULL.");
+    fail = 1;
+  }
+
+  return fail;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 200000
+#define CATS 20
+#define TESTS 30
+
+typedef struct {
+  const RRB *original;
+  uint32_t next;
+  int out_of_order;
+} Order;
+
+static void* triple(void *elt, void *ctx) {
+  (void) ctx;
+  return (void *) (3 * (intptr_t) elt + 1);
+}
+
+// Checks that rrb_map calls fn on the items from left to right.
+static void* triple_in_order(void *elt, void *ctx) {
+  Order *order = ctx;
+  if (rrb_nth(order->original, order->next++) != elt) {
+    order->out_of_order = 1;
+  }
+  return triple(elt, NULL);
+}
+
+static int check_mapped(const RRB *mapped, const RRB *original,
+                        const char *name, uint32_t t) {
+  const uint32_t cnt = rrb_count(original);
+  if (rrb_count(mapped) != cnt) {
+    printf("In run %u: expected %s size %u, but was %u.\n", t, name, cnt,
+           rrb_count(mapped));
+    return 1;
+  }
+  if (CHECK_TREE(mapped)) {
+    return 1;
+  }
+  for (uint32_t i = 0; i < cnt; i++) {
+    void *expected = triple(rrb_nth(original, i), NULL);
+    if (rrb_nth(mapped, i) != expected) {
+      printf("In run %u: expected %s val at pos %u to be %ld, was %ld.\n", t,
+             name, i, (intptr_t) expected, (intptr_t) rrb_nth(mapped, i));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Maps dense, relaxed and small trees with heads, both sequentially and in
+ * parallel, and checks the results against the originals.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+  rrb_parallel_set_threads(4);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *original;
+    switch (t % 3) {
+    case 0: original = rrb_slice(base, 0, (uint32_t) rand() % SIZE); break;
+    case 1: {
+      original = rrb_create();
+      for (uint32_t i = 0; i < CATS; i++) {
+        const uint32_t from = (uint32_t) rand() % SIZE;
+        const uint32_t to = (uint32_t) (rand() % (SIZE - from)) + from;
+        original = rrb_concat(original, rrb_slice(base, from, to));
+      }
+      break;
+    }
+    default: original = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    }
+    const uint32_t head_len = (uint32_t) rand() % 50;
+    for (uint32_t i = 0; i < head_len; i++) {
+      original = rrb_push_front(original, (void *) ((intptr_t) rand()));
+    }
+
+    Order order = {.original = original, .next = 0, .out_of_order = 0};
+    const RRB *mapped = rrb_map(original, triple_in_order, &order);
+    if (order.out_of_order || order.next != rrb_count(original)) {
+      printf("In run %u: rrb_map didn't visit the items in order.\n", t);
+      fail = 1;
+    }
+    fail |= check_mapped(mapped, original, "mapped", t);
+    fail |= check_mapped(rrb_parallel_map(original, triple, NULL), original,
+                         "parallel mapped", t);
+  }
+
+  const RRB *empty = rrb_create();
+  if (rrb_count(rrb_map(empty, triple, NULL)) != 0 ||
+      rrb_count(rrb_parallel_map(empty, triple, NULL)) != 0) {
+    printf("Mapping an empty tree gave a non-empty one.\n");
+    fail = 1;
+  }
+
+  return fail;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 40
+#define BATCHES 200
+#define MAX_BATCH 2000
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  uint32_t *indices = GC_MALLOC_ATOMIC(sizeof(uint32_t) * MAX_BATCH);
+  void **out = GC_MALLOC(sizeof(void *) * MAX_BATCH);
+
+  for (uint32_t b = 0; b < BATCHES; b++) {
+    // alternate between relaxed and dense trees
+    const RRB *rrb = (b % 2 == 0) ? relaxed_rrb(base, CATS) : base;
+    const uint32_t count = rrb_count(rrb);
+    const uint32_t n = (uint32_t) rand() % MAX_BATCH;
+    for (uint32_t i = 0; i < n; i++) {
+      // a few out of bounds indices as well
+      indices[i] = (uint32_t) rand() % (count + 10);
+    }
+    if (b % 4 < 2) { // sorted input
+      for (uint32_t i = 1; i < n; i++) {
+        uint32_t val = indices[i], j = i;
+        for (; j > 0 && indices[j-1] > val; j--) {
+          indices[j] = indices[j-1];
+        }
+        indices[j] = val;
+      }
+    }
+    rrb_nth_many(rrb, indices, n, out);
+    for (uint32_t i = 0; i < n; i++) {
+      if (out[i] != rrb_nth(rrb, indices[i])) {
+        printf("Batch %u: expected val at pos %u to be %ld, was %ld.\n", b,
+               indices[i], (intptr_t) rrb_nth(rrb, indices[i]),
+               (intptr_t) out[i]);
+        fail = 1;
+      }
+    }
+  }
+
+  return fail;
+}
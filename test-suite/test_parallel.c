@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 400000
+#define CATS 20
+
+// Items are consecutive numbers, so that we can check that every one is
+// visited exactly once, and that results are combined in order.
+typedef struct {
+  intptr_t from;
+  intptr_t to;
+  char ordered;
+} Range;
+
+static void* range_reduce(void *acc, void *elt, void *ctx) {
+  (void) ctx;
+  Range *range = acc;
+  if (range == NULL) {
+    range = GC_MALLOC(sizeof(Range));
+    range->from = range->to = (intptr_t) elt;
+    range->ordered = 1;
+  }
+  range->ordered &= (range->to == (intptr_t) elt);
+  range->to = (intptr_t) elt + 1;
+  return range;
+}
+
+static void* range_combine(void *left, void *right, void *ctx) {
+  (void) ctx;
+  const Range *l = left, *r = right;
+  if (l == NULL || r == NULL) {
+    return (l == NULL) ? right : left;
+  }
+  Range *range = GC_MALLOC(sizeof(Range));
+  range->from = l->from;
+  range->to = r->to;
+  range->ordered = l->ordered && r->ordered && l->to == r->from;
+  return range;
+}
+
+typedef struct {
+  uint32_t *seen;
+  intptr_t first;
+} Seen;
+
+static void mark(void *elt, uint32_t index, void *ctx) {
+  Seen *s = ctx;
+  s->seen[index] += ((intptr_t) elt - s->first == (intptr_t) index) ? 1 : 100;
+}
+
+static const RRB *nested_rrb;
+
+// Runs a parallel reduction from within a parallel for_each.
+static void nested(void *elt, uint32_t index, void *ctx) {
+  (void) elt;
+  int *fail = ctx;
+  if (index % 50000 == 0) {
+    const Range *range = rrb_parallel_reduce(nested_rrb, range_reduce,
+                                             range_combine, NULL, NULL);
+    if (range == NULL || !range->ordered ||
+        range->to - range->from != (intptr_t) rrb_count(nested_rrb)) {
+      printf("Nested reduction at %u gave the wrong result.\n", index);
+      *fail = 1;
+    }
+  }
+}
+
+static int check(const RRB *rrb, const char *name) {
+  int fail = 0;
+  const uint32_t cnt = rrb_count(rrb);
+  Seen s = {.seen = GC_MALLOC_ATOMIC(sizeof(uint32_t) * (cnt + 1)),
+            .first = (cnt == 0) ? 0 : (intptr_t) rrb_nth(rrb, 0)};
+  for (uint32_t i = 0; i < cnt; i++) {
+    s.seen[i] = 0;
+  }
+  rrb_parallel_for_each(rrb, mark, &s);
+  for (uint32_t i = 0; i < cnt; i++) {
+    if (s.seen[i] != 1) {
+      printf("%s: item %u was visited %u times, or with the wrong index.\n",
+             name, i, s.seen[i]);
+      fail = 1;
+      break;
+    }
+  }
+
+  const Range *range = rrb_parallel_reduce(rrb, range_reduce, range_combine,
+                                           NULL, NULL);
+  if (cnt == 0) {
+    if (range != NULL) {
+      printf("%s: reducing an empty tree didn't give init.\n", name);
+      fail = 1;
+    }
+  }
+  else if (range == NULL || !range->ordered ||
+           range->from != s.first ||
+           range->to - range->from != (intptr_t) cnt) {
+    printf("%s: the reduction was out of order or incomplete.\n", name);
+    fail = 1;
+  }
+  return fail;
+}
+
+/**
+ * Runs parallel for_each and reduce on dense, relaxed, small and empty trees,
+ * with and without heads, and from within another parallel operation.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+  rrb_parallel_set_threads(4);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) i));
+  }
+  fail |= check(base, "dense");
+  fail |= check(rrb_create(), "empty");
+  fail |= check(rrb_slice(base, 0, 1000), "small");
+
+  // Relaxed, and with a head whose items come right before the rest.
+  const uint32_t from = (uint32_t) rand() % 1000 + 100;
+  const RRB *relaxed = rrb_slice(base, from, from + 1);
+  for (uint32_t i = 0; i < CATS; i++) {
+    const uint32_t start = from + rrb_count(relaxed);
+    const uint32_t len = (uint32_t) rand() % ((SIZE - start) / CATS);
+    relaxed = rrb_concat(relaxed, rrb_slice(base, start, start + len));
+  }
+  for (uint32_t i = from; i --> from - 100;) {
+    relaxed = rrb_push_front(relaxed, (void *) ((intptr_t) i));
+  }
+  fail |= check(relaxed, "relaxed");
+
+  nested_rrb = relaxed;
+  rrb_parallel_for_each(base, nested, &fail);
+
+  return fail;
+}
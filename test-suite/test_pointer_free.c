@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 100000
+
+static void* twice(void *elt, void *ctx) {
+  (void) ctx;
+  return (void *) (2 * (intptr_t) elt);
+}
+
+static char is_even(void *elt, void *ctx) {
+  (void) ctx;
+  return ((intptr_t) elt & 1) == 0;
+}
+
+static int descending(void *a, void *b, void *ctx) {
+  (void) ctx;
+  return ((intptr_t) a < (intptr_t) b) - ((intptr_t) a > (intptr_t) b);
+}
+
+// Callbacks make their own RRB-trees, which hold pointers.
+static int callback_fail = 0;
+
+static void* push_in_callback(void *elt, void *ctx) {
+  const RRB **list = ctx;
+  const AllocCounts before = alloc_counts();
+  *list = rrb_push(*list, list);
+  if (alloc_counts_since(before).atomic_allocs != 0) {
+    callback_fail = 1;
+  }
+  return elt;
+}
+
+static const RRB* op_push(const RRB *rrb) {
+  for (intptr_t i = 0; i < 100; i++) {
+    rrb = rrb_push(rrb, (void *) i);
+  }
+  return rrb;
+}
+
+static const RRB* op_update(const RRB *rrb) {
+  for (uint32_t i = 0; i < rrb_count(rrb); i += 997) {
+    rrb = rrb_update(rrb, i, (void *) (intptr_t) i);
+  }
+  return rrb;
+}
+
+static const RRB* op_pop(const RRB *rrb) {
+  for (uint32_t i = 0; i < 100; i++) {
+    rrb = rrb_pop(rrb);
+  }
+  return rrb;
+}
+
+static const RRB* op_slice(const RRB *rrb) {
+  return rrb_slice(rrb, 1001, rrb_count(rrb) - 999);
+}
+
+static const RRB* op_concat(const RRB *rrb) {
+  return rrb_concat(rrb_slice(rrb, 0, 3333), rrb_slice(rrb, 77, 60000));
+}
+
+static const RRB* op_insert_remove(const RRB *rrb) {
+  for (uint32_t i = 0; i < 50; i++) {
+    rrb = rrb_insert_at(rrb, i * 1013, (void *) (intptr_t) i);
+    rrb = rrb_remove_at(rrb, i * 2039);
+  }
+  return rrb;
+}
+
+static const RRB* op_front(const RRB *rrb) {
+  for (intptr_t i = 0; i < 100; i++) {
+    rrb = rrb_push_front(rrb, (void *) i);
+  }
+  for (uint32_t i = 0; i < 40; i++) {
+    rrb = rrb_pop_front(rrb);
+  }
+  return rrb;
+}
+
+static const RRB* op_splice(const RRB *rrb) {
+  return rrb_splice(rrb, 5000, 7000, rrb_slice(rrb, 100, 20000));
+}
+
+static const RRB* op_map(const RRB *rrb) {
+  return rrb_map(rrb, twice, NULL);
+}
+
+static const RRB* op_filter(const RRB *rrb) {
+  return rrb_filter(rrb, is_even, NULL);
+}
+
+static const RRB* op_sort(const RRB *rrb) {
+  return rrb_sort(rrb, descending, NULL);
+}
+
+static const RRB* op_parallel_map(const RRB *rrb) {
+  return rrb_parallel_map(rrb, twice, NULL);
+}
+
+static const RRB* op_transient(const RRB *rrb) {
+  TransientRRB *trrb = rrb_to_transient(rrb);
+  for (uint32_t i = 0; i < rrb_count(rrb); i += 101) {
+    trrb = transient_rrb_update(trrb, i, NULL);
+  }
+  for (intptr_t i = 0; i < 1000; i++) {
+    trrb = transient_rrb_push(trrb, (void *) i);
+  }
+  trrb = transient_rrb_concat(trrb, rrb_slice(rrb, 10, 5000));
+  return transient_to_rrb(trrb);
+}
+
+typedef const RRB* (*Op)(const RRB *rrb);
+
+static const struct {
+  const char *name;
+  Op op;
+} ops[] = {
+  {"push", op_push}, {"update", op_update}, {"pop", op_pop},
+  {"slice", op_slice}, {"concat", op_concat},
+  {"insert/remove", op_insert_remove}, {"front", op_front},
+  {"splice", op_splice}, {"map", op_map}, {"filter", op_filter},
+  {"sort", op_sort}, {"parallel map", op_parallel_map},
+  {"transient", op_transient}
+};
+
+static int check_same(const char *name, const RRB *expected,
+                      const RRB *actual) {
+  if (CHECK_TREE(actual)) {
+    printf("%s: the tree is invalid.\n", name);
+    return 1;
+  }
+  if (rrb_count(expected) != rrb_count(actual)) {
+    printf("%s: expected size %u, but was %u.\n", name,
+           rrb_count(expected), rrb_count(actual));
+    return 1;
+  }
+  for (uint32_t i = 0; i < rrb_count(expected); i++) {
+    if (rrb_nth(expected, i) != rrb_nth(actual, i)) {
+      printf("%s: wrong item at index %u.\n", name, i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Runs op on a tree holding pointers and on a pointer free copy of it. Both
+// make the same allocations, but the leaves made for the pointer free tree are
+// atomic. So are those the results make later on.
+static int check_op(const char *name, Op op, const RRB *plain,
+                    const RRB *pointer_free) {
+  AllocCounts before = alloc_counts();
+  const RRB *plain_result = op(plain);
+  const AllocCounts plain_counts = alloc_counts_since(before);
+  before = alloc_counts();
+  const RRB *pointer_free_result = op(pointer_free);
+  const AllocCounts pointer_free_counts = alloc_counts_since(before);
+
+  if (check_same(name, plain_result, pointer_free_result)) {
+    return 1;
+  }
+  if (plain_counts.allocs + plain_counts.atomic_allocs
+      != pointer_free_counts.allocs + pointer_free_counts.atomic_allocs
+      || plain_counts.bytes + plain_counts.atomic_bytes
+      != pointer_free_counts.bytes + pointer_free_counts.atomic_bytes) {
+    printf("%s: the pointer free tree made other allocations.\n", name);
+    return 1;
+  }
+  if (pointer_free_counts.atomic_bytes <= plain_counts.atomic_bytes) {
+    printf("%s: the pointer free tree made no atomic leaves.\n", name);
+    return 1;
+  }
+
+  before = alloc_counts();
+  op_push(plain_result);
+  const AllocCounts plain_after = alloc_counts_since(before);
+  before = alloc_counts();
+  op_push(pointer_free_result);
+  const AllocCounts pointer_free_after = alloc_counts_since(before);
+  if (pointer_free_after.atomic_bytes <= plain_after.atomic_bytes) {
+    printf("%s: the result isn't pointer free.\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+  rrb_set_allocator(counting_allocator());
+
+  int fail = 0;
+
+  TransientRRB *plain_trrb = rrb_to_transient(rrb_create());
+  TransientRRB *pointer_free_trrb = rrb_to_transient(rrb_create_pointer_free());
+  for (uint32_t i = 0; i < SIZE; i++) {
+    void *val = (void *) ((intptr_t) rand());
+    plain_trrb = transient_rrb_push(plain_trrb, val);
+    pointer_free_trrb = transient_rrb_push(pointer_free_trrb, val);
+  }
+  const RRB *plain = transient_to_rrb(plain_trrb);
+  const RRB *pointer_free = transient_to_rrb(pointer_free_trrb);
+  fail |= check_same("build", plain, pointer_free);
+
+  for (uint32_t i = 0; i < sizeof(ops) / sizeof(ops[0]) && !fail; i++) {
+    fail |= check_op(ops[i].name, ops[i].op, plain, pointer_free);
+  }
+
+  // Combined with a tree holding pointers, the result holds pointers as well.
+  AllocCounts before = alloc_counts();
+  op_push(rrb_concat(pointer_free, plain));
+  const AllocCounts mixed = alloc_counts_since(before);
+  before = alloc_counts();
+  op_push(rrb_concat(plain, plain));
+  const AllocCounts both_plain = alloc_counts_since(before);
+  if (mixed.atomic_bytes != both_plain.atomic_bytes) {
+    printf("Concatenating a tree holding pointers made atomic leaves.\n");
+    fail = 1;
+  }
+
+  // So does a pointer free transient, once a tree holding pointers is
+  // concatenated or spliced into it.
+  for (int splice = 0; splice < 2; splice++) {
+    AllocCounts counts[2];
+    for (int i = 0; i < 2; i++) {
+      TransientRRB *trrb = rrb_to_transient(i == 0 ? plain : pointer_free);
+      trrb = transient_rrb_push(trrb, NULL);
+      before = alloc_counts();
+      trrb = splice ? transient_rrb_splice(trrb, 500, 600, plain)
+                    : transient_rrb_concat(trrb, plain);
+      for (intptr_t j = 0; j < 1000; j++) {
+        trrb = transient_rrb_push(trrb, (void *) j);
+      }
+      trrb = transient_rrb_update(trrb, 3, NULL);
+      counts[i] = alloc_counts_since(before);
+      fail |= CHECK_TREE(transient_to_rrb(trrb));
+    }
+    if (counts[0].atomic_bytes != counts[1].atomic_bytes) {
+      printf("A transient %s with a tree holding pointers made atomic "
+             "leaves.\n", splice ? "splice" : "concatenation");
+      fail = 1;
+    }
+  }
+
+  const RRB *list = rrb_create();
+  rrb_map(rrb_slice(pointer_free, 0, 100), push_in_callback, &list);
+  if (callback_fail || rrb_count(list) != 100) {
+    printf("A callback made atomic leaves for its own tree.\n");
+    fail = 1;
+  }
+
+  rrb_set_allocator(NULL);
+  return fail;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 50000
+#define CATS 20
+#define PARTS 7
+#define PARALLEL_SIZE 200000
+
+// Replaces the tree in var with the result of expr, releasing the old one.
+#define STEP(var, expr) do {                    \
+    const RRB *next_ = (expr);                  \
+    rrb_release(var);                           \
+    var = next_;                                \
+  } while (0)
+
+static int check_live(const char *name) {
+  long live = alloc_counts().live;
+  if (live != 0) {
+    printf("%s: %ld allocations weren't freed.\n", name, live);
+    return 1;
+  }
+  return 0;
+}
+
+static int check_items(const char *name, const RRB *rrb,
+                       const intptr_t *vals, uint32_t n) {
+  if (CHECK_TREE(rrb)) {
+    printf("%s: the tree is invalid.\n", name);
+    return 1;
+  }
+  if (rrb_count(rrb) != n) {
+    printf("%s: expected size %u, but was %u.\n", name, n, rrb_count(rrb));
+    return 1;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    if ((intptr_t) rrb_nth(rrb, i) != vals[i]) {
+      printf("%s: wrong item at index %u.\n", name, i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void* twice(void *elt, void *ctx) {
+  (void) ctx;
+  return (void *) (2 * (intptr_t) elt);
+}
+
+// Creates a tree for each item, to check that callbacks can use the library.
+static void* singleton(void *elt, void *ctx) {
+  (void) ctx;
+  const RRB *empty = rrb_create();
+  const RRB *rrb = rrb_push(empty, elt);
+  rrb_release(empty);
+  return (void *) rrb;
+}
+
+static char is_even(void *elt, void *ctx) {
+  (void) ctx;
+  return ((intptr_t) elt) % 2 == 0;
+}
+
+static int asc_cmp(void *a, void *b, void *ctx) {
+  (void) ctx;
+  const intptr_t x = (intptr_t) a, y = (intptr_t) b;
+  return (x > y) - (x < y);
+}
+
+// Builds trees in different ways, releasing every intermediate tree.
+static int check_persistent(const intptr_t *vals) {
+  int fail = 0;
+
+  const RRB *rrb = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    STEP(rrb, rrb_push(rrb, (void *) vals[i]));
+  }
+  fail |= check_items("push", rrb, vals, SIZE);
+
+  const RRB *cat = rrb_create();
+  for (uint32_t from = 0; from < SIZE;) {
+    uint32_t to = from + (uint32_t) rand() % (SIZE / CATS) + 1;
+    to = (to < SIZE) ? to : SIZE;
+    const RRB *slice = rrb_slice(rrb, from, to);
+    STEP(cat, rrb_concat(cat, slice));
+    rrb_release(slice);
+    from = to;
+  }
+  fail |= check_items("concat", cat, vals, SIZE);
+
+  // Each of these leaves cat as it was, but shares parts of it.
+  const uint32_t index = (uint32_t) rand() % SIZE;
+  const RRB *modified = rrb_update(cat, index, (void *) -1);
+  if (rrb_nth(modified, index) != (void *) -1) {
+    printf("update: the item wasn't updated.\n");
+    fail = 1;
+  }
+  STEP(modified, rrb_update(modified, index, (void *) vals[index]));
+  STEP(modified, rrb_insert_at(modified, index, (void *) -1));
+  STEP(modified, rrb_remove_at(modified, index));
+  STEP(modified, rrb_push_front(modified, (void *) -1));
+  STEP(modified, rrb_pop_front(modified));
+  STEP(modified, rrb_write_range(modified, 0, (const void **) vals, 100));
+  const uint32_t indices[] = {0, index, SIZE - 1};
+  const void *elts[] = {(void *) vals[0], (void *) vals[index],
+                        (void *) vals[SIZE - 1]};
+  STEP(modified, rrb_update_many(modified, indices, elts, 3));
+  const RRB *insert = rrb_slice(cat, index / 2, index);
+  STEP(modified, rrb_splice(modified, index / 2, index, insert));
+  rrb_release(insert);
+  fail |= check_items("modifications", modified, vals, SIZE);
+  fail |= check_items("original", cat, vals, SIZE);
+
+  const RRB *parts[PARTS];
+  rrb_split_n(cat, PARTS, parts);
+  const RRB *joined = rrb_concat_many(parts, PARTS);
+  for (uint32_t i = 0; i < PARTS; i++) {
+    rrb_release(parts[i]);
+  }
+  fail |= check_items("split_n", joined, vals, SIZE);
+
+  const RRB *from_array = rrb_from_array((const void **) vals, SIZE);
+  fail |= check_items("from_array", from_array, vals, SIZE);
+
+  // Shared references stay valid until the last one is released.
+  const RRB *retained = rrb_retain(from_array);
+  rrb_release(from_array);
+  fail |= check_items("retain", retained, vals, SIZE);
+  while (rrb_count(retained) > 0) {
+    STEP(retained, rrb_pop(retained));
+  }
+
+  RRBIterator *it = rrb_iterator_create(cat, SIZE / 2);
+  if (rrb_iterator_next(it) != (void *) vals[SIZE / 2]) {
+    printf("iterator: wrong item.\n");
+    fail = 1;
+  }
+  rrb_iterator_destroy(it);
+  RRBCursor *cursor = rrb_cursor_create(cat);
+  if (rrb_cursor_nth(cursor, index) != (void *) vals[index]) {
+    printf("cursor: wrong item.\n");
+    fail = 1;
+  }
+  rrb_cursor_destroy(cursor);
+
+  rrb_release(rrb);
+  rrb_release(cat);
+  rrb_release(modified);
+  rrb_release(joined);
+  rrb_release(retained);
+  fail |= check_live("persistent");
+  return fail;
+}
+
+// Transients keep the trees they were made from alive until they are turned
+// into persistent trees.
+static int check_transient(const intptr_t *vals) {
+  int fail = 0;
+
+  const RRB *source = rrb_from_array((const void **) vals, SIZE / 2);
+  TransientRRB *trrb = rrb_to_transient(source);
+  rrb_release(source);
+  trrb = transient_rrb_push_many(trrb, (const void **) &vals[SIZE / 2],
+                                 SIZE - SIZE / 2);
+  trrb = transient_rrb_update(trrb, 0, (void *) -1);
+  trrb = transient_rrb_update(trrb, 0, (void *) vals[0]);
+  trrb = transient_rrb_insert_at(trrb, SIZE / 3, (void *) -1);
+  trrb = transient_rrb_remove_at(trrb, SIZE / 3);
+  trrb = transient_rrb_push_front(trrb, (void *) -1);
+  trrb = transient_rrb_pop_front(trrb);
+  trrb = transient_rrb_push(trrb, (void *) -1);
+  trrb = transient_rrb_pop(trrb);
+  RRBCursor *cursor = transient_rrb_cursor_create(trrb);
+  trrb = transient_rrb_cursor_update(cursor, SIZE / 4, (void *) vals[SIZE / 4]);
+  rrb_cursor_destroy(cursor);
+
+  const RRB *tail = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    STEP(tail, rrb_push(tail, (void *) vals[i]));
+  }
+  trrb = transient_rrb_concat(trrb, tail);
+  rrb_release(tail);
+  // Rotates the second half to the front, then back again.
+  trrb = transient_rrb_slice(trrb, SIZE / 2, SIZE + SIZE / 2);
+  const RRB *insert = rrb_from_array((const void **) vals, SIZE / 2);
+  trrb = transient_rrb_splice(trrb, 0, 0, insert);
+  rrb_release(insert);
+  trrb = transient_rrb_slice(trrb, 0, SIZE);
+
+  const RRB *rrb = transient_to_rrb(trrb);
+  fail |= check_items("transient", rrb, vals, SIZE);
+
+  // The nodes left in an arena are freed with it.
+  trrb = rrb_to_transient_arena(rrb);
+  rrb_release(rrb);
+  for (uint32_t i = 0; i < SIZE; i++) {
+    trrb = transient_rrb_update(trrb, i, (void *) -1);
+    trrb = transient_rrb_update(trrb, i, (void *) vals[i]);
+  }
+  trrb = transient_rrb_insert_at(trrb, SIZE / 3, (void *) -1);
+  insert = rrb_from_array((const void **) vals, SIZE / 2);
+  trrb = transient_rrb_splice(trrb, SIZE / 3, SIZE / 3 + 1, insert);
+  rrb_release(insert);
+  trrb = transient_rrb_remove_at(trrb, 0);
+  trrb = transient_rrb_slice(trrb, SIZE / 3 - 1, SIZE / 3 - 1 + SIZE / 2);
+  rrb = transient_to_rrb(trrb);
+  fail |= check_items("transient arena", rrb, vals, SIZE / 2);
+  rrb_release(rrb);
+  fail |= check_live("transient");
+  return fail;
+}
+
+static int check_parallel(void) {
+  int fail = 0;
+  intptr_t *vals = malloc(sizeof(intptr_t) * PARALLEL_SIZE);
+  intptr_t *expected = malloc(sizeof(intptr_t) * PARALLEL_SIZE);
+  for (uint32_t i = 0; i < PARALLEL_SIZE; i++) {
+    vals[i] = rand();
+  }
+  const RRB *rrb = rrb_from_array((const void **) vals, PARALLEL_SIZE);
+
+  for (uint32_t i = 0; i < PARALLEL_SIZE; i++) {
+    expected[i] = 2 * vals[i];
+  }
+  const RRB *mapped = rrb_parallel_map(rrb, twice, NULL);
+  fail |= check_items("parallel_map", mapped, expected, PARALLEL_SIZE);
+  rrb_release(mapped);
+
+  uint32_t evens = 0;
+  for (uint32_t i = 0; i < PARALLEL_SIZE; i++) {
+    if (vals[i] % 2 == 0) {
+      expected[evens++] = vals[i];
+    }
+  }
+  const RRB *filtered = rrb_parallel_filter(rrb, is_even, NULL);
+  fail |= check_items("parallel_filter", filtered, expected, evens);
+  rrb_release(filtered);
+  const RRB *kept, *rejected;
+  rrb_parallel_partition(rrb, is_even, NULL, &kept, &rejected);
+  fail |= check_items("parallel_partition", kept, expected, evens);
+  if (rrb_count(rejected) != PARALLEL_SIZE - evens) {
+    printf("parallel_partition: wrong number of rejected items.\n");
+    fail = 1;
+  }
+  rrb_release(kept);
+  rrb_release(rejected);
+
+  const RRB *sorted = rrb_parallel_sort(rrb, asc_cmp, NULL);
+  for (uint32_t i = 1; i < PARALLEL_SIZE; i++) {
+    if (rrb_nth(sorted, i - 1) > rrb_nth(sorted, i)) {
+      printf("parallel_sort: items %u and %u are out of order.\n", i - 1, i);
+      fail = 1;
+      break;
+    }
+  }
+  rrb_release(sorted);
+
+  // The trees made by the callbacks outlive the call, and belong to the
+  // caller afterwards.
+  const RRB *trees = rrb_parallel_map(rrb, singleton, NULL);
+  for (uint32_t i = 0; i < PARALLEL_SIZE; i++) {
+    const RRB *tree = rrb_nth(trees, i);
+    if (rrb_count(tree) != 1 || (intptr_t) rrb_nth(tree, 0) != vals[i]) {
+      printf("parallel_map: the tree made for index %u is wrong.\n", i);
+      fail = 1;
+      break;
+    }
+  }
+  for (uint32_t i = 0; i < PARALLEL_SIZE; i++) {
+    rrb_release(rrb_nth(trees, i));
+  }
+  rrb_release(trees);
+
+  rrb_release(rrb);
+  free(vals);
+  free(expected);
+  fail |= check_live("parallel");
+  return fail;
+}
+
+/**
+ * Counts the allocations made by the library, and checks that every one of
+ * them is freed once the trees using it are released. Only built when the
+ * library uses reference counting.
+ */
+int main(int argc, char *argv[]) {
+  setup_rand(argc == 2 ? argv[1] : NULL);
+  rrb_parallel_set_threads(4);
+  rrb_set_allocator(counting_allocator());
+
+  int fail = 0;
+  intptr_t *vals = malloc(sizeof(intptr_t) * SIZE);
+  for (uint32_t i = 0; i < SIZE; i++) {
+    vals[i] = rand();
+  }
+  fail |= check_persistent(vals);
+  fail |= check_transient(vals);
+  fail |= check_parallel();
+  free(vals);
+
+  return fail;
+}
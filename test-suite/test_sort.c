@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 300000
+#define CATS 20
+#define TESTS 40
+// Items are key << POS_BITS | position in the original tree. The comparator
+// only looks at the key, so a stable sort orders the items by their value.
+#define POS_BITS 20
+#define KEYS 1000
+
+static int key_cmp(void *a, void *b, void *ctx) {
+  (void) ctx;
+  const intptr_t x = (intptr_t) a >> POS_BITS, y = (intptr_t) b >> POS_BITS;
+  return (x > y) - (x < y);
+}
+
+static int check_sorted(const RRB *sorted, uint32_t cnt, const char *name,
+                        uint32_t t) {
+  if (rrb_count(sorted) != cnt) {
+    printf("In run %u: expected %s size %u, but was %u.\n", t, name, cnt,
+           rrb_count(sorted));
+    return 1;
+  }
+  if (CHECK_TREE(sorted)) {
+    return 1;
+  }
+  char *seen = GC_MALLOC_ATOMIC(cnt + 1);
+  for (uint32_t i = 0; i < cnt; i++) {
+    seen[i] = 0;
+  }
+  for (uint32_t i = 0; i < cnt; i++) {
+    const intptr_t val = (intptr_t) rrb_nth(sorted, i);
+    const uint32_t pos = (uint32_t) (val & ((1 << POS_BITS) - 1));
+    if (i > 0 && (intptr_t) rrb_nth(sorted, i - 1) >= val) {
+      printf("In run %u: %s items %u and %u are out of order.\n", t, name,
+             i - 1, i);
+      return 1;
+    }
+    if (pos >= cnt || seen[pos]) {
+      printf("In run %u: %s item %u is not from the original.\n", t, name, i);
+      return 1;
+    }
+    seen[pos] = 1;
+  }
+  return 0;
+}
+
+/**
+ * Sorts dense, relaxed and small trees with heads, both sequentially and in
+ * parallel, and checks that the results are stable permutations of the
+ * originals.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+  rrb_parallel_set_threads(4);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand() % KEYS));
+  }
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *keys;
+    switch (t % 4) {
+    case 0: keys = rrb_slice(base, 0, (uint32_t) rand() % SIZE); break;
+    case 1: {
+      keys = rrb_create();
+      for (uint32_t i = 0; i < CATS; i++) {
+        const uint32_t from = (uint32_t) rand() % SIZE;
+        const uint32_t to = (uint32_t) (rand() % (SIZE - from)) + from;
+        keys = rrb_concat(keys, rrb_slice(base, from, to));
+      }
+      keys = rrb_slice(keys, 0, SIZE);
+      break;
+    }
+    // Around the leaf and chunk sizes.
+    case 2: keys = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    default:
+      keys = rrb_slice(base, 0, (1 << 13) * (t % 5) + (uint32_t) rand() % 3);
+      break;
+    }
+    const uint32_t head_len = (uint32_t) rand() % 50;
+    for (uint32_t i = 0; i < head_len; i++) {
+      keys = rrb_push_front(keys, (void *) ((intptr_t) rand() % KEYS));
+    }
+
+    const uint32_t cnt = rrb_count(keys);
+    TransientRRB *trrb = rrb_to_transient(rrb_create());
+    for (uint32_t i = 0; i < cnt; i++) {
+      const intptr_t key = (intptr_t) rrb_nth(keys, i);
+      trrb = transient_rrb_push(trrb, (void *) (key << POS_BITS | i));
+    }
+    const RRB *original = transient_to_rrb(trrb);
+
+    fail |= check_sorted(rrb_sort(original, key_cmp, NULL), cnt, "sorted", t);
+    fail |= check_sorted(rrb_parallel_sort(original, key_cmp, NULL), cnt,
+                         "parallel sorted", t);
+  }
+
+  return fail;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 20
+#define TESTS 60
+#define OPS 200
+#define MAX_CNT (SIZE * 3)
+
+/**
+ * Replaces random ranges with random trees, both small and large, relaxed and
+ * with items in their heads, in persistent and transient trees. Every step is
+ * checked against a plain array, and neither the original tree nor the
+ * inserted ones may be modified.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+  void **base_vals = GC_MALLOC(sizeof(void *) * SIZE);
+  rrb_copy_range(base, 0, SIZE, base_vals);
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *original;
+    switch (t % 3) {
+    case 0: original = rrb_slice(relaxed_rrb(base, CATS), 0, SIZE); break;
+    case 1: original = base; break;
+    default: original = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    }
+    uint32_t cnt = rrb_count(original);
+    void **original_vals = GC_MALLOC(sizeof(void *) * cnt);
+    rrb_copy_range(original, 0, cnt, original_vals);
+
+    void **vals = GC_MALLOC(sizeof(void *) * MAX_CNT);
+    void **insert_vals = GC_MALLOC(sizeof(void *) * MAX_CNT);
+    rrb_copy_range(original, 0, cnt, vals);
+
+    const RRB *rrb = original;
+    TransientRRB *trrb = rrb_to_transient(original);
+    for (uint32_t op = 0; op < OPS; op++) {
+      const uint32_t from = (uint32_t) rand() % (cnt + 1);
+      uint32_t to = from;
+      const RRB *insert;
+      switch (rand() % 4) {
+      case 0: // a small edit
+        to += (uint32_t) rand() % ((cnt - from < 20 ? cnt - from : 20) + 1);
+        insert = rrb_slice(base, 0, (uint32_t) rand() % 12);
+        break;
+      case 1: // a removal
+        to += (uint32_t) rand() % (cnt - from + 1);
+        insert = rrb_create();
+        break;
+      case 2: { // a relaxed tree with a head
+        to += (uint32_t) rand() % (cnt - from + 1);
+        insert = rrb_slice(relaxed_rrb(base, CATS), 0, (uint32_t) rand() % SIZE);
+        const uint32_t head_len = (uint32_t) rand() % 40;
+        for (uint32_t i = 0; i < head_len; i++) {
+          insert = rrb_push_front(insert, (void *) ((intptr_t) rand()));
+        }
+        break;
+      }
+      default: { // part of the tree itself
+        to += (uint32_t) rand() % (cnt - from + 1);
+        const uint32_t insert_from = (uint32_t) rand() % (cnt + 1);
+        insert = rrb_slice(rrb, insert_from,
+                           insert_from + (uint32_t) rand() % (cnt - insert_from + 1));
+        break;
+      }
+      }
+      uint32_t insert_cnt = rrb_count(insert);
+      if (cnt - (to - from) + insert_cnt > MAX_CNT) {
+        insert = rrb_create();
+        insert_cnt = 0;
+      }
+      rrb_copy_range(insert, 0, insert_cnt, insert_vals);
+
+      rrb = rrb_splice(rrb, from, to, insert);
+      trrb = transient_rrb_splice(trrb, from, to, insert);
+      memmove(&vals[from + insert_cnt], &vals[to], (cnt - to) * sizeof(void *));
+      memcpy(&vals[from], insert_vals, insert_cnt * sizeof(void *));
+      cnt = cnt - (to - from) + insert_cnt;
+
+      if (op % 8 == 0 || op == OPS - 1) {
+        fail |= check_vals(rrb, vals, cnt, "persistent", t, op);
+        fail |= CHECK_TREE(rrb);
+        fail |= check_vals((const RRB *) trrb, vals, cnt, "transient", t, op);
+        fail |= check_vals(insert, insert_vals, insert_cnt, "inserted", t, op);
+        fail |= CHECK_TREE(insert);
+      }
+    }
+
+    if (rrb_splice(rrb, 1, 0, rrb_create()) != NULL ||
+        rrb_splice(rrb, 0, cnt + 1, rrb_create()) != NULL) {
+      printf("In run %u: out of range splice didn't return NULL.\n", t);
+      fail = 1;
+    }
+
+    const RRB *transient_result = transient_to_rrb(trrb);
+    fail |= check_vals(transient_result, vals, cnt, "transient", t, OPS);
+    fail |= CHECK_TREE(transient_result);
+    fail |= check_vals(original, original_vals, rrb_count(original),
+                       "original", t, OPS);
+    fail |= CHECK_TREE(original);
+    fail |= check_vals(base, base_vals, SIZE, "base", t, OPS);
+  }
+
+  return fail;
+}
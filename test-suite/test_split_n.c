@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 5000
+#define CATS 20
+#define TESTS 200
+#define MAX_K 300
+
+/**
+ * Splits dense, relaxed and small trees, with and without heads, into any
+ * number of parts, and checks that the parts are valid, that their sizes differ
+ * by at most one with the smallest first, and that they contain the items of
+ * the original tree in order.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+  const RRB **parts = GC_MALLOC(sizeof(RRB *) * MAX_K);
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *rrb;
+    switch (t % 4) {
+    case 0: rrb = rrb_slice(base, 0, (uint32_t) rand() % SIZE); break;
+    case 1: rrb = relaxed_rrb(base, CATS); break;
+    case 2: rrb = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    default: rrb = rrb_slice(relaxed_rrb(base, CATS), (uint32_t) rand() % 1000,
+                             SIZE); break;
+    }
+    const uint32_t head_len = (uint32_t) rand() % 50;
+    for (uint32_t i = 0; i < head_len; i++) {
+      rrb = rrb_push_front(rrb, (void *) ((intptr_t) rand()));
+    }
+    const uint32_t cnt = rrb_count(rrb);
+    uint32_t k = (t % 3 == 0) ? (uint32_t) rand() % 8 + 1
+                              : (uint32_t) rand() % MAX_K + 1;
+    if (t % 3 == 2 && cnt + 8 < MAX_K) {
+      // More parts than items, so some of them are empty.
+      k = cnt + (uint32_t) rand() % 8 + 1;
+    }
+
+    rrb_split_n(rrb, k, parts);
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < k; i++) {
+      const uint32_t part_cnt = rrb_count(parts[i]);
+      const uint32_t expected = cnt / k + (i < k - cnt % k ? 0 : 1);
+      if (part_cnt != expected) {
+        printf("In run %u: part %u of %u of a tree with %u items has %u items, "
+               "expected %u.\n", t, i, k, cnt, part_cnt, expected);
+        fail = 1;
+      }
+      fail |= CHECK_TREE(parts[i]);
+      for (uint32_t j = 0; j < part_cnt && pos + j < cnt; j++) {
+        if (rrb_nth(parts[i], j) != rrb_nth(rrb, pos + j)) {
+          printf("In run %u: expected val at pos %u in part %u of %u to be %ld, "
+                 "was %ld.\n", t, j, i, k, (intptr_t) rrb_nth(rrb, pos + j),
+                 (intptr_t) rrb_nth(parts[i], j));
+          fail = 1;
+        }
+      }
+      pos += part_cnt;
+
+      // The parts must still work with the other operations.
+      if (part_cnt != 0) {
+        fail |= CHECK_TREE(rrb_push(rrb_pop(parts[i]), NULL));
+      }
+    }
+    if (pos != cnt) {
+      printf("In run %u: the %u parts have %u items, expected %u.\n", t, k, pos,
+             cnt);
+      fail = 1;
+    }
+    fail |= CHECK_TREE(rrb);
+  }
+
+  return fail;
+}
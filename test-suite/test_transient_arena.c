@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 5000
+#define TESTS 40
+#define OPS 400
+
+static void* rand_val(void) {
+  return (void *) ((intptr_t) rand());
+}
+
+// Runs random operations on a transient in an arena and on a persistent tree,
+// and checks that they end up with the same items.
+static int check_session(const RRB *base, uint32_t t) {
+  int fail = 0;
+  const RRB *expected = base;
+  TransientRRB *trrb = rrb_to_transient_arena(base);
+  for (uint32_t op = 0; op < OPS; op++) {
+    const uint32_t cnt = rrb_count(expected);
+    const uint32_t index = (cnt == 0) ? 0 : (uint32_t) rand() % cnt;
+    void *val = rand_val();
+    switch (rand() % 10) {
+    case 0:
+      expected = rrb_push(expected, val);
+      trrb = transient_rrb_push(trrb, val);
+      break;
+    case 1:
+      if (cnt > 0) {
+        expected = rrb_pop(expected);
+        trrb = transient_rrb_pop(trrb);
+      }
+      break;
+    case 2:
+      if (cnt > 0) {
+        expected = rrb_update(expected, index, val);
+        trrb = transient_rrb_update(trrb, index, val);
+      }
+      break;
+    case 3:
+      expected = rrb_insert_at(expected, index, val);
+      trrb = transient_rrb_insert_at(trrb, index, val);
+      break;
+    case 4:
+      if (cnt > 0) {
+        expected = rrb_remove_at(expected, index);
+        trrb = transient_rrb_remove_at(trrb, index);
+      }
+      break;
+    case 5:
+      expected = rrb_push_front(expected, val);
+      trrb = transient_rrb_push_front(trrb, val);
+      break;
+    case 6:
+      if (cnt > 0) {
+        expected = rrb_pop_front(expected);
+        trrb = transient_rrb_pop_front(trrb);
+      }
+      break;
+    case 7: {
+      const uint32_t from = (uint32_t) rand() % SIZE;
+      const RRB *part = rrb_slice(base, from, from + (uint32_t) rand()
+                                              % (rrb_count(base) - from + 1));
+      expected = rrb_concat(expected, part);
+      trrb = transient_rrb_concat(trrb, part);
+      break;
+    }
+    case 8: {
+      const uint32_t from = index / 2;
+      const uint32_t to = from + (uint32_t) rand() % (cnt - from + 1);
+      expected = rrb_slice(expected, from, to);
+      trrb = transient_rrb_slice(trrb, from, to);
+      break;
+    }
+    default: {
+      const uint32_t to = index + (uint32_t) rand() % (cnt - index + 1);
+      const RRB *insert = rrb_slice(base, 0, (uint32_t) rand() % SIZE);
+      expected = rrb_splice(expected, index, to, insert);
+      trrb = transient_rrb_splice(trrb, index, to, insert);
+      break;
+    }
+    }
+  }
+
+  const RRB *result = transient_to_rrb(trrb);
+  fail |= CHECK_TREE(result);
+  if (rrb_count(result) != rrb_count(expected)) {
+    printf("In run %u: expected size %u, but was %u.\n", t,
+           rrb_count(expected), rrb_count(result));
+    return 1;
+  }
+  for (uint32_t i = 0; i < rrb_count(expected); i++) {
+    if (rrb_nth(result, i) != rrb_nth(expected, i)) {
+      printf("In run %u: wrong item at index %u.\n", t, i);
+      return 1;
+    }
+  }
+  return fail;
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  void **items = GC_MALLOC(sizeof(void *) * SIZE);
+  for (uint32_t i = 0; i < SIZE; i++) {
+    items[i] = rand_val();
+    base = rrb_push(base, items[i]);
+  }
+
+  for (uint32_t t = 0; t < TESTS && !fail; t++) {
+    fail |= check_session(base, t);
+  }
+
+  // Sessions can be run on the result of another one, and must leave their
+  // source untouched.
+  TransientRRB *trrb = rrb_to_transient_arena(rrb_create());
+  for (uint32_t i = 0; i < SIZE; i++) {
+    trrb = transient_rrb_push(trrb, items[i]);
+  }
+  const RRB *built = transient_to_rrb(trrb);
+  trrb = rrb_to_transient_arena(built);
+  for (uint32_t i = 0; i < SIZE; i++) {
+    trrb = transient_rrb_update(trrb, i, NULL);
+  }
+  const RRB *cleared = transient_to_rrb(trrb);
+  fail |= CHECK_TREE(built) | CHECK_TREE(cleared);
+  for (uint32_t i = 0; i < SIZE && !fail; i++) {
+    if (rrb_nth(built, i) != items[i] || rrb_nth(base, i) != items[i] ||
+        rrb_nth(cleared, i) != NULL) {
+      printf("Item %u was changed by a later session.\n", i);
+      fail = 1;
+    }
+  }
+
+  return fail;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#ifndef MIN
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#endif
+
+#define SIZE 3000
+#define TESTS 100
+#define MAX_PARTS 40
+
+// Random fragments: Empty, tail only, sliced or concatenated.
+static const RRB* rand_part(const RRB *base) {
+  uint32_t from = (uint32_t) rand() % SIZE;
+  uint32_t to;
+  switch (rand() % 5) {
+  case 0:
+    return rrb_create();
+  case 1:
+    to = from + (uint32_t) rand() % RRB_BRANCHING;
+    return rrb_slice(base, from, MIN(to, SIZE));
+  case 2: {
+    const RRB *left = rand_part(base);
+    return rrb_concat(left, rand_part(base));
+  }
+  default:
+    to = (uint32_t) (rand() % (SIZE - from)) + from;
+    return rrb_slice(base, from, to);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+  const void **list = GC_MALLOC(sizeof(void *) * SIZE * MAX_PARTS * 2);
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const uint32_t parts_len = 1 + (uint32_t) rand() % MAX_PARTS;
+    const RRB **parts = GC_MALLOC(sizeof(RRB *) * parts_len);
+    uint32_t *offsets = GC_MALLOC_ATOMIC(sizeof(uint32_t) * parts_len);
+    const RRB *expected = rrb_create();
+    uint32_t count = 0;
+    TransientRRB *trrb = rrb_to_transient(rrb_create());
+    for (uint32_t p = 0; p < parts_len; p++) {
+      parts[p] = rand_part(base);
+      expected = rrb_concat(expected, parts[p]);
+      offsets[p] = count;
+      for (uint32_t i = 0; i < rrb_count(parts[p]); i++) {
+        list[count++] = rrb_nth(parts[p], i);
+      }
+      trrb = transient_rrb_concat(trrb, parts[p]);
+      // Push onto the result now and then, to check that it's still editable
+      if (rand() % 4 == 0) {
+        list[count] = (void *) ((intptr_t) rand());
+        expected = rrb_push(expected, list[count]);
+        trrb = transient_rrb_push(trrb, list[count]);
+        count++;
+      }
+    }
+
+    if (transient_rrb_count(trrb) != count) {
+      printf("Expected size of transient rrb to be %u, but was %u.\n", count,
+             transient_rrb_count(trrb));
+      fail = 1;
+    }
+    const RRB *cat = transient_to_rrb(trrb);
+    fail |= CHECK_TREE(cat);
+    for (uint32_t i = 0; i < count; i++) {
+      if (rrb_nth(cat, i) != list[i] || rrb_nth(expected, i) != list[i]) {
+        printf("In run %u: expected val at pos %u to be %ld, was %ld.\n", t, i,
+               (intptr_t) list[i], (intptr_t) rrb_nth(cat, i));
+        fail = 1;
+      }
+    }
+
+    // The parts must be left untouched
+    for (uint32_t p = 0; p < parts_len; p++) {
+      fail |= CHECK_TREE(parts[p]);
+      for (uint32_t i = 0; i < rrb_count(parts[p]); i++) {
+        if (rrb_nth(parts[p], i) != list[offsets[p] + i]) {
+          printf("In run %u: part %u changed at pos %u.\n", t, p, i);
+          fail = 1;
+        }
+      }
+    }
+  }
+
+  return fail;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 20
+#define TESTS 100
+#define BATCHES 20
+#define MAX_BATCH 1500
+
+static uint32_t batch_size() {
+  switch (rand() % 4) {
+  case 0:
+    return (uint32_t) rand() % 40;
+  case 1:
+    return RRB_BRANCHING * (1 + (uint32_t) rand() % 40);
+  default:
+    return (uint32_t) rand() % MAX_BATCH;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+  const uint32_t max_size = SIZE * CATS + BATCHES * MAX_BATCH * 2;
+  const void **list = GC_MALLOC(sizeof(void *) * max_size);
+  const void **items = GC_MALLOC(sizeof(void *) * MAX_BATCH * 2);
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    // Start out empty, dense, sliced or relaxed
+    const RRB *rrb;
+    switch (t % 4) {
+    case 0:
+      rrb = rrb_create();
+      break;
+    case 1:
+      rrb = rrb_slice(base, 0, (uint32_t) rand() % SIZE);
+      break;
+    case 2:
+      rrb = rrb_slice(base, (uint32_t) rand() % SIZE, SIZE);
+      break;
+    default:
+      rrb = relaxed_rrb(base, CATS);
+      break;
+    }
+    uint32_t count = rrb_count(rrb);
+    for (uint32_t i = 0; i < count; i++) {
+      list[i] = rrb_nth(rrb, i);
+    }
+
+    TransientRRB *trrb = rrb_to_transient(rrb);
+    for (uint32_t b = 0; b < BATCHES; b++) {
+      const uint32_t n = batch_size();
+      for (uint32_t i = 0; i < n; i++) {
+        items[i] = list[count + i] = (void *) ((intptr_t) rand());
+      }
+      trrb = transient_rrb_push_many(trrb, items, n);
+      count += n;
+      // Mix in a single push now and then
+      if (rand() % 4 == 0) {
+        list[count] = (void *) ((intptr_t) rand());
+        trrb = transient_rrb_push(trrb, list[count]);
+        count++;
+      }
+    }
+
+    if (transient_rrb_count(trrb) != count) {
+      printf("Expected size of transient rrb to be %u, but was %u.\n", count,
+             transient_rrb_count(trrb));
+      fail = 1;
+    }
+    const RRB *pushed = transient_to_rrb(trrb);
+    fail |= CHECK_TREE(pushed);
+    for (uint32_t i = 0; i < count; i++) {
+      if (rrb_nth(pushed, i) != list[i]) {
+        printf("In run %u: expected val at pos %u to be %ld, was %ld.\n", t, i,
+               (intptr_t) list[i], (intptr_t) rrb_nth(pushed, i));
+        fail = 1;
+      }
+    }
+    // The original must be left untouched
+    for (uint32_t i = 0; i < rrb_count(rrb); i++) {
+      if (rrb_nth(rrb, i) != list[i]) {
+        printf("In run %u: original changed at pos %u.\n", t, i);
+        fail = 1;
+      }
+    }
+    fail |= CHECK_TREE(rrb);
+  }
+
+  return fail;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 3000
+#define CATS 20
+#define TESTS 200
+#define MAX_OPS 12
+
+/**
+ * Slices the same transient repeatedly, with pushes in between, and checks
+ * every step against persistent slicing. The original tree must be left
+ * untouched.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *original = (t % 2 == 0) ? relaxed_rrb(base, CATS) : base;
+    const uint32_t original_cnt = rrb_count(original);
+    void **original_vals = GC_MALLOC(sizeof(void *) * original_cnt);
+    rrb_copy_range(original, 0, original_cnt, original_vals);
+
+    const RRB *expected = original;
+    TransientRRB *trrb = rrb_to_transient(original);
+    const uint32_t ops = 1 + (uint32_t) rand() % MAX_OPS;
+    for (uint32_t op = 0; op < ops; op++) {
+      const uint32_t cnt = rrb_count(expected);
+      if (cnt > 0 && rand() % 4 != 0) {
+        const uint32_t from = (uint32_t) rand() % cnt;
+        const uint32_t to = from + (uint32_t) rand() % (cnt - from + 1);
+        expected = rrb_slice(expected, from, to);
+        trrb = transient_rrb_slice(trrb, from, to);
+      }
+      else {
+        const uint32_t pushes = (uint32_t) rand() % 100;
+        for (uint32_t i = 0; i < pushes; i++) {
+          void *val = (void *) ((intptr_t) rand());
+          expected = rrb_push(expected, val);
+          trrb = transient_rrb_push(trrb, val);
+        }
+      }
+
+      const uint32_t expected_cnt = rrb_count(expected);
+      if (transient_rrb_count(trrb) != expected_cnt) {
+        printf("In run %u, op %u: expected size %u, but was %u.\n", t, op,
+               expected_cnt, transient_rrb_count(trrb));
+        fail = 1;
+        break;
+      }
+      for (uint32_t i = 0; i < expected_cnt; i++) {
+        if (transient_rrb_nth(trrb, i) != rrb_nth(expected, i)) {
+          printf("In run %u, op %u: expected val at pos %u to be %ld, was "
+                 "%ld.\n", t, op, i, (intptr_t) rrb_nth(expected, i),
+                 (intptr_t) transient_rrb_nth(trrb, i));
+          fail = 1;
+        }
+      }
+    }
+
+    const RRB *sliced = transient_to_rrb(trrb);
+    fail |= CHECK_TREE(sliced);
+    fail |= CHECK_TREE(original);
+    for (uint32_t i = 0; i < original_cnt; i++) {
+      if (rrb_nth(original, i) != original_vals[i]) {
+        printf("In run %u: original changed at pos %u.\n", t, i);
+        fail = 1;
+      }
+    }
+  }
+
+  return fail;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2013-2014 Jean Niklas L'orange. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <gc/gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rrb.h"
+#include "test.h"
+
+#define SIZE 20000
+#define CATS 20
+#define TESTS 300
+#define MAX_UPDATES 3000
+
+/**
+ * Updates sorted, scattered indices and contiguous ranges in dense, relaxed and
+ * small trees with heads, and checks the results against plain arrays. The
+ * original trees must not be modified.
+ */
+int main(int argc, char *argv[]) {
+  GC_INIT();
+  setup_rand(argc == 2 ? argv[1] : NULL);
+
+  int fail = 0;
+
+  const RRB *base = rrb_create();
+  for (uint32_t i = 0; i < SIZE; i++) {
+    base = rrb_push(base, (void *) ((intptr_t) rand()));
+  }
+
+  uint32_t *indices = GC_MALLOC_ATOMIC(sizeof(uint32_t) * MAX_UPDATES);
+  void **elts = GC_MALLOC(sizeof(void *) * (SIZE + 100));
+  void **vals = GC_MALLOC(sizeof(void *) * (SIZE + 100));
+  void **original_vals = GC_MALLOC(sizeof(void *) * (SIZE + 100));
+
+  for (uint32_t t = 0; t < TESTS; t++) {
+    const RRB *original;
+    switch (t % 3) {
+    case 0: original = rrb_slice(base, 0, (uint32_t) rand() % SIZE); break;
+    case 1: original = rrb_slice(relaxed_rrb(base, CATS), 0, SIZE); break;
+    default: original = rrb_slice(base, 0, (uint32_t) rand() % 100); break;
+    }
+    const uint32_t head_len = (uint32_t) rand() % 50;
+    for (uint32_t i = 0; i < head_len; i++) {
+      original = rrb_push_front(original, (void *) ((intptr_t) rand()));
+    }
+    const uint32_t cnt = rrb_count(original);
+    rrb_copy_range(original, 0, cnt, original_vals);
+    memcpy(vals, original_vals, cnt * sizeof(void *));
+
+    const RRB *rrb;
+    if (rand() % 2 == 0) {
+      // Sorted indices, with duplicates where the last one wins.
+      const uint32_t n = (cnt == 0) ? 0 : (uint32_t) rand() % MAX_UPDATES;
+      for (uint32_t i = 0; i < n; i++) {
+        indices[i] = (uint32_t) rand() % cnt;
+      }
+      for (uint32_t i = 1; i < n; i++) {
+        for (uint32_t j = i; j > 0 && indices[j - 1] > indices[j]; j--) {
+          const uint32_t tmp = indices[j];
+          indices[j] = indices[j - 1];
+          indices[j - 1] = tmp;
+        }
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        elts[i] = (void *) ((intptr_t) rand());
+        vals[indices[i]] = elts[i];
+      }
+      rrb = rrb_update_many(original, indices, (const void **) elts, n);
+      if (n != 0 && rrb_update_many(original, indices, (const void **) elts,
+                                    n) == original) {
+        printf("In run %u: rrb_update_many returned the original tree.\n", t);
+        fail = 1;
+      }
+      indices[0] = cnt;
+      if (rrb_update_many(original, indices, (const void **) elts, 1) != NULL) {
+        printf("In run %u: out of range update didn't return NULL.\n", t);
+        fail = 1;
+      }
+    }
+    else {
+      const uint32_t from = (uint32_t) rand() % (cnt + 1);
+      const uint32_t n = (uint32_t) rand() % (cnt - from + 1);
+      for (uint32_t i = 0; i < n; i++) {
+        elts[i] = (void *) ((intptr_t) rand());
+        vals[from + i] = elts[i];
+      }
+      rrb = rrb_write_range(original, from, (const void **) elts, n);
+      if (rrb_write_range(original, from, (const void **) elts,
+                          cnt - from + 1) != NULL) {
+        printf("In run %u: out of range write didn't return NULL.\n", t);
+        fail = 1;
+      }
+    }
+
+    fail |= CHECK_TREE(rrb);
+    fail |= check_vals(rrb, vals, cnt, "updated", t, 0);
+    fail |= check_vals(original, original_vals, cnt, "original", t, 0);
+  }
+
+  return fail;
+}